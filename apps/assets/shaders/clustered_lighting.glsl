@@ -0,0 +1,34 @@
+// Point and spot lights, see clustered_lighting.h. Define LIGHTS_SET and
+// LIGHTS_BINDING before including.
+
+const uint kLightPoint = 0u;
+const uint kLightSpot = 1u;
+
+struct Light {
+  vec4 positionRange; // World space.
+  vec4 colorIntensity;
+  vec4 directionType; // w is the type.
+  vec4 spot; // Cosine of outer angle, 1 / (cos inner - cos outer).
+};
+
+layout(std430, set = LIGHTS_SET, binding = LIGHTS_BINDING)readonly buffer
+LightBuffer {
+  Light lights[];
+} lightBuffer;
+
+// Diffuse light reaching a surface, fading to zero at the range.
+vec3 lightContribution(Light light, vec3 position, vec3 normal) {
+  vec3 toLight = light.positionRange.xyz - position;
+  float distance2 = dot(toLight, toLight);
+  vec3 l = toLight * inversesqrt(max(distance2, 1e-8));
+  float ratio = distance2 / (light.positionRange.w * light.positionRange.w);
+  float window = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+  float attenuation = window * window / (distance2 + 1.0);
+  if (uint(light.directionType.w) == kLightSpot) {
+    float cosAngle = dot(-l, light.directionType.xyz);
+    attenuation *=
+        clamp((cosAngle - light.spot.x) * light.spot.y, 0.0, 1.0);
+  }
+  return light.colorIntensity.rgb * light.colorIntensity.w * attenuation *
+         max(dot(normal, l), 0.0);
+}
@@ -0,0 +1,17 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+
+#include "input_structures.glsl"
+#include "vertex_fetch.glsl"
+
+// Same position as mesh.vert, so depth test passes on equal.
+invariant gl_Position;
+
+void main()
+{
+  vec4 position = vec4(fetchPosition(gl_VertexIndex), 1.0f);
+
+  gl_Position = sceneData.viewproj * PushConstants.render_matrix * position;
+}
@@ -6,6 +6,8 @@ layout(set = 0, binding = 0)uniform SceneData {
   vec4 ambientColor;
   vec4 sunlightDirection; //w for sun power
   vec4 sunlightColor;
+  uvec4 lightGrid; // Tiles x and y, slices, max lights a cluster.
+  vec4 lightSlicing; // Log depth scale and bias, tile size in pixels.
 } sceneData;
 
 layout(set = 1, binding = 0)uniform GLTFMaterialData {
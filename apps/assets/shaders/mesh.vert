@@ -4,34 +4,19 @@
 #extension GL_EXT_buffer_reference : require
 
 #include "input_structures.glsl"
+#include "vertex_fetch.glsl"
+
+// Same position as depth pre-pass, so depth test passes on equal.
+invariant gl_Position;
 
 layout(location = 0)out vec3 outNormal;
 layout(location = 1)out vec3 outColor;
 layout(location = 2)out vec2 outUV;
-
-struct Vertex {
-
-  vec3 position;
-  float uv_x;
-  vec3 normal;
-  float uv_y;
-  vec4 color;
-};
-
-layout(buffer_reference, std430)readonly buffer VertexBuffer {
-  Vertex vertices[];
-};
-
-//push constants block
-layout(push_constant)uniform constants
-{
-  mat4 render_matrix;
-  VertexBuffer vertexBuffer;
-} PushConstants;
+layout(location = 3)out vec3 outPosition; // World space.
 
 void main()
 {
-  Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+  Vertex v = fetchVertex(gl_VertexIndex);
 
   vec4 position = vec4(v.position, 1.0f);
 
@@ -41,4 +26,5 @@ void main()
   outColor = v.color.xyz * materialData.colorFactors.xyz;
   outUV.x = v.uv_x;
   outUV.y = v.uv_y;
+  outPosition = (PushConstants.render_matrix * position).xyz;
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#include "input_structures.glsl"
+
+// Same as mesh.frag, plus the point and spot lights culled into the cluster
+// of the fragment by light_cull.comp.
+#define LIGHTS_SET 0
+#define LIGHTS_BINDING 1
+#include "clustered_lighting.glsl"
+
+layout(std430, set = 0, binding = 2)readonly buffer ClusterCounts {
+  uint counts[];
+} clusterCounts;
+layout(std430, set = 0, binding = 3)readonly buffer ClusterIndices {
+  uint indices[];
+} clusterIndices;
+
+layout(location = 0)in vec3 inNormal;
+layout(location = 1)in vec3 inColor;
+layout(location = 2)in vec2 inUV;
+layout(location = 3)in vec3 inPosition;
+
+layout(location = 0)out vec4 outFragColor;
+
+uint clusterIndex() {
+  uvec4 grid = sceneData.lightGrid;
+  uvec2 tile = min(uvec2(gl_FragCoord.xy / sceneData.lightSlicing.zw),
+                   grid.xy - 1u);
+  float depth = -(sceneData.view * vec4(inPosition, 1.0)).z;
+  // Slices 1 to n - 2 are even in log depth, the outer two take the rest.
+  float slice = floor(log(max(depth, 1e-6)) * sceneData.lightSlicing.x +
+                      sceneData.lightSlicing.y) + 1.0;
+  uint z = uint(clamp(slice, 0.0, float(grid.z - 1u)));
+  return tile.x + grid.x * (tile.y + grid.y * z);
+}
+
+void main()
+{
+  float lightValue = max(dot(inNormal, sceneData.sunlightDirection.xyz), 0.1f);
+
+  vec3 color = inColor * texture(colorTex, inUV).xyz;
+  vec3 ambient = color * sceneData.ambientColor.xyz;
+  vec3 lit = color * lightValue * sceneData.sunlightColor.w + ambient;
+
+  vec3 normal = normalize(inNormal);
+  uint cluster = clusterIndex();
+  uint count = clusterCounts.counts[cluster];
+  uint first = cluster * sceneData.lightGrid.w;
+  for (uint i = 0u; i < count; i++) {
+    Light light = lightBuffer.lights[clusterIndices.indices[first + i]];
+    lit += color * lightContribution(light, inPosition, normal);
+  }
+
+  outFragColor = vec4(lit, 1.0f);
+}
@@ -0,0 +1,76 @@
+// Vertex fetch through buffer device address, full or compact layout.
+//
+// Compact layout, 16 bytes per vertex:
+//   x: position xy, snorm16x2 relative to the surface bound
+//   y: position z, snorm16, high half unused
+//   z: octahedral normal, snorm16x2
+//   w: uv, half2
+// Color comes from a separate unorm8x4 stream, white when absent.
+
+const uint kVertexLayoutCompact = 1;
+const uint kVertexLayoutColor = 2;
+
+struct Vertex {
+  vec3 position;
+  float uv_x;
+  vec3 normal;
+  float uv_y;
+  vec4 color;
+};
+
+layout(buffer_reference, std430)readonly buffer VertexBuffer {
+  Vertex vertices[];
+};
+layout(buffer_reference, std430)readonly buffer CompactVertexBuffer {
+  uvec4 vertices[];
+};
+layout(buffer_reference, std430)readonly buffer ColorBuffer {
+  uint colors[];
+};
+
+//push constants block
+layout(push_constant)uniform constants
+{
+  mat4 render_matrix;
+  VertexBuffer vertexBuffer;
+  ColorBuffer colorBuffer;
+  vec4 positionBound; // Origin and radius of the surface bound.
+  uint vertexLayout;
+} PushConstants;
+
+vec3 decodePosition(uvec4 data) {
+  vec3 p = vec3(unpackSnorm2x16(data.x), unpackSnorm2x16(data.y).x);
+  return PushConstants.positionBound.xyz + p * PushConstants.positionBound.w;
+}
+
+vec3 decodeOctahedral(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+vec3 fetchPosition(uint index) {
+  if ((PushConstants.vertexLayout & kVertexLayoutCompact) == 0)
+  return PushConstants.vertexBuffer.vertices[index].position;
+  CompactVertexBuffer compact = CompactVertexBuffer(PushConstants.vertexBuffer);
+  return decodePosition(compact.vertices[index]);
+}
+
+Vertex fetchVertex(uint index) {
+  if ((PushConstants.vertexLayout & kVertexLayoutCompact) == 0)
+  return PushConstants.vertexBuffer.vertices[index];
+  CompactVertexBuffer compact = CompactVertexBuffer(PushConstants.vertexBuffer);
+  uvec4 data = compact.vertices[index];
+  Vertex v;
+  v.position = decodePosition(data);
+  v.normal = decodeOctahedral(unpackSnorm2x16(data.z));
+  vec2 uv = unpackHalf2x16(data.w);
+  v.uv_x = uv.x;
+  v.uv_y = uv.y;
+  v.color = vec4(1.0);
+  if ((PushConstants.vertexLayout & kVertexLayoutColor) != 0)
+  v.color = unpackUnorm4x8(PushConstants.colorBuffer.colors[index]);
+  return v;
+}
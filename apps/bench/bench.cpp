@@ -0,0 +1,196 @@
+#include "bench.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+namespace bench {
+const void *volatile g_sink = nullptr;
+std::vector<Case> &registry() {
+  static std::vector<Case> cases;
+  return cases;
+}
+} // namespace bench
+
+namespace {
+struct Options {
+  const char *filter{nullptr};
+  const char *out_path{nullptr};
+  const char *baseline_path{nullptr};
+  double threshold{0.1}; // Slowdown ratio counted as a regression.
+  double min_time_ms{100.0};
+  int repetitions{5};
+};
+struct Result {
+  std::string name;
+  uint64_t iterations;
+  double ns_per_op;     // Median of repetitions.
+  double ns_per_op_min; // Least noisy estimate.
+  double items_per_second;
+};
+
+/// @brief Double iterations until one run takes long enough to time well.
+uint64_t calibrate(bench::CaseFn fn, double min_time_ms) {
+  uint64_t iterations = 1;
+  while (true) {
+    bench::State state(iterations);
+    fn(state);
+    double ms = state.elapsedNs() / 1e6;
+    if (ms >= min_time_ms || iterations >= (uint64_t(1) << 40))
+      return iterations;
+    // Aim a bit over, rather than doubling from a tiny sample.
+    double scale = ms > 0.0 ? 1.4 * min_time_ms / ms : 10.0;
+    iterations = std::max(iterations * 2,
+                          static_cast<uint64_t>(iterations *
+                                                std::min(scale, 100.0)));
+  }
+}
+Result run(const bench::Case &c, const Options &options) {
+  uint64_t iterations = calibrate(c.fn, options.min_time_ms);
+  std::vector<double> ns_per_op;
+  uint64_t items = 0;
+  for (int r = 0; r < options.repetitions; r++) {
+    bench::State state(iterations);
+    c.fn(state);
+    ns_per_op.push_back(state.elapsedNs() / iterations);
+    items = state.items();
+  }
+  std::sort(ns_per_op.begin(), ns_per_op.end());
+  Result result;
+  result.name = c.name;
+  result.iterations = iterations;
+  result.ns_per_op = ns_per_op[ns_per_op.size() / 2];
+  result.ns_per_op_min = ns_per_op.front();
+  result.items_per_second =
+      items > 0 ? items * 1e9 / result.ns_per_op : 0.0;
+  return result;
+}
+
+/// @brief One case per line, so the baseline is read back without a parser.
+bool writeJson(const char *path, const std::vector<Result> &results) {
+  FILE *file = fopen(path, "w");
+  if (!file)
+    return false;
+  fmt::print(file, "{{\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    fmt::print(file,
+               "    {{\"name\": \"{}\", \"iterations\": {}, \"ns_per_op\": "
+               "{:.3f}, \"ns_per_op_min\": {:.3f}, \"items_per_second\": "
+               "{:.1f}}}{}\n",
+               r.name, r.iterations, r.ns_per_op, r.ns_per_op_min,
+               r.items_per_second, i + 1 < results.size() ? "," : "");
+  }
+  fmt::print(file, "  ]\n}}\n");
+  fclose(file);
+  return true;
+}
+std::map<std::string, double> readBaseline(const char *path) {
+  std::map<std::string, double> baseline;
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return baseline;
+  char line[512];
+  while (fgets(line, sizeof(line), file)) {
+    const char *name = strstr(line, "\"name\": \"");
+    const char *ns = strstr(line, "\"ns_per_op\": ");
+    if (!name || !ns)
+      continue;
+    name += strlen("\"name\": \"");
+    const char *name_end = strchr(name, '"');
+    if (!name_end)
+      continue;
+    baseline[std::string(name, name_end)] =
+        std::atof(ns + strlen("\"ns_per_op\": "));
+  }
+  fclose(file);
+  return baseline;
+}
+
+bool parseArgs(int argc, char *argv[], Options &options) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (i + 1 >= argc) {
+      fmt::println("Missing value of {}", arg);
+      return false;
+    }
+    const char *value = argv[++i];
+    if (strcmp(arg, "--filter") == 0)
+      options.filter = value;
+    else if (strcmp(arg, "--out") == 0)
+      options.out_path = value;
+    else if (strcmp(arg, "--baseline") == 0)
+      options.baseline_path = value;
+    else if (strcmp(arg, "--threshold") == 0)
+      options.threshold = std::atof(value);
+    else if (strcmp(arg, "--min-time-ms") == 0)
+      options.min_time_ms = std::atof(value);
+    else if (strcmp(arg, "--repetitions") == 0)
+      options.repetitions = std::max(1, std::atoi(value));
+    else {
+      fmt::println("Unknown argument {}", arg);
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+/**
+ * @brief Run every case matching --filter, print a table, write --out as
+ *        JSON and compare with --baseline. Exits 1 when a case is slower
+ *        than its baseline by more than --threshold.
+ */
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parseArgs(argc, argv, options)) {
+    fmt::println("Usage: bench [--filter s] [--out file] [--baseline file] "
+                 "[--threshold 0.1] [--min-time-ms 100] [--repetitions 5]");
+    return 2;
+  }
+  std::map<std::string, double> baseline;
+  if (options.baseline_path) {
+    baseline = readBaseline(options.baseline_path);
+    if (baseline.empty())
+      fmt::println("No baseline read from {}", options.baseline_path);
+  }
+
+  std::vector<Result> results;
+  int n_regressions = 0;
+  fmt::println("{:<32} {:>14} {:>14} {:>14} {:>10}", "case", "ns/op",
+               "min ns/op", "items/s", "vs base");
+  for (const bench::Case &c : bench::registry()) {
+    if (options.filter && !strstr(c.name, options.filter))
+      continue;
+    Result r = run(c, options);
+    std::string versus;
+    auto it = baseline.find(r.name);
+    if (it != baseline.end() && it->second > 0.0) {
+      double ratio = r.ns_per_op / it->second;
+      versus = fmt::format("{:+.1f}%", 100.0 * (ratio - 1.0));
+      if (ratio > 1.0 + options.threshold) {
+        versus += " REGRESSED";
+        n_regressions++;
+      }
+    }
+    fmt::println("{:<32} {:>14.1f} {:>14.1f} {:>14.3g} {:>10}", r.name,
+                 r.ns_per_op, r.ns_per_op_min, r.items_per_second, versus);
+    results.push_back(std::move(r));
+  }
+  if (options.out_path) {
+    if (writeJson(options.out_path, results))
+      fmt::println("Results written to {}", options.out_path);
+    else
+      fmt::println("Failed to open {}", options.out_path);
+  }
+  if (n_regressions > 0) {
+    fmt::println("{} cases regressed over {:.0f}%", n_regressions,
+                 100.0 * options.threshold);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file bench.h
+ * @brief Micro benchmark harness, Google Benchmark style, no dependency.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/**
+ * @brief Passed to a case. Setup goes before the loop and is not timed:
+ *        while (state.keepRunning()) { ... }
+ */
+class State {
+public:
+  explicit State(uint64_t iterations)
+      : m_iterations(iterations), m_left(iterations) {}
+
+  bool keepRunning() {
+    if (m_left == m_iterations)
+      m_start = std::chrono::steady_clock::now();
+    if (m_left == 0) {
+      m_end = std::chrono::steady_clock::now();
+      return false;
+    }
+    m_left--;
+    return true;
+  }
+  /// @brief Items each iteration processes, for throughput.
+  void setItemsPerIteration(uint64_t n) { m_items = n; }
+
+  uint64_t items() const { return m_items; }
+  double elapsedNs() const {
+    return std::chrono::duration<double, std::nano>(m_end - m_start).count();
+  }
+
+private:
+  uint64_t m_iterations;
+  uint64_t m_left;
+  uint64_t m_items{0};
+  std::chrono::steady_clock::time_point m_start;
+  std::chrono::steady_clock::time_point m_end;
+};
+
+using CaseFn = void (*)(State &);
+struct Case {
+  const char *name;
+  CaseFn fn;
+};
+std::vector<Case> &registry();
+
+struct Registrar {
+  Registrar(const char *name, CaseFn fn) { registry().push_back({name, fn}); }
+};
+#define BENCH(fn) static bench::Registrar bench_registrar_##fn(#fn, fn)
+
+extern const void *volatile g_sink;
+/// @brief Keep a result from being optimized away.
+template <typename T> inline void doNotOptimize(const T &value) {
+  g_sink = static_cast<const void *>(&value);
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+} // namespace bench
@@ -0,0 +1,274 @@
+/**
+ * @file engine_bench.cpp
+ * @brief CPU hot paths of the engine. Nothing here touches a Vulkan device,
+ *        handles are left null.
+ */
+#include "bench.h"
+
+#include "engine.h"
+#include "renderable.h"
+#include "vk_descriptors.h"
+#include "vk_loader.h"
+
+#include <fastgltf/core.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/transform.hpp>
+
+namespace {
+
+constexpr uint32_t kSeed = 1;
+
+glm::mat4 benchViewProj() {
+  glm::mat4 view = glm::lookAt(glm::vec3{0.f, 10.f, 60.f}, glm::vec3{0.f},
+                               glm::vec3{0.f, 1.f, 0.f});
+  // Same projection as the engine.
+  glm::mat4 proj =
+      glm::perspective(glm::radians(70.f), 16.f / 9.f, 0.1f, 10000.f);
+  proj[1][1] *= -1;
+  return proj * view;
+}
+glm::mat4 randomTransform(std::mt19937 &rng, float extent) {
+  std::uniform_real_distribution<float> offset(-extent, extent);
+  std::uniform_real_distribution<float> angle(0.f, 6.2831853f);
+  return glm::translate(glm::vec3{offset(rng), offset(rng), offset(rng)}) *
+         glm::rotate(angle(rng), glm::vec3{0.f, 1.f, 0.f});
+}
+
+void visibility(bench::State &state) {
+  constexpr uint32_t kObjects = 4096;
+  std::mt19937 rng(kSeed);
+  std::uniform_real_distribution<float> radius(0.2f, 3.f);
+  // Spread wider than the frustum, about half are culled.
+  std::vector<RenderObject> objects(kObjects);
+  for (RenderObject &obj : objects) {
+    obj.transform = randomTransform(rng, 80.f);
+    obj.bound.origin = glm::vec3{0.f};
+    obj.bound.radius = radius(rng);
+  }
+  glm::mat4 view_proj = benchViewProj();
+  state.setItemsPerIteration(kObjects);
+  while (state.keepRunning()) {
+    uint32_t n_visible = 0;
+    for (const RenderObject &obj : objects)
+      n_visible += isVisible(obj, view_proj) ? 1 : 0;
+    bench::doNotOptimize(n_visible);
+  }
+}
+BENCH(visibility);
+
+/// @brief Tree of n nodes, node i under node (i - 1) / branching.
+template <typename T>
+std::vector<std::shared_ptr<T>> buildTree(uint32_t n, uint32_t branching,
+                                          std::mt19937 &rng) {
+  std::vector<std::shared_ptr<T>> nodes(n);
+  for (uint32_t i = 0; i < n; i++) {
+    nodes[i] = std::make_shared<T>();
+    nodes[i]->transform_local = randomTransform(rng, 4.f);
+    if (i > 0) {
+      std::shared_ptr<T> &parent = nodes[(i - 1) / branching];
+      nodes[i]->parent = parent;
+      parent->children.push_back(nodes[i]);
+    }
+  }
+  return nodes;
+}
+
+void updateTransform(bench::State &state) {
+  constexpr uint32_t kNodes = 10000;
+  std::mt19937 rng(kSeed);
+  auto nodes = buildTree<Node>(kNodes, 8, rng);
+  state.setItemsPerIteration(kNodes);
+  while (state.keepRunning()) {
+    nodes[0]->updateTransform(glm::mat4{1.f});
+    bench::doNotOptimize(nodes.back()->transform_world);
+  }
+}
+BENCH(updateTransform);
+
+void meshNodeDraw(bench::State &state) {
+  constexpr uint32_t kNodes = 10000;
+  constexpr uint32_t kMeshes = 16;
+  constexpr uint32_t kSurfaces = 2;
+  std::mt19937 rng(kSeed);
+  auto material = std::make_shared<GLTFMaterial>();
+  material->data.pass_type = MaterialPass::BasicMainColor;
+  std::vector<std::shared_ptr<MeshAsset>> meshes(kMeshes);
+  for (uint32_t m = 0; m < kMeshes; m++) {
+    meshes[m] = std::make_shared<MeshAsset>();
+    for (uint32_t s = 0; s < kSurfaces; s++) {
+      GeometrySurface surface;
+      surface.start_index = s * 3000;
+      surface.count = 3000;
+      surface.material = material;
+      surface.bound = {glm::vec3{0.f}, 1.f};
+      meshes[m]->surfaces.push_back(std::move(surface));
+    }
+  }
+  // Root is a plain node, as a scene file has.
+  auto root = std::make_shared<Node>();
+  root->transform_local = glm::mat4{1.f};
+  for (uint32_t i = 0; i < kNodes; i++) {
+    auto node = std::make_shared<MeshNode>();
+    node->transform_local = randomTransform(rng, 100.f);
+    node->mesh = meshes[i % kMeshes];
+    node->parent = root;
+    root->children.push_back(node);
+  }
+  root->updateTransform(glm::mat4{1.f});
+
+  DrawContext context;
+  state.setItemsPerIteration(kNodes * kSurfaces);
+  while (state.keepRunning()) {
+    // Keep the capacity, as the engine does between frames.
+    context.opaque_surfaces.clear();
+    context.transparent_surfaces.clear();
+    context.n_triangles_full = 0;
+    context.n_triangles_selected = 0;
+    root->draw(glm::mat4{1.f}, context);
+    bench::doNotOptimize(context.opaque_surfaces.back());
+  }
+}
+BENCH(meshNodeDraw);
+
+std::string base64(const std::vector<uint8_t> &bytes) {
+  static const char *kTable =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((bytes.size() + 2) / 3 * 4);
+  for (size_t i = 0; i < bytes.size(); i += 3) {
+    uint32_t n = uint32_t(bytes[i]) << 16;
+    if (i + 1 < bytes.size())
+      n |= uint32_t(bytes[i + 1]) << 8;
+    if (i + 2 < bytes.size())
+      n |= bytes[i + 2];
+    out += kTable[(n >> 18) & 63];
+    out += kTable[(n >> 12) & 63];
+    out += i + 1 < bytes.size() ? kTable[(n >> 6) & 63] : '=';
+    out += i + 2 < bytes.size() ? kTable[n & 63] : '=';
+  }
+  return out;
+}
+template <typename T>
+size_t appendBytes(std::vector<uint8_t> &bytes, const std::vector<T> &data) {
+  size_t offset = bytes.size();
+  bytes.resize(offset + data.size() * sizeof(T));
+  std::memcpy(bytes.data() + offset, data.data(), data.size() * sizeof(T));
+  return offset;
+}
+
+/**
+ * @brief Grid primitive with positions, normals, uvs and 32-bit indices,
+ *        parsed once from an in-memory file with an embedded buffer.
+ */
+fastgltf::Asset &gridAsset() {
+  static std::unique_ptr<fastgltf::Asset> asset;
+  if (asset)
+    return *asset;
+
+  constexpr uint32_t kSide = 128;
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<glm::vec2> uvs;
+  std::vector<uint32_t> indices;
+  for (uint32_t y = 0; y < kSide; y++) {
+    for (uint32_t x = 0; x < kSide; x++) {
+      glm::vec2 uv = glm::vec2{x, y} / float(kSide - 1);
+      positions.push_back(glm::vec3{uv.x, 0.f, uv.y});
+      normals.push_back(glm::vec3{0.f, 1.f, 0.f});
+      uvs.push_back(uv);
+    }
+  }
+  for (uint32_t y = 0; y + 1 < kSide; y++) {
+    for (uint32_t x = 0; x + 1 < kSide; x++) {
+      uint32_t i = y * kSide + x;
+      indices.insert(indices.end(),
+                     {i, i + kSide, i + 1, i + 1, i + kSide, i + kSide + 1});
+    }
+  }
+  std::vector<uint8_t> bytes;
+  size_t position_offset = appendBytes(bytes, positions);
+  size_t normal_offset = appendBytes(bytes, normals);
+  size_t uv_offset = appendBytes(bytes, uvs);
+  size_t index_offset = appendBytes(bytes, indices);
+
+  std::string json = fmt::format(
+      R"({{"asset": {{"version": "2.0"}},
+"buffers": [{{"byteLength": {}, "uri": "{}"}}],
+"bufferViews": [
+  {{"buffer": 0, "byteOffset": {}, "byteLength": {}}},
+  {{"buffer": 0, "byteOffset": {}, "byteLength": {}}},
+  {{"buffer": 0, "byteOffset": {}, "byteLength": {}}},
+  {{"buffer": 0, "byteOffset": {}, "byteLength": {}}}],
+"accessors": [
+  {{"bufferView": 0, "componentType": 5126, "count": {}, "type": "VEC3",
+    "min": [0, 0, 0], "max": [1, 0, 1]}},
+  {{"bufferView": 1, "componentType": 5126, "count": {}, "type": "VEC3"}},
+  {{"bufferView": 2, "componentType": 5126, "count": {}, "type": "VEC2"}},
+  {{"bufferView": 3, "componentType": 5125, "count": {}, "type": "SCALAR"}}],
+"meshes": [{{"primitives": [{{"attributes":
+  {{"POSITION": 0, "NORMAL": 1, "TEXCOORD_0": 2}}, "indices": 3}}]}}]
+}})",
+      bytes.size(), "data:application/octet-stream;base64," + base64(bytes),
+      position_offset,
+      positions.size() * sizeof(glm::vec3), normal_offset,
+      normals.size() * sizeof(glm::vec3), uv_offset,
+      uvs.size() * sizeof(glm::vec2), index_offset,
+      indices.size() * sizeof(uint32_t), positions.size(), normals.size(),
+      uvs.size(), indices.size());
+
+  fastgltf::Parser parser{};
+  auto data = fastgltf::GltfDataBuffer::FromBytes(
+      reinterpret_cast<const std::byte *>(json.data()), json.size());
+  if (data.error() != fastgltf::Error::None) {
+    fmt::println("Failed to buffer the grid glTF.");
+    std::exit(1);
+  }
+  auto load = parser.loadGltfJson(data.get(), ".", fastgltf::Options::None);
+  if (!load) {
+    fmt::println("Failed to load the grid glTF: {}",
+                 fastgltf::to_underlying(load.error()));
+    std::exit(1);
+  }
+  asset = std::make_unique<fastgltf::Asset>(std::move(load.get()));
+  return *asset;
+}
+
+void accessorConversion(bench::State &state) {
+  fastgltf::Asset &gltf = gridAsset();
+  fastgltf::Primitive &primitive = gltf.meshes[0].primitives[0];
+  std::vector<uint32_t> indices;
+  std::vector<Vertex> vertices;
+  readPrimitive(gltf, primitive, indices, vertices);
+  state.setItemsPerIteration(vertices.size());
+  while (state.keepRunning()) {
+    indices.clear();
+    vertices.clear();
+    readPrimitive(gltf, primitive, indices, vertices);
+    bench::doNotOptimize(vertices.back());
+  }
+}
+BENCH(accessorConversion);
+
+void descriptorWriter(bench::State &state) {
+  // Same writes as a material instance takes.
+  DescriptorWriter writer;
+  state.setItemsPerIteration(4);
+  while (state.keepRunning()) {
+    writer.clear();
+    writer.writeBuffer(0, VK_NULL_HANDLE, 256, 0,
+                       VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    for (int binding = 1; binding <= 3; binding++)
+      writer.writeImage(binding, VK_NULL_HANDLE, VK_NULL_HANDLE,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    bench::doNotOptimize(writer);
+  }
+}
+BENCH(descriptorWriter);
+
+} // namespace
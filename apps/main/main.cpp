@@ -3,8 +3,10 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 
-int main(int, char *[]) {
+int main(int argc, char *argv[]) {
   Engine engine{};
+  if (!parseBenchmarkArgs(argc, argv, engine.benchmark_config))
+    return 1;
   std::cout << "init" << std::endl;
   engine.init();
   fmt::print("run\n");
@@ -12,5 +14,5 @@ int main(int, char *[]) {
   fmt::print("cleanup\n");
   engine.cleanup();
 
-  return 0;
+  return engine.benchmarkFailed() ? 1 : 0;
 }
\ No newline at end of file
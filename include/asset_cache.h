@@ -0,0 +1,76 @@
+/**
+ * @file asset_cache.h
+ * @brief Engine-wide cache of textures and samplers shared by scenes.
+ */
+#pragma once
+
+#include "vk_types.h"
+#include "texture_streaming.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace assetutil {
+constexpr uint64_t kHashSeed = 0xcbf29ce484222325ull;
+/// @brief 64-bit FNV-1a, chained through seed.
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = kHashSeed);
+/// @brief Hash of the state a sampler is made of, pNext is ignored.
+uint64_t hashSampler(const VkSamplerCreateInfo &info);
+} // namespace assetutil
+
+struct AssetCacheStats {
+  uint32_t texture_hits{0};
+  uint32_t texture_misses{0};
+  uint32_t sampler_hits{0};
+  uint32_t sampler_misses{0};
+  size_t texture_bytes_saved{0}; // Full mip chains not uploaded twice.
+  uint32_t n_textures{0};
+  uint32_t n_samplers{0};
+};
+
+/**
+ * @brief Reference counted textures by content hash and samplers by create
+ *        info hash. Each acquire is paired with a release, the resource is
+ *        freed with the last one.
+ * @note  Hashes are trusted, a 64-bit collision would share wrong content.
+ *        Main thread only but for hasTexture().
+ */
+class AssetCache {
+public:
+  void init(Engine *engine);
+  void destroy();
+
+  /// @brief Whether a texture is cached, the only call safe off the main
+  ///        thread. It may be released before acquired.
+  bool hasTexture(uint64_t hash) const;
+  /// @brief Take a reference if cached, no decoding needed then.
+  std::optional<TextureHandle> acquireTexture(uint64_t hash);
+  /// @brief Cache a texture on a miss, with one reference.
+  TextureHandle addTexture(uint64_t hash, TextureSource &&source);
+  void releaseTexture(TextureHandle texture);
+
+  VkSampler acquireSampler(const VkSamplerCreateInfo &info);
+  void releaseSampler(VkSampler sampler);
+
+  const AssetCacheStats &stats() const { return m_stats; }
+
+private:
+  struct CachedTexture {
+    uint64_t hash;
+    uint32_t refs;
+    size_t bytes;
+  };
+  struct CachedSampler {
+    VkSampler sampler;
+    uint32_t refs;
+  };
+
+  Engine *m_engine{nullptr};
+  // Guards writes of m_texture_by_hash, and reads off the main thread.
+  mutable std::mutex m_mutex;
+  std::unordered_map<uint64_t, TextureHandle> m_texture_by_hash;
+  std::unordered_map<TextureHandle, CachedTexture> m_textures;
+  std::unordered_map<uint64_t, CachedSampler> m_samplers;
+  std::unordered_map<VkSampler, uint64_t> m_sampler_hashes;
+  AssetCacheStats m_stats;
+};
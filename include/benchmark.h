@@ -0,0 +1,109 @@
+/**
+ * @file benchmark.h
+ * @brief Scripted camera runs with reports, to compare builds.
+ */
+#pragma once
+
+#include "vk_types.h"
+#include "camera.h"
+#include "scene_manager.h"
+
+struct EngineStats;
+
+struct CameraKey {
+  float time; // Seconds from the start of the path.
+  glm::vec3 position;
+  float pitch;
+  float yaw;
+};
+
+/// @brief Camera keys played back as a Catmull-Rom spline.
+class CameraPath {
+public:
+  std::vector<CameraKey> keys; // By increasing time.
+
+  /// @brief Text file, one "time x y z pitch yaw" key per line, # comments.
+  bool load(const std::string &path);
+  bool save(const std::string &path) const;
+  /// @brief Keys of a circle around center, looking at it.
+  void orbit(glm::vec3 center, float radius, float height, float duration,
+             uint32_t n_keys = 16);
+
+  float duration() const { return keys.empty() ? 0.f : keys.back().time; }
+  /// @brief Place the camera at time, clamped to the path.
+  void sample(float time, Camera &camera) const;
+};
+
+struct BenchmarkConfig {
+  bool enabled{false};
+  std::string scene_path{"../../assets/models/structure.glb"};
+  uint32_t synthetic_objects{0}; // Generate a scene instead, if not 0.
+  std::string camera_path; // Orbit around the origin if empty.
+  std::string report_path{"benchmark.json"};
+  uint32_t n_warmup_frames{60};
+  uint32_t n_frames{600};
+  float timestep{1.f / 60.f}; // Path time advanced per frame.
+  bool hidden_window{false};
+  // Vulkan calls of the measured frames, see vk_call_stats.h.
+  std::string call_stats_path; // Not counted if empty.
+  bool time_calls{false}; // Inflates record times of the report.
+  uint32_t n_lights{0}; // Clustered lighting on, if not 0.
+  // Job threads to cores, for steadier timings. Also outside benchmarks.
+  bool pin_threads{false};
+};
+/**
+ * @brief Parse --benchmark [scene], --synthetic n, --camera-path file,
+ *        --frames n, --warmup n, --timestep s, --report file, --hidden,
+ *        --call-stats file, --time-calls, --lights n and --pin-threads.
+ * @return False on unknown or incomplete arguments.
+ */
+bool parseBenchmarkArgs(int argc, char *argv[], BenchmarkConfig &config);
+
+/// @brief Stats of one measured frame.
+struct BenchmarkSample {
+  float frame_ms;
+  float cpu_draw_ms;
+  float scene_update_ms;
+  float update_wait_ms; // Part of the update not overlapped with the frame.
+  float record_ms;
+  float gpu_ms; // Of the frame finished kFrameOverlap frames earlier.
+  int n_drawcalls;
+  int n_triangles;
+  VkDeviceSize device_memory; // Device local heaps, whole process.
+};
+
+/**
+ * @brief Load a scene, then render it along a camera path with a fixed
+ *        timestep and write a JSON report of the frames.
+ * @note  Camera input is ignored while running. Frames are stepped by count,
+ *        not by wall time, so every run sees the same views in the same
+ *        order. Warm-up frames let streaming and pipelined stats settle.
+ */
+class BenchmarkRunner {
+public:
+  void init(Engine *engine, const BenchmarkConfig &config);
+  bool running() const {
+    return m_state != State::Idle && m_state != State::Done;
+  }
+  bool done() const { return m_state == State::Done; }
+  bool failed() const { return m_failed; }
+
+  /// @brief Place the camera for the frame about to be drawn.
+  void beginFrame(Camera &camera);
+  /// @brief Take stats of the frame just drawn, report after the last.
+  void endFrame(const EngineStats &stats);
+
+private:
+  enum class State { Idle, Loading, Warmup, Measuring, Done };
+
+  void writeReport();
+
+  Engine *m_engine{nullptr};
+  BenchmarkConfig m_config;
+  CameraPath m_path;
+  SceneFuture m_scene;
+  State m_state{State::Idle};
+  bool m_failed{false};
+  uint32_t m_frame{0}; // Within the current state.
+  std::vector<BenchmarkSample> m_samples;
+};
@@ -0,0 +1,97 @@
+/**
+ * @file clustered_lighting.h
+ * @brief Point and spot lights culled into a view space froxel grid.
+ */
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+
+struct GPUSceneData;
+
+enum class LightType : uint32_t { Point, Spot };
+
+struct Light {
+  LightType type{LightType::Point};
+  glm::vec3 position{0.f};
+  glm::vec3 direction{0.f, -1.f, 0.f}; // Spot only, normalized.
+  glm::vec3 color{1.f};
+  float intensity{1.f};
+  float range{10.f}; // No light reaches further.
+  // Spot only, half angles in radians.
+  float inner_angle{0.3f};
+  float outer_angle{0.5f};
+};
+/// @brief GPU layout, see clustered_lighting.glsl.
+struct GPULight {
+  glm::vec4 position_range;
+  glm::vec4 color_intensity;
+  glm::vec4 direction_type; // w is LightType.
+  glm::vec4 spot;           // Cosine of outer angle, 1 / cosine range.
+};
+
+struct LightingStats {
+  uint32_t n_lights{0};
+  uint32_t n_uploaded{0}; // In the view frustum.
+};
+
+/**
+ * @brief Cull lights into clusters with compute, so that shading a fragment
+ *        loops over the lights of its cluster only.
+ * @note  The view is cut into kTilesX * kTilesY screen tiles, each split into
+ *        kSlices exponential depth slices between near and far. A cluster
+ *        keeps at most kMaxLightsPerCluster lights, extra ones are dropped.
+ *        The first slice reaches the camera and the last slice goes on
+ *        forever, so every fragment has a cluster.
+ */
+class ClusteredLighting {
+public:
+  static constexpr uint32_t kTilesX = 16;
+  static constexpr uint32_t kTilesY = 9;
+  static constexpr uint32_t kSlices = 24;
+  static constexpr uint32_t kClusters = kTilesX * kTilesY * kSlices;
+  static constexpr uint32_t kMaxLightsPerCluster = 128;
+  /// @brief One set of buffers per frame in flight.
+  static constexpr uint32_t kSlots = 3;
+
+  std::vector<Light> lights;
+  float near_depth{0.5f}; // End of the first slice.
+  float far_depth{500.f}; // Start of the last slice.
+
+  void init(Engine *engine);
+  /// @brief GPU must be idle.
+  void destroy();
+
+  /// @brief Replace lights with n random ones in a box, a quarter spots.
+  void scatter(uint32_t n, glm::vec3 center, glm::vec3 half_extent,
+               uint32_t seed = 1);
+
+  /**
+   * @brief Upload lights in the frustum of scene_data for the current frame,
+   *        and fill its cluster fields for the draw extent.
+   */
+  void prepare(GPUSceneData &scene_data, VkExtent2D extent);
+  /// @brief Lights, cluster counts and indices, as bindings 1 to 3.
+  void writeFrameSet(DescriptorWriter &writer);
+  /// @brief Cull into clusters, visible to fragment shaders after this.
+  void record(VkCommandBuffer cmd, const GPUSceneData &scene_data);
+
+  const LightingStats &stats() const { return m_stats; }
+
+private:
+  struct FrameBuffers {
+    AllocatedBuffer lights{};
+    size_t light_capacity{0};
+    AllocatedBuffer counts{};  // Per cluster.
+    AllocatedBuffer indices{}; // kMaxLightsPerCluster per cluster.
+    uint32_t n_lights{0};
+  };
+  FrameBuffers &currentFrame();
+
+  Engine *m_engine{nullptr};
+  VkDescriptorSetLayout m_ds_layout;
+  VkPipelineLayout m_pipeline_layout;
+  VkPipeline m_pipeline;
+  std::array<FrameBuffers, kSlots> m_frames;
+  LightingStats m_stats;
+};
@@ -4,6 +4,13 @@
 #include "vk_loader.h"
 #include "renderable.h"
 #include "camera.h"
+#include "job_system.h"
+#include "texture_streaming.h"
+#include "asset_cache.h"
+#include "scene_manager.h"
+#include "frame_capture.h"
+#include "clustered_lighting.h"
+#include "benchmark.h"
 
 /**
  * @brief Manage the deletion.
@@ -22,15 +29,79 @@ struct DeletionQueue {
   }
 };
 
+/**
+ * @brief Timeline semaphore of one queue. Each submit signals the next value,
+ *        so any point of the queue's work is a value to wait for or poll.
+ */
+struct QueueTimeline {
+  VkSemaphore semaphore{VK_NULL_HANDLE};
+  uint64_t last_submitted{0};
+  uint64_t completed{0}; // Cached by poll() and wait().
+
+  /// @brief Value for the next submit to signal.
+  uint64_t next() { return ++last_submitted; }
+  /// @brief Read the counter, never blocks.
+  uint64_t poll(VkDevice device);
+  bool reached(VkDevice device, uint64_t value) {
+    return value <= completed || value <= poll(device);
+  }
+  void wait(VkDevice device, uint64_t value);
+};
+
+/// @brief Secondary command buffers of one recording thread in one frame.
+struct SecondaryCommands {
+  VkCommandPool pool;
+  // Grown on demand, reset with the pool once the frame is done.
+  std::vector<VkCommandBuffer> buffers;
+  uint32_t n_used{0};
+};
+
 struct FrameData {
   VkCommandPool cmd_pool;
   VkCommandBuffer cmd_buffer_main;
+  // One per job thread, geometry passes are split among them.
+  std::vector<SecondaryCommands> secondary_cmds;
 
   // https://github.com/KhronosGroup/Vulkan-Docs/wiki/Synchronization-Examples
-  // Sync between GPU queues, one operation wait another to signal a semaphore.
+  // Binary as swapchain acquire and present take no timeline semaphores.
   VkSemaphore swapchain_semaphore, render_semaphore; // Two one-way channels.
-  // Sync between CPU and GPU, CPU waits for some GPU operations to finish.
-  VkFence render_fence;
+  // Graphics timeline value signalled by the last submit of this frame, CPU
+  // waits for it before reusing anything below. Zero before first use.
+  uint64_t render_value{0};
+
+  // Async compute, only created if the device has a separate compute queue.
+  VkCommandPool compute_cmd_pool;
+  VkCommandBuffer cmd_buffer_compute;
+  // Compute timeline value the graphics queue waits before using the
+  // background.
+  uint64_t compute_value{0};
+  // Background is drawn here by compute queue, then copied to color image.
+  // One per frame so the compute work can run ahead of the previous frame.
+  AllocatedImage background_image;
+  VkDescriptorSet background_ds;
+
+  // Queries are read back after render_value is reached, no extra wait.
+  VkQueryPool query_pool_timestamp;
+  VkQueryPool query_pool_compute;
+  bool timestamp_written{false};
+  bool compute_timestamp_written{false};
+
+  // Occlusion culling, grown on demand.
+  AllocatedBuffer cull_object_buffer; // CPU written.
+  AllocatedBuffer draw_cmd_buffer;    // Indirect commands, GPU written.
+  AllocatedBuffer visibility_buffer;  // Phase 0 result.
+  AllocatedBuffer cull_stats_buffer;  // Read back after render_value.
+  uint32_t cull_capacity{0};
+  bool cull_stats_written{false};
+
+  // Cluster culling, grown on demand.
+  AllocatedBuffer cluster_object_buffer; // CPU written.
+  AllocatedBuffer cluster_index_buffer;  // Compacted indices.
+  AllocatedBuffer cluster_draw_buffer;   // One indirect command per object.
+  AllocatedBuffer cluster_stats_buffer;
+  uint32_t cluster_object_capacity{0};
+  uint32_t cluster_index_capacity{0};
+  bool cluster_stats_written{false};
 
   DeletionQueue deletion_queue;
   DescriptorAllocator frame_descriptors;
@@ -43,6 +114,9 @@ struct GPUSceneData {
   glm::vec4 ambient_color;
   glm::vec4 sunlight_dir; // w for sun power.
   glm::vec4 sunlight_color;
+  // Clustered lighting, see ClusteredLighting::prepare().
+  glm::uvec4 light_grid;   // Tiles x and y, slices, max lights a cluster.
+  glm::vec4 light_slicing; // Log depth scale and bias, tile size in pixels.
 };
 
 struct ComputePushConstants {
@@ -52,6 +126,66 @@ struct ComputePushConstants {
   glm::vec4 data4;
 };
 
+struct UpscalePushConstants {
+  glm::vec4 sizes;  // xy for input extent, zw for output extent.
+  glm::vec4 params; // x for sharpness.
+};
+
+struct DepthPyramidPushConstants {
+  glm::vec4 sizes; // xy for source region, zw for destination extent.
+};
+struct CullPushConstants {
+  glm::mat4 view;
+  glm::vec4 proj;    // P00, P11, P22, P32.
+  glm::vec4 pyramid; // Width, height, levels and near plane.
+  uint32_t n_objects;
+  uint32_t phase;
+};
+/// @brief GPU layout, see occlusion_cull.comp.
+struct CullObject {
+  glm::vec4 sphere; // World space.
+  uint32_t index_count;
+  uint32_t first_index;
+  int32_t vertex_offset;
+  uint32_t cluster_draw; // Command from cluster culling, ~0u for none.
+};
+/// @brief GPU layout, see cluster_cull.comp.
+struct ClusterObject {
+  glm::mat4 transform;
+  VkDeviceAddress meshlet_buffer;
+  VkDeviceAddress index_buffer;
+  uint32_t first_meshlet;
+  uint32_t meshlet_count;
+  uint32_t output_offset; // In compacted index buffer.
+  int32_t vertex_offset;  // Added to indices on output.
+  uint32_t index_16bit;   // Source indices are VK_INDEX_TYPE_UINT16.
+  uint32_t padding[3];
+};
+/// @brief One draw of a geometry pass, recorded by any thread.
+struct DrawItem {
+  const RenderObject *object;
+  VkBuffer index_buffer;
+  VkIndexType index_type;
+  VkBuffer indirect_buffer; // VK_NULL_HANDLE for a direct draw.
+  uint32_t draw_idx;        // Command in indirect buffer.
+};
+struct ClusterPushConstants {
+  glm::mat4 view_proj;
+  glm::vec4 camera;
+  uint32_t n_objects;
+};
+struct ClusterStats {
+  uint32_t n_tested;
+  uint32_t n_culled;
+  uint32_t n_triangles;
+};
+struct CullStats {
+  uint32_t n_visible_phase0;
+  uint32_t n_visible_phase1;
+  uint32_t n_culled;
+  uint32_t n_triangles;
+};
+
 struct ComputePipeline {
   const char *name;
   VkPipeline pipeline;
@@ -66,6 +200,12 @@ struct ComputePipeline {
 struct GLTFMetallicRoughness {
   MaterialPipeline pipeline_opaque;
   MaterialPipeline pipeline_transparent;
+  // Opaque after depth pre-pass, depth is tested but not written.
+  MaterialPipeline pipeline_opaque_prepassed;
+  // Same three, shading clustered lights too.
+  MaterialPipeline pipeline_opaque_clustered;
+  MaterialPipeline pipeline_transparent_clustered;
+  MaterialPipeline pipeline_opaque_prepassed_clustered;
 
   struct MaterialConstants {
     glm::vec4 color_factors;
@@ -90,6 +230,12 @@ struct GLTFMetallicRoughness {
   MaterialInstance writeMaterial(VkDevice device, MaterialPass pass,
                                  const MaterialResources &resources,
                                  DescriptorAllocator &d_allocator);
+  /// @brief Write resources into an allocated set of ds_layout.
+  void writeMaterialSet(VkDevice device, VkDescriptorSet ds,
+                        const MaterialResources &resources);
+  /// @brief Pipeline to draw with, for base pipeline of a material.
+  MaterialPipeline *variant(MaterialPipeline *base, bool prepassed,
+                            bool clustered);
 };
 
 struct Timer {
@@ -103,14 +249,105 @@ struct Timer {
     period_ms = elapsed.count() / 1000.f;
   }
 };
+/// @brief Allocation classes, each but Default has its own VMA pool.
+enum class MemoryClass : uint8_t {
+  Default,      // Per frame and readback buffers, VMA default pools.
+  Geometry,     // Static vertex, index and meshlet buffers.
+  Texture,      // Sampled images.
+  RenderTarget, // Attachments and storage images.
+  Upload,       // Staging buffers, freed soon after the copy.
+  Count,
+};
+/// @brief One memory heap, from VK_EXT_memory_budget or VMA estimates.
+struct HeapBudget {
+  VkDeviceSize usage;  // Whole process, not only this allocator.
+  VkDeviceSize budget; // Available before the driver starts paging.
+  bool device_local;
+};
+enum class MemoryPressure : uint8_t { Normal, High, Critical };
 struct EngineStats {
   int n_triangles;
   int n_drawcalls;
   Timer t_frame;
   Timer t_scene_update;
+  Timer t_update_wait; // Main thread blocked on the scene update.
   Timer t_cpu_draw;
+  Timer t_record; // Geometry passes only.
+  float gpu_frame_ms{0.f}; // Graphics queue, from timestamps.
+  // Occlusion culling, from GPU counters.
+  int n_occlusion_visible{0};
+  int n_occlusion_culled{0};
+  // Meshlets, from GPU counters.
+  int n_clusters_tested{0};
+  int n_clusters_culled{0};
+  // Draw list triangles at full detail and after LOD selection.
+  int n_lod_triangles_full{0};
+  int n_lod_triangles{0};
+  std::vector<HeapBudget> heaps;
+  // From the fullest device local heap.
+  MemoryPressure memory_pressure{MemoryPressure::Normal};
+};
+
+/**
+ * @brief Pick render scale to keep GPU frame time under a budget.
+ * @note  Timestamps come back kFrameOverlap frames late, so after each change
+ *        we wait a few frames before judging again. Scale changes only when
+ *        the smoothed time leaves the band [lower, upper] * budget.
+ */
+struct ResolutionController {
+  bool enabled{false};
+  float budget_ms{12.f};
+  float upper_ratio{1.f};
+  float lower_ratio{0.8f};
+  float min_scale{0.3f};
+  float max_scale{1.f};
+  float max_step{0.1f}; // Largest scale change at once.
+  float smoothing{0.1f};
+
+  float smoothed_ms{0.f};
+  int cooldown{0};
+
+  /// @brief Return the new render scale.
+  float update(float gpu_ms, float scale);
 };
 
+/**
+ * @brief Sweep record thread count from 1 to max, averaging CPU time of
+ *        geometry pass recording over some frames each.
+ */
+struct RecordBenchmark {
+  static constexpr uint32_t kFramesPerStep = 120;
+  bool running{false};
+  uint32_t n_threads{1};
+  uint32_t n_frames{0};
+  float total_ms{0.f};
+  std::vector<float> results_ms; // By thread count, from 1.
+};
+
+/// @brief Inputs of the scene update stage, copied on the main thread.
+struct SceneInputs {
+  glm::mat4 view;
+  glm::vec3 camera_position;
+  float aspect;
+  float draw_height; // Pixels, for LOD selection.
+  bool use_lod;
+  float lod_max_error_pixels;
+};
+/**
+ * @brief Render data of one frame from the scene update stage. The update
+ *        job writes its own copy while the previous one is being recorded,
+ *        and they are swapped at the frame boundary.
+ */
+struct FrameSnapshot {
+  GPUSceneData scene_data;
+  DrawContext draw_context;
+  std::vector<size_t> visible_opaque; // Frustum culled opaque surfaces.
+  float update_ms{0.f};
+};
+
+/// @brief Whether the bound of obj may be inside the frustum of view_proj.
+bool isVisible(const RenderObject &obj, const glm::mat4 &view_proj);
+
 // FIXME This affects imgui drag lagging.
 constexpr uint32_t kFrameOverlap = 3;
 
@@ -123,7 +360,13 @@ public:
   void cleanup();
   void immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&func);
   GPUMeshBuffers uploadMesh(std::span<uint32_t> indices,
-                            std::span<Vertex> vertices);
+                            std::span<Vertex> vertices,
+                            std::span<Meshlet> meshlets = {});
+  /// @brief Compact layout, colors are optional.
+  GPUMeshBuffers uploadMesh(std::span<uint32_t> indices,
+                            std::span<CompactVertex> vertices,
+                            std::span<uint32_t> colors,
+                            std::span<Meshlet> meshlets = {});
 
   bool stop_rendering{false};
   bool require_resize{false};
@@ -131,6 +374,8 @@ public:
   int frame_number{0};
   VkExtent2D window_extent{1920, 1080};
   EngineStats stats;
+  // Set before init() to run a benchmark and quit.
+  BenchmarkConfig benchmark_config;
 
   struct SDL_Window *window{nullptr};
 
@@ -142,17 +387,47 @@ public:
   /// @brief Create GPU-only image.
   AllocatedImage createImage(VkExtent3D size, VkFormat format,
                              VkImageUsageFlags usage, bool mipmap = false);
+  /// @brief Create GPU-only image with given mip levels.
+  AllocatedImage createImage(VkExtent3D size, VkFormat format,
+                             VkImageUsageFlags usage, uint32_t mip_levels);
   /// @brief Create GPU-only image with data.
   AllocatedImage createImage(void *data, VkExtent3D size, VkFormat format,
                              VkImageUsageFlags usage, bool mipmap = false);
   void destroyImage(const AllocatedImage &image);
+  /// @brief Write VMA statistics of every heap and pool as JSON.
+  void dumpMemoryStats(const std::string &path);
+  /// @brief Append raw frames to capture.rgba or capture.nv12, their size
+  ///        is printed for ffmpeg -f rawvideo. Frames have the swapchain
+  ///        size, each resize goes on in capture_1, capture_2 and so on.
+  void startCapture(CaptureFormat format);
+  bool benchmarkFailed() const { return m_benchmark.failed(); }
+  /// @brief Compact the geometry pool, waits for the GPU. For loading
+  ///        screens, moved buffers get new handles and device addresses.
+  void defragmentGeometry();
+  MemoryPressure memoryPressure() const { return stats.memory_pressure; }
+  /// @brief Whether bytes fit under the critical mark of VRAM heaps.
+  bool hasMemoryFor(VkDeviceSize bytes) const;
 
 private:
   // TODO Better visibility.
   friend struct GLTFMetallicRoughness;
   friend struct LoadedGLTF;
+  friend class TextureStreamer;
+  friend class AssetCache;
+  friend class SceneManager;
+  friend class FrameCapture;
+  friend class ClusteredLighting;
+  friend class BenchmarkRunner;
   friend std::optional<std::shared_ptr<LoadedGLTF>>
   loadGltf(Engine *engine, std::filesystem::path file_path);
+  friend std::shared_ptr<GltfStaging>
+  parseGltf(Engine *engine, std::filesystem::path file_path,
+            bool compact_vertices);
+  friend std::optional<std::shared_ptr<LoadedGLTF>>
+  finishGltf(Engine *engine, GltfStaging &staging);
+  friend std::shared_ptr<GltfStaging>
+  generateScene(Engine *engine, const SyntheticSceneConfig &config,
+                bool compact_vertices);
   VkInstance m_instance;                  // Vulkan library handle
   VkDebugUtilsMessengerEXT m_debug_msngr; // Vulkan debug output handle
   VkPhysicalDevice m_chosen_GPU;          // GPU chosen as the default device
@@ -166,16 +441,35 @@ private:
   VkExtent2D m_swapchain_extent;
   VkExtent2D m_draw_extent;
   float m_render_scale = 1.f;
+  ResolutionController m_resolution_controller;
 
   FrameData m_frames[kFrameOverlap];
   GPUSceneData m_scene_data;
   VkDescriptorSetLayout m_GPU_scene_data_ds_layout;
   VkQueue m_graphic_queue;
   uint32_t m_graphic_queue_family;
+  VkQueue m_compute_queue;
+  uint32_t m_compute_queue_family;
+  bool m_has_async_compute = false; // Separate compute family found.
+  bool m_use_async_compute = false;
 
   DeletionQueue m_main_deletion_queue;
 
   VmaAllocator m_allocator;
+  // By MemoryClass, null for Default.
+  std::array<VmaPool, static_cast<size_t>(MemoryClass::Count)> m_pools{};
+  static constexpr VkDeviceSize kPoolBlockSize = VkDeviceSize(64) << 20;
+  static constexpr VkDeviceSize kUploadBlockSize = VkDeviceSize(16) << 20;
+  // Every static geometry buffer, movable by defragmentation.
+  static constexpr VkBufferUsageFlags kGeometryBufferUsage =
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  bool m_has_memory_budget = false; // VK_EXT_memory_budget enabled.
+  // Fractions of a heap budget. Above high, streamed textures shrink to
+  // stay under it and LODs get coarser. Above critical, loads are refused.
+  float m_memory_high = 0.85f;
+  float m_memory_critical = 0.95f;
 
   // Input images.
   AllocatedImage m_white_image;
@@ -188,6 +482,8 @@ private:
   // Output images.
   AllocatedImage m_color_image;
   AllocatedImage m_depth_image;
+  // Swapchain sized, written by upscaler then copied to swapchain.
+  AllocatedImage m_upscale_image;
 
   MaterialInstance m_default_material;
   GLTFMetallicRoughness m_metal_rough_mat;
@@ -199,47 +495,173 @@ private:
   VkPipelineLayout m_compute_pipeline_layout;
   std::vector<ComputePipeline> m_compute_pipelines;
   int m_cur_comp_pipeline_idx = 0;
+  VkDescriptorSetLayout m_upscale_ds_layout;
+  VkDescriptorSet m_upscale_ds;
+  VkPipelineLayout m_upscale_pipeline_layout;
+  VkPipeline m_upscale_pipeline;
+  bool m_use_upscaler = true;
+  float m_upscale_sharpness = 0.3f;
+  // Hi-Z pyramid, farthest depth. Built after first phase of culling and
+  // used by the next frame.
+  AllocatedImage m_depth_pyramid;
+  std::vector<VkImageView> m_depth_pyramid_mips;
+  VkExtent2D m_depth_pyramid_extent;
+  uint32_t m_depth_pyramid_levels;
+  bool m_depth_pyramid_valid{false};
+  VkSampler m_depth_sampler;
+  VkDescriptorSetLayout m_depth_pyramid_ds_layout;
+  VkPipelineLayout m_depth_pyramid_pipeline_layout;
+  VkPipeline m_depth_pyramid_pipeline;
+  VkDescriptorSetLayout m_cull_ds_layout;
+  VkPipelineLayout m_cull_pipeline_layout;
+  VkPipeline m_cull_pipeline;
+  CullStats m_cull_stats{};
+  bool m_use_occlusion_culling = true;
+  VkDescriptorSetLayout m_cluster_ds_layout;
+  VkPipelineLayout m_cluster_pipeline_layout;
+  VkPipeline m_cluster_pipeline;
+  ClusterStats m_cluster_stats{};
+  bool m_use_cluster_culling = true;
+  VkPipelineLayout m_depth_only_pipeline_layout;
+  VkPipeline m_depth_only_pipeline;
+  bool m_use_depth_prepass = false;
+  // Shade the lights of m_lighting, no cost but the sun's when off.
+  bool m_use_clustered_lighting = false;
+  int m_n_scatter_lights = 1024;
+  // Layout of meshes loaded afterwards.
+  bool m_compact_vertices = true;
+  bool m_use_lod = true;
+  float m_lod_max_error_pixels = 1.f;
+  // Textures of loaded scenes, mip tail first then by footprint.
+  TextureStreamer m_texture_streamer;
+  // Textures and samplers shared between scenes.
+  AssetCache m_assets;
+
   VkPipelineLayout m_simple_mesh_pipeline_layout;
   VkPipeline m_simple_mesh_pipeline;
   GPUMeshBuffers m_simple_mesh;
 
   std::vector<std::shared_ptr<MeshAsset>> m_meshes;
+  // Changed by m_scenes only, at frame boundaries.
   std::unordered_map<std::string, std::shared_ptr<LoadedGLTF>> m_loaded_scenes;
+  SceneManager m_scenes;
+  // Final image read back for encoding, see startCapture().
+  FrameCapture m_capture;
+  ClusteredLighting m_lighting;
+  // Render side of the frame snapshot, see FrameSnapshot.
   DrawContext m_main_draw_context;
+  std::vector<size_t> m_visible_opaque;
+  // Update side, only touched by the update job until m_update_done.
+  FrameSnapshot m_update_snapshot;
+  JobCounter m_update_done;
+  // Background deque of the update job, see kickSceneUpdate().
+  uint32_t m_update_queue{0};
   std::unordered_map<std::string, std::shared_ptr<Node>> m_loaded_nodes;
-  void updateScene();
+  /// @brief Update stage, reads scenes and inputs only. Runs on a job.
+  void updateScene(const SceneInputs &inputs, FrameSnapshot &snapshot);
+  /// @brief Start updating the next frame from current inputs.
+  /// @param advance_camera  False to redo the update of the same frame.
+  void kickSceneUpdate(bool advance_camera = true);
+  /// @brief Wait for the update job and swap its snapshot in for render.
+  void acquireSnapshot();
   Camera m_main_camera;
 
-  VkFence m_imm_fence;
+  // Shared by loading, draw list building, culling and command recording.
+  JobSystem m_jobs;
+  // Jobs finished during last frame, if profiling.
+  std::vector<JobProfile> m_job_profile;
+  // Geometry passes are recorded in parallel into secondary command buffers.
+  int m_record_threads = 1;
+  // Fewer draws per thread are recorded inline.
+  static constexpr size_t kMinDrawsPerThread = 64;
+  RecordBenchmark m_record_benchmark;
+  BenchmarkRunner m_benchmark;
+  // Keys added from the panel, 2 seconds apart.
+  CameraPath m_recorded_path;
+
+  // One per queue, fences are not used.
+  QueueTimeline m_graphics_timeline;
+  QueueTimeline m_compute_timeline; // If async compute.
   VkCommandBuffer m_imm_cmd;
   VkCommandPool m_imm_cmd_pool;
 
-  VkQueryPool m_query_pool_timestamp;
   std::vector<uint64_t> m_timestamps;
+  std::vector<uint64_t> m_prev_timestamps;
+  // Begin and end of background pass on async compute queue.
+  std::vector<uint64_t> m_compute_timestamps;
   float m_timestamp_period;
 
 private:
   void initVulkan();
+  void initMemoryPools();
   void initSwapchain();
+  /// @brief Color, depth and other images drawn at most at extent.
+  void createRenderTargets(VkExtent2D extent);
+  /// @brief Destroy current render targets once queue is flushed.
+  void retireRenderTargets(DeletionQueue &queue);
+  /// @brief Allocate and write sets referencing render targets.
+  void writeRenderTargetSets();
   void initCommands();
   void initSyncStructures();
 
   void initDescriptors();
   void initPipelines();
   void initBackgroundPipelines();
+  void initUpscalePipeline();
+  void initCullingPipelines();
+  void initDepthOnlyPipeline();
   void initSimpleMeshPipeline();
   void initDefaultData();
 
   void initImGui();
   void drawImGui(VkCommandBuffer cmd, VkImageView target_img_view);
-  void drawBackground(VkCommandBuffer cmd);
+  void drawBackground(VkCommandBuffer cmd, VkDescriptorSet target_ds);
+  void submitAsyncCompute();
+  void readTimestamps();
+  /// @brief Refresh heap budgets and apply the pressure policy.
+  void updateMemoryBudget();
   void drawGeometry(VkCommandBuffer cmd);
-
-  void createSwapchain(int w, int h);
+  /// @brief One rendering scope, draws split among record threads.
+  void recordPass(VkCommandBuffer cmd, std::span<const DrawItem> items,
+                  VkDescriptorSet frame_ds, bool depth_only, bool clear_depth,
+                  bool prepassed);
+  /// @brief Bind state and draw, returns triangles of direct draws.
+  uint32_t recordDraws(VkCommandBuffer cmd, std::span<const DrawItem> items,
+                       VkDescriptorSet frame_ds, bool depth_only,
+                       bool prepassed);
+  VkCommandBuffer acquireSecondary(SecondaryCommands &secondary);
+  void stepRecordBenchmark();
+  void drawUpscale(VkCommandBuffer cmd, VkExtent2D output_extent);
+  uint32_t cullClusters(VkCommandBuffer cmd, std::span<size_t> opaque_index,
+                        std::span<uint32_t> cluster_draw);
+  void readClusterStats();
+  GPUMeshBuffers uploadMeshBuffers(std::span<uint32_t> indices,
+                                   std::span<const std::byte> vertices,
+                                   std::span<const std::byte> colors,
+                                   std::span<const std::byte> meshlets);
+  VkDescriptorSet prepareCulling(std::span<size_t> opaque_index,
+                                 std::span<uint32_t> cluster_draw);
+  void cullOcclusion(VkCommandBuffer cmd, VkDescriptorSet cull_ds,
+                     uint32_t n_objects, uint32_t phase);
+  void buildDepthPyramid(VkCommandBuffer cmd);
+  void readCullStats();
+
+  void createSwapchain(int w, int h,
+                       VkSwapchainKHR old_swapchain = VK_NULL_HANDLE);
+  /// @brief Recreate from the old swapchain, without waiting for the device.
   void resizeSwapchain();
   void destroySwapchain();
 
+  /// @brief Host visible ones are persistently mapped.
   AllocatedBuffer createBuffer(size_t alloc_size, VkBufferUsageFlags usage,
-                               VmaMemoryUsage mem_usage);
+                               VmaMemoryUsage mem_usage,
+                               MemoryClass mem_class = MemoryClass::Default);
+  /// @brief Pool of a class, null if the allocation is better outside.
+  VmaPool poolFor(MemoryClass mem_class, VkDeviceSize size) const;
   void destroyBuffer(const AllocatedBuffer &buffer);
+  /// @brief Create GPU-only image, may fail with flags like WITHIN_BUDGET.
+  VkResult allocateImage(VkExtent3D size, VkFormat format,
+                         VkImageUsageFlags usage, uint32_t mip_levels,
+                         VmaAllocationCreateFlags flags,
+                         AllocatedImage &image);
 };
@@ -0,0 +1,108 @@
+/**
+ * @file frame_capture.h
+ * @brief Rendered frames read back to the CPU, for encoding.
+ */
+#pragma once
+
+#include "vk_types.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+enum class CaptureFormat : uint32_t {
+  RGBA8, // 4 bytes a pixel.
+  NV12,  // Y plane then interleaved UV plane at half resolution.
+};
+
+struct CapturedFrame {
+  uint64_t frame; // Engine frame number.
+  VkExtent2D extent;
+  CaptureFormat format;
+  std::span<const uint8_t> data; // Valid during the callback only.
+};
+/// @brief Runs on the capture thread, frames come in order.
+using CaptureCallback = std::function<void(const CapturedFrame &)>;
+
+struct FrameCaptureStats {
+  uint32_t n_delivered{0};
+  uint32_t n_dropped{0}; // No free slot when recording.
+  size_t delivered_bytes{0};
+};
+
+/**
+ * @brief Convert the final image with compute into a ring of host visible
+ *        buffers, and hand finished ones to a callback off the main thread.
+ * @note  The engine captures what it copies to the swapchain, the upscaled
+ *        image or the color image, scaled to the swapchain size the same
+ *        way and without the GUI. So the extent only changes with the
+ *        window, not with the render scale.
+ *        Slots are polled against the graphics timeline, draw() never waits
+ *        for readback. A slot returns to the ring when its callback returns,
+ *        frames are dropped while all are busy. Data is read in place from
+ *        mapped memory, no copy on the CPU.
+ */
+class FrameCapture {
+public:
+  /// @brief Frames in flight plus two held by the capture thread.
+  static constexpr uint32_t kSlots = 5;
+
+  void init(Engine *engine);
+  /// @brief Drops undelivered frames, GPU must be idle.
+  void destroy();
+
+  void start(CaptureFormat format, CaptureCallback &&callback);
+  /// @brief Frames already recorded are still delivered.
+  void stop();
+  bool capturing() const { return m_capturing; }
+
+  /**
+   * @brief Record conversion of extent of image, in GENERAL layout, scaled
+   *        to output with linear filtering, into a free slot. Output width
+   *        is rounded down to 4 pixels and height to 2, cropping the rest.
+   */
+  void record(VkCommandBuffer cmd, const AllocatedImage &image,
+              VkExtent2D extent, VkExtent2D output);
+  /// @brief Slots recorded this frame finish with this graphics value.
+  void submitted(uint64_t timeline_value);
+  /// @brief Hand finished slots to the capture thread, never blocks.
+  void poll();
+
+  FrameCaptureStats stats();
+
+private:
+  enum class SlotState { Free, Recorded, InFlight, Delivering };
+  struct Slot {
+    AllocatedBuffer buffer{};
+    size_t capacity{0};
+    size_t size{0};
+    VkExtent2D extent;
+    CaptureFormat format;
+    uint64_t frame;
+    uint64_t timeline_value;
+    std::shared_ptr<CaptureCallback> callback;
+    SlotState state{SlotState::Free};
+  };
+
+  void deliverLoop();
+
+  Engine *m_engine{nullptr};
+  VkDescriptorSetLayout m_ds_layout;
+  VkPipelineLayout m_pipeline_layout;
+  VkPipeline m_pipeline;
+  VkSampler m_sampler; // Linear, clamped to edge.
+  bool m_capturing{false};
+  CaptureFormat m_format{CaptureFormat::RGBA8};
+  std::shared_ptr<CaptureCallback> m_callback;
+
+  std::array<Slot, kSlots> m_slots;
+  std::thread m_thread;
+  // Guards slot states, m_ready, m_stats and m_quit.
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::deque<uint32_t> m_ready; // Slots to deliver, in frame order.
+  FrameCaptureStats m_stats;
+  bool m_quit{false};
+};
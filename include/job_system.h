@@ -0,0 +1,144 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Jobs left before a dependency is met, and what to run after.
+ * @note  May be reused once it reaches zero.
+ */
+class JobCounter {
+public:
+  bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+  friend class JobSystem;
+  std::atomic<uint32_t> m_pending{0};
+  std::mutex m_mutex;
+  // Queued when m_pending reaches zero.
+  std::vector<std::function<void()>> m_continuations;
+};
+
+/// @brief One finished job, for profiling.
+struct JobProfile {
+  const char *name;
+  uint32_t thread;
+  float start_ms; // Since init.
+  float duration_ms;
+};
+
+/**
+ * @brief Work-stealing scheduler shared by engine subsystems.
+ * @note  Each thread owns a deque, pushing and popping at the back. Idle
+ *        threads steal from the front of others. Waiting threads run jobs
+ *        instead of blocking, so jobs may wait on counters, but there are no
+ *        fibers: a waiting job keeps its stack until the counter is done.
+ *        Thread 0 is the one calling init(), usually the main thread.
+ *        Threads outside the system, such as a loader, register for a
+ *        background deque, and jobs meant to overlap the main thread get one
+ *        reserved. Only workers steal from those, and jobs pushed by
+ *        background jobs stay there, so the main thread never runs loading
+ *        or update work while waiting in a frame.
+ */
+class JobSystem {
+public:
+  /**
+   * @param n_workers  Threads created besides the caller.
+   * @param n_background  Deques for registerThread() and reserveQueue().
+   * @param pin_threads  Pin thread i to core i, the caller included.
+   */
+  void init(uint32_t n_workers, uint32_t n_background = 0,
+            bool pin_threads = false);
+  void destroy();
+  /**
+   * @brief Give the calling thread, not one of this system, a background
+   *        deque. While waiting it runs its own jobs only.
+   * @return False if all background deques are taken.
+   */
+  bool registerThread();
+  /**
+   * @brief Take a background deque for runOn(), for jobs the caller waits on
+   *        later but should not run itself.
+   * @return The deque, or the caller's own if all are taken or there are no
+   *         workers to run it.
+   */
+  uint32_t reserveQueue();
+  /// @brief Threads running frame jobs, workers and the caller of init().
+  uint32_t size() const { return m_n_threads; }
+  /// @brief Deques, background ones included, see JobProfile::thread.
+  uint32_t nQueues() const {
+    return static_cast<uint32_t>(m_queues.size());
+  }
+  /// @brief Index of the calling thread, 0 if not from this system.
+  static uint32_t threadIndex();
+
+  /**
+   * @brief Queue a job on the calling thread's deque.
+   * @param name  Static string, shown in profiles.
+   * @param counter  Incremented now, decremented when the job finishes.
+   */
+  void run(const char *name, std::function<void()> job,
+           JobCounter *counter = nullptr);
+  /// @brief Queue a job on a deque from reserveQueue().
+  void runOn(uint32_t queue, const char *name, std::function<void()> job,
+             JobCounter *counter = nullptr);
+  /// @brief Queue a job once dependency reaches zero, without blocking.
+  void runAfter(JobCounter &dependency, const char *name,
+                std::function<void()> job, JobCounter *counter = nullptr);
+  /// @brief Run other jobs until counter reaches zero.
+  void wait(JobCounter &counter);
+  /**
+   * @brief Run task(begin, end) over [0, n) in chunks, return when all have
+   *        finished. The caller runs jobs meanwhile.
+   * @param chunk  Items per job, at least 1.
+   */
+  void parallelFor(const char *name, size_t n, size_t chunk,
+                   const std::function<void(size_t, size_t)> &task);
+
+  /// @brief Record every job from now on, see takeProfile().
+  void setProfiling(bool enabled) { m_profiling = enabled; }
+  bool profiling() const { return m_profiling; }
+  /// @brief Jobs finished since last call.
+  std::vector<JobProfile> takeProfile();
+
+private:
+  struct Job {
+    const char *name;
+    std::function<void()> function;
+    JobCounter *counter;
+  };
+  /// @brief Deque of one thread, locked as stealing is rare.
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+    std::mutex profile_mutex;
+    std::vector<JobProfile> profile;
+  };
+
+  void push(Job &&job, uint32_t queue);
+  bool tryRunOne(uint32_t thread);
+  void execute(Job &job, uint32_t thread, uint32_t queue);
+  void finish(JobCounter *counter);
+  void workerLoop(uint32_t thread);
+  static void pinThread(uint32_t core);
+
+  // Workers and the caller of init() first, then background deques.
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  uint32_t m_n_threads{0};
+  std::atomic<uint32_t> m_n_registered{0};
+  std::vector<std::thread> m_workers;
+  // Jobs in all deques, idle workers sleep while zero.
+  std::atomic<uint32_t> m_n_queued{0};
+  std::mutex m_sleep_mutex;
+  std::condition_variable m_wake;
+  std::atomic<bool> m_quit{false};
+  std::atomic<bool> m_profiling{false};
+  std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,96 @@
+/**
+ * @file mesh_processing.h
+ * @brief Offline-style mesh processing, run by the loader on CPU.
+ */
+#pragma once
+
+#include "vk_types.h"
+
+namespace meshutil {
+constexpr uint32_t kMeshletMaxVertices = 64;
+constexpr uint32_t kMeshletMaxTriangles = 124;
+/// @brief Post-transform cache entries assumed by the optimizer and report.
+constexpr uint32_t kVertexCacheSize = 16;
+
+/// @brief Efficiency of an index order on a simulated FIFO vertex cache.
+struct VertexCacheStats {
+  float acmr; // Cache misses per triangle, 0.5 at best for large meshes.
+  float atvr; // Cache misses per unique vertex, 1 at best.
+};
+
+/**
+ * @brief Simulate a FIFO post-transform cache on a triangle list.
+ */
+VertexCacheStats analyzeVertexCache(std::span<const uint32_t> indices,
+                                    uint32_t cache_size = kVertexCacheSize);
+/**
+ * @brief Reorder triangles for the post-transform cache, Tipsify style.
+ *
+ * @param clusters  Optional output, first triangle of each cluster. Clusters
+ *                  start where the fanning jumps to a non-local vertex.
+ */
+void optimizeVertexCache(std::span<uint32_t> indices,
+                         std::vector<uint32_t> *clusters = nullptr,
+                         uint32_t cache_size = kVertexCacheSize);
+/**
+ * @brief Reorder clusters from optimizeVertexCache, outward facing ones
+ *        first, so they tend to occlude the rest. Triangle order inside a
+ *        cluster is kept.
+ */
+void optimizeOverdraw(std::span<uint32_t> indices,
+                      std::span<const Vertex> vertices,
+                      std::span<const uint32_t> clusters);
+/**
+ * @brief Reorder vertices by first use in indices and remap indices.
+ *        Vertices never referenced are dropped.
+ * @return New vertex count.
+ */
+uint32_t optimizeVertexFetch(std::span<uint32_t> indices,
+                             std::vector<Vertex> &vertices);
+
+/**
+ * @brief Quadric error simplification by edge collapse.
+ * @note  Vertices only collapse onto existing ones, so the result indexes
+ *        the same vertex buffer. Borders and attribute seams are locked.
+ *
+ * @param indices Triangle list.
+ * @param vertices Whole vertex buffer indexed by indices.
+ * @param target_index_count Stop when reaching this count.
+ * @param target_error Max error allowed, relative to the mesh extent.
+ * @param result_error Output, error reached relative to the mesh extent.
+ * @return Simplified triangle list.
+ */
+std::vector<uint32_t> simplify(std::span<const uint32_t> indices,
+                               std::span<const Vertex> vertices,
+                               size_t target_index_count, float target_error,
+                               float *result_error = nullptr);
+/**
+ * @brief Build coarser LODs of a surface, each halving the triangle count.
+ *        Index ranges are appended to indices and recorded in surface.lods.
+ * @return Number of LODs generated.
+ */
+uint32_t generateLods(std::vector<uint32_t> &indices,
+                      std::span<const Vertex> vertices,
+                      GeometrySurface &surface);
+/**
+ * @brief Encode a vertex range into the compact layout, positions relative
+ *        to bound.
+ * @param colors  Optional output, unorm8x4 colors of the same range.
+ */
+void compressVertices(std::span<const Vertex> vertices,
+                      const GeometryBound &bound,
+                      std::span<CompactVertex> compact,
+                      std::span<uint32_t> colors = {});
+/**
+ * @brief Split an index range into meshlets of consecutive triangles,
+ *        bounded by kMeshletMaxVertices and kMeshletMaxTriangles.
+ *
+ * @param cone_culling  False for double-sided surfaces, cones never cull.
+ * @param meshlets  Output, new meshlets are appended.
+ * @return Number of meshlets appended.
+ */
+uint32_t buildMeshlets(std::span<const uint32_t> indices,
+                       std::span<const Vertex> vertices, uint32_t first_index,
+                       uint32_t index_count, bool cone_culling,
+                       std::vector<Meshlet> &meshlets);
+} // namespace meshutil
@@ -1,6 +1,7 @@
 #pragma once
 #include "vk_types.h"
 #include "vk_descriptors.h"
+#include "texture_streaming.h"
 
 /**
  * @brief Render-ready data, last stage from CPU to GPU. Holds
@@ -12,14 +13,32 @@ struct RenderObject {
   uint32_t n_index;
   uint32_t first_index;
   VkBuffer index_buffer;
+  VkIndexType index_type;
+  int32_t vertex_offset;
   MaterialInstance *material;
   glm::mat4 transform;
   VkDeviceAddress vertex_buffer_address;
-  GeometryBound bound;
+  VkDeviceAddress color_buffer_address;
+  uint32_t vertex_layout; // VertexLayoutFlags.
+  GeometryBound bound; // Also dequantizes compact positions.
+  // Meshlets of the selected index range, for cluster culling.
+  uint32_t first_meshlet;
+  uint32_t n_meshlets;
+  VkDeviceAddress index_buffer_address;
+  VkDeviceAddress meshlet_buffer_address;
 };
 struct DrawContext {
   std::vector<RenderObject> opaque_surfaces;
   std::vector<RenderObject> transparent_surfaces;
+
+  // LOD selection, set before traversal.
+  glm::vec3 camera_position;
+  // Pixels per unit of object space error at distance 1, 0 for full detail.
+  float lod_pixels_per_unit{0.f};
+  float lod_max_error_pixels{1.f};
+  // Triangles of collected surfaces, at full detail and as selected.
+  size_t n_triangles_full{0};
+  size_t n_triangles_selected{0};
 };
 
 /// @brief Interface for everything that can be rendered.
@@ -57,15 +76,21 @@ struct LoadedGLTF : public IRenderable {
   // Storage all the data on a given glTF file.
   std::unordered_map<std::string, std::shared_ptr<MeshAsset>> meshes;
   std::unordered_map<std::string, std::shared_ptr<Node>> nodes;
-  std::unordered_map<std::string, AllocatedImage> images;
+  // References into the engine's asset cache, one per acquire.
+  std::vector<TextureHandle> textures;
   std::unordered_map<std::string, std::shared_ptr<GLTFMaterial>> materials;
   // Nodes having no parent, for iterating through the file in tree order.
   std::vector<std::shared_ptr<Node>> top_nodes;
 
-  std::vector<VkSampler> samplers;
+  std::vector<VkSampler> samplers; // Same, from the asset cache.
+  // Registered with the streamer, untracked before textures are released.
+  std::vector<MaterialInstance *> streamed_materials;
   DescriptorAllocator descriptor_pool;
   AllocatedBuffer material_data_buffer;
   Engine *creator;
+  // Vertex memory as uploaded and as it would be in the full layout.
+  size_t vertex_bytes{0};
+  size_t vertex_bytes_full{0};
 
   ~LoadedGLTF() { clearAll(); };
 
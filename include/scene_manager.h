@@ -0,0 +1,96 @@
+/**
+ * @file scene_manager.h
+ * @brief Scenes loaded in the background and swapped at frame boundaries.
+ */
+#pragma once
+
+#include "vk_types.h"
+#include "vk_loader.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+/// @brief Ready once the scene is in the engine, null if it failed.
+using SceneFuture = std::shared_future<std::shared_ptr<LoadedGLTF>>;
+
+/**
+ * @brief Load scenes by path without stalling frames, and free unloaded ones
+ *        once frames using them have finished on GPU.
+ * @note  A loader thread parses files, decodes images and processes geometry
+ *        with the job system, on a background deque that only workers steal
+ *        from. Uploads and descriptor writes stay on the main
+ *        thread, in update(), where no scene update job is running. Scenes
+ *        leave the engine there too, and are destroyed kFrameOverlap frames
+ *        later instead of waiting for the device to idle.
+ */
+class SceneManager {
+public:
+  /// @brief Parsed scenes uploaded per update, each blocks on its transfers.
+  uint32_t max_finish_per_frame{1};
+
+  void init(Engine *engine);
+  /// @brief Stop loading and free everything, the device must be idle.
+  void destroy();
+
+  /**
+   * @brief Queue a file to load as name. A scene already there keeps being
+   *        drawn until the new one replaces it.
+   */
+  SceneFuture requestScene(const std::string &name,
+                           std::filesystem::path file_path);
+  /// @brief Same, generating the scene instead of reading a file.
+  SceneFuture requestScene(const std::string &name,
+                           const SyntheticSceneConfig &config);
+  /// @brief Remove at next update, cancelling requests not finished yet.
+  void unloadScene(const std::string &name);
+
+  /**
+   * @brief Insert parsed scenes, remove unloaded ones and free those retired
+   *        long enough. Call between acquiring the snapshot and kicking the
+   *        next scene update.
+   */
+  void update();
+
+  /// @brief Requests not finished yet.
+  uint32_t nPending() const {
+    return static_cast<uint32_t>(m_requests.size());
+  }
+  /// @brief Scenes removed but still possibly used by frames in flight.
+  uint32_t nRetired() const { return static_cast<uint32_t>(m_retired.size()); }
+
+private:
+  struct Request {
+    std::string name;
+    std::filesystem::path path;
+    std::optional<SyntheticSceneConfig> synthetic; // Instead of the path.
+    bool compact_vertices;
+    std::promise<std::shared_ptr<LoadedGLTF>> promise;
+    std::shared_ptr<GltfStaging> staging;
+    std::atomic<bool> cancelled{false};
+  };
+  struct RetiredScene {
+    std::shared_ptr<LoadedGLTF> scene;
+    uint64_t frame;
+  };
+
+  SceneFuture queue(std::shared_ptr<Request> &&request);
+  void loaderLoop();
+  void retire(std::shared_ptr<LoadedGLTF> &&scene);
+
+  Engine *m_engine{nullptr};
+  std::thread m_loader;
+  // Guards both queues and m_quit.
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  bool m_quit{false};
+  std::deque<std::shared_ptr<Request>> m_queued; // To parse.
+  std::deque<std::shared_ptr<Request>> m_parsed; // To finish.
+  // Main thread only, m_requests are those not finished.
+  std::vector<std::shared_ptr<Request>> m_requests;
+  std::vector<std::string> m_unloads;
+  std::deque<RetiredScene> m_retired;
+};
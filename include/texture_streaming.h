@@ -0,0 +1,149 @@
+/**
+ * @file texture_streaming.h
+ * @brief Texture mips streamed to VRAM by screen-space footprint.
+ */
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+
+#include <cstdint>
+#include <unordered_map>
+
+struct DrawContext;
+
+/// @brief Decoded RGBA8 image with its whole mip chain, kept in RAM.
+struct TextureSource {
+  std::vector<VkExtent2D> extents; // By level, finest first.
+  std::vector<size_t> offsets;     // Byte offset of each level.
+  std::vector<uint8_t> pixels;
+
+  uint32_t levels() const { return static_cast<uint32_t>(extents.size()); }
+  /// @brief Bytes of levels [level, levels()).
+  size_t bytesFrom(uint32_t level) const {
+    return pixels.size() - offsets[level];
+  }
+};
+
+namespace texutil {
+/// @brief Box filtered mip chain down to 1x1, odd edges are clamped.
+TextureSource buildMipChain(const uint8_t *rgba, uint32_t width,
+                            uint32_t height);
+} // namespace texutil
+
+using TextureHandle = uint32_t;
+constexpr TextureHandle kNoTexture = ~0u;
+
+struct TextureStreamingStats {
+  size_t resident_bytes{0};
+  size_t full_bytes{0}; // If every texture had all levels resident.
+  uint32_t n_textures{0};
+  // Last update.
+  uint32_t n_upgraded{0};
+  uint32_t n_evicted{0};
+  uint32_t n_refused{0}; // Upgrades not fitting in the budgets.
+  size_t uploaded_bytes{0};
+};
+
+/**
+ * @brief Keep the mip tail of every texture in VRAM, and finer levels only
+ *        for textures that cover enough pixels on screen.
+ * @note  Levels live in one image per texture. Changing residency creates a
+ *        new image, copies the levels both have on GPU and uploads the rest
+ *        from RAM. The old image retires with the frame. Materials using the
+ *        texture get a new descriptor set, the old one is reused after
+ *        kFrameOverlap frames. Not thread safe, main thread only.
+ */
+class TextureStreamer {
+public:
+  /// @brief Levels no larger than this are always resident.
+  static constexpr uint32_t kTailSize = 64;
+  /// @brief Unused textures keep their levels this long unless pressed.
+  static constexpr uint64_t kEvictFrames = 120;
+
+  size_t budget_bytes{size_t(256) << 20};
+  size_t upload_bytes_per_frame{size_t(32) << 20};
+  // Set from heap budgets, the lower of the two applies.
+  size_t pressure_limit_bytes{SIZE_MAX};
+
+  void init(Engine *engine);
+  void destroy();
+
+  /// @brief Upload the mip tail now, finer levels are streamed later.
+  TextureHandle addTexture(TextureSource &&source);
+  /// @brief Destroy right away, the texture must not be in use. Materials
+  ///        using it are no longer tracked.
+  void removeTexture(TextureHandle texture);
+  const AllocatedImage &image(TextureHandle texture) const {
+    return m_textures[texture].image;
+  }
+
+  /**
+   * @brief Track a material whose set samples streamed textures. The set
+   *        is rewritten from these bindings when residency changes.
+   * @param color, metal_rough  kNoTexture for fixed images in bindings.
+   */
+  void addMaterial(MaterialInstance *instance, VkBuffer data_buffer,
+                   uint32_t data_buffer_offset, TextureHandle color,
+                   VkSampler color_sampler, TextureHandle metal_rough,
+                   VkSampler metal_rough_sampler);
+  void removeMaterial(MaterialInstance *instance);
+
+  /**
+   * @brief Pick levels from surfaces drawn this frame and record transfers
+   *        into cmd. Run before any recording reads material sets.
+   * @param visible_opaque  Opaque surfaces to consider, all transparent ones
+   *                        are.
+   * @param pixels_per_unit  Projected size of one unit at distance 1.
+   */
+  void update(VkCommandBuffer cmd, const DrawContext &context,
+              std::span<const size_t> visible_opaque, float pixels_per_unit);
+
+  const TextureStreamingStats &stats() const { return m_stats; }
+
+private:
+  struct StreamedTexture {
+    TextureSource source;
+    AllocatedImage image{};
+    uint32_t tail_level{0};     // First level always resident.
+    uint32_t resident_level{0}; // First level in image.
+    uint32_t wanted_level{0};   // From last update.
+    uint64_t last_used_frame{0};
+    std::vector<MaterialInstance *> materials;
+    bool alive{false};
+  };
+  struct StreamedMaterial {
+    VkBuffer data_buffer;
+    uint32_t data_buffer_offset;
+    TextureHandle color;
+    VkSampler color_sampler;
+    TextureHandle metal_rough;
+    VkSampler metal_rough_sampler;
+    AllocatedImage fixed_color;       // Used if color is kNoTexture.
+    AllocatedImage fixed_metal_rough; // Same.
+    bool owns_set{false};             // Set from m_ds_allocator.
+  };
+  struct RetiredSet {
+    VkDescriptorSet ds;
+    uint64_t frame;
+  };
+
+  /**
+   * @brief Record the transfer to a new image holding [level, levels()).
+   * @return False if an upgrade did not fit in the heap budget.
+   */
+  bool setResidentLevel(VkCommandBuffer cmd, StreamedTexture &texture,
+                        uint32_t level);
+  void rewriteMaterial(MaterialInstance *instance);
+  void retireSet(VkDescriptorSet ds);
+
+  Engine *m_engine{nullptr};
+  std::vector<StreamedTexture> m_textures;
+  std::vector<TextureHandle> m_free_textures;
+  std::unordered_map<MaterialInstance *, StreamedMaterial> m_materials;
+  DescriptorAllocator m_ds_allocator;
+  std::vector<VkDescriptorSet> m_free_sets;
+  std::deque<RetiredSet> m_retired_sets;
+  size_t m_resident_bytes{0};
+  TextureStreamingStats m_stats;
+};
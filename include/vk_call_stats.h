@@ -0,0 +1,171 @@
+/**
+ * @file vk_call_stats.h
+ * @brief Count and time Vulkan command entry points, per frame and per pass.
+ * @note  A dispatch wrapper, no layer to install. Include this file last in a
+ *        translation unit to route its vkCmd* calls listed below through the
+ *        counters. When off, each call costs one extra relaxed load.
+ */
+#pragma once
+
+#include "vk_types.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+namespace vkstats {
+
+enum class Call : uint8_t {
+  BindPipeline,
+  BindDescriptorSets,
+  PushConstants,
+  BindIndexBuffer,
+  DrawIndexed,
+  DrawIndexedIndirect,
+  Dispatch,
+  Count,
+};
+constexpr size_t kCalls = static_cast<size_t>(Call::Count);
+/// @brief Engine passes, calls outside of any go to Other.
+enum class Pass : uint8_t {
+  Other,
+  Background,
+  Culling,
+  DepthPyramid,
+  Lighting,
+  DepthPrepass,
+  Geometry,
+  Capture,
+  Upscale,
+  Count,
+};
+constexpr size_t kPasses = static_cast<size_t>(Pass::Count);
+
+const char *callName(Call call);
+const char *passName(Pass pass);
+
+struct PassCallStats {
+  std::array<uint32_t, kCalls> counts{};
+  std::array<float, kCalls> call_ms{}; // Inside the calls, all threads.
+  float record_ms{0.f}; // Wall time in the pass, on the recording thread.
+};
+struct FrameCallStats {
+  std::array<PassCallStats, kPasses> passes{};
+  float record_ms{0.f}; // Whole frame, first to last command.
+};
+
+/// @brief Takes effect at the next beginFrame().
+void setEnabled(bool enabled);
+bool enabled();
+/// @brief Time each call too. Costs about as much as a cheap call does.
+void setTimeCalls(bool time_calls);
+bool timeCalls();
+
+/// @brief Around all recording of a frame, on the thread that submits it.
+void beginFrame();
+void endFrame();
+/// @brief Last complete frame.
+const FrameCallStats &lastFrame();
+/// @brief Drop frames accumulated for dump().
+void reset();
+/**
+ * @brief Write mean and max per frame of every call and pass, over the
+ *        frames since reset(), as JSON.
+ */
+bool dump(const std::string &path);
+
+/**
+ * @brief Calls recorded until destruction go to pass, including ones from
+ *        jobs the scope waits for. Scopes should not nest.
+ */
+class PassScope {
+public:
+  explicit PassScope(Pass pass);
+  ~PassScope();
+
+private:
+  Pass m_previous;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+namespace detail {
+extern std::atomic<bool> g_active;
+extern std::atomic<bool> g_time_calls;
+void count(Call call);
+void addTime(Call call, std::chrono::steady_clock::duration elapsed);
+
+template <typename Fn> inline void intercept(Call call, Fn &&fn) {
+  if (!g_active.load(std::memory_order_relaxed)) {
+    fn();
+    return;
+  }
+  count(call);
+  if (!g_time_calls.load(std::memory_order_relaxed)) {
+    fn();
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  addTime(call, std::chrono::steady_clock::now() - start);
+}
+} // namespace detail
+
+inline void cmdBindPipeline(VkCommandBuffer cmd, VkPipelineBindPoint point,
+                            VkPipeline pipeline) {
+  detail::intercept(Call::BindPipeline,
+                    [&]() { vkCmdBindPipeline(cmd, point, pipeline); });
+}
+inline void cmdBindDescriptorSets(VkCommandBuffer cmd,
+                                  VkPipelineBindPoint point,
+                                  VkPipelineLayout layout, uint32_t first_set,
+                                  uint32_t n_sets, const VkDescriptorSet *sets,
+                                  uint32_t n_dynamic_offsets,
+                                  const uint32_t *dynamic_offsets) {
+  detail::intercept(Call::BindDescriptorSets, [&]() {
+    vkCmdBindDescriptorSets(cmd, point, layout, first_set, n_sets, sets,
+                            n_dynamic_offsets, dynamic_offsets);
+  });
+}
+inline void cmdPushConstants(VkCommandBuffer cmd, VkPipelineLayout layout,
+                             VkShaderStageFlags stages, uint32_t offset,
+                             uint32_t size, const void *values) {
+  detail::intercept(Call::PushConstants, [&]() {
+    vkCmdPushConstants(cmd, layout, stages, offset, size, values);
+  });
+}
+inline void cmdBindIndexBuffer(VkCommandBuffer cmd, VkBuffer buffer,
+                               VkDeviceSize offset, VkIndexType type) {
+  detail::intercept(Call::BindIndexBuffer, [&]() {
+    vkCmdBindIndexBuffer(cmd, buffer, offset, type);
+  });
+}
+inline void cmdDrawIndexed(VkCommandBuffer cmd, uint32_t n_index,
+                           uint32_t n_instance, uint32_t first_index,
+                           int32_t vertex_offset, uint32_t first_instance) {
+  detail::intercept(Call::DrawIndexed, [&]() {
+    vkCmdDrawIndexed(cmd, n_index, n_instance, first_index, vertex_offset,
+                     first_instance);
+  });
+}
+inline void cmdDrawIndexedIndirect(VkCommandBuffer cmd, VkBuffer buffer,
+                                   VkDeviceSize offset, uint32_t n_draws,
+                                   uint32_t stride) {
+  detail::intercept(Call::DrawIndexedIndirect, [&]() {
+    vkCmdDrawIndexedIndirect(cmd, buffer, offset, n_draws, stride);
+  });
+}
+inline void cmdDispatch(VkCommandBuffer cmd, uint32_t x, uint32_t y,
+                        uint32_t z) {
+  detail::intercept(Call::Dispatch, [&]() { vkCmdDispatch(cmd, x, y, z); });
+}
+
+} // namespace vkstats
+
+// Route the calls of the including file, after the wrappers are defined.
+#define vkCmdBindPipeline vkstats::cmdBindPipeline
+#define vkCmdBindDescriptorSets vkstats::cmdBindDescriptorSets
+#define vkCmdPushConstants vkstats::cmdPushConstants
+#define vkCmdBindIndexBuffer vkstats::cmdBindIndexBuffer
+#define vkCmdDrawIndexed vkstats::cmdDrawIndexed
+#define vkCmdDrawIndexedIndirect vkstats::cmdDrawIndexedIndirect
+#define vkCmdDispatch vkstats::cmdDispatch
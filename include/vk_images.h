@@ -5,6 +5,19 @@
 namespace vkutil {
 void transitionImage(VkCommandBuffer cmd, VkImage image,
                      VkImageLayout cur_layout, VkImageLayout new_layout);
+/**
+ * @brief Queue family ownership transfer with layout transition.
+ * @note  Record the same barrier on both queues, release on the source
+ *        queue and acquire on the destination queue.
+ */
+void transferImageOwnership(VkCommandBuffer cmd, VkImage image,
+                            VkImageLayout cur_layout, VkImageLayout new_layout,
+                            uint32_t src_queue_family,
+                            uint32_t dst_queue_family);
+/// @brief Global memory barrier, for buffers written and read by shaders.
+void memoryBarrier(VkCommandBuffer cmd, VkPipelineStageFlags2 src_stage,
+                   VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage,
+                   VkAccessFlags2 dst_access);
 void copyImage(VkCommandBuffer cmd, VkImage src, VkImage dst,
                VkExtent2D src_size, VkExtent2D dst_size);
 void generateMipmap(VkCommandBuffer cmd, VkImage image, VkExtent2D image_size);
@@ -5,8 +5,9 @@
 namespace vkinit {
 VkCommandPoolCreateInfo cmdPoolCreateInfo(uint32_t queue_family_idx,
                                           VkCommandPoolCreateFlags flags = 0);
-VkCommandBufferAllocateInfo cmdBufferAllocInfo(VkCommandPool pool,
-                                              uint32_t count = 1);
+VkCommandBufferAllocateInfo cmdBufferAllocInfo(
+    VkCommandPool pool, uint32_t count = 1,
+    VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 
 VkCommandBufferBeginInfo
 cmdBufferBeginInfo(VkCommandBufferUsageFlags flags = 0);
@@ -15,6 +16,9 @@ VkCommandBufferSubmitInfo cmdBufferSubmitInfo(VkCommandBuffer cmd);
 VkFenceCreateInfo fenceCreateInfo(VkFenceCreateFlags flags = 0);
 
 VkSemaphoreCreateInfo semaphoreCreateInfo(VkSemaphoreCreateFlags flags = 0);
+/// @brief Chain into semaphoreCreateInfo() for a timeline semaphore.
+VkSemaphoreTypeCreateInfo
+semaphoreTypeCreateInfo(VkSemaphoreType type, uint64_t initial_value = 0);
 
 VkSubmitInfo2 submitInfo(VkCommandBufferSubmitInfo *cmd,
                          VkSemaphoreSubmitInfo *signal_info,
@@ -35,8 +39,10 @@ VkRenderingInfo renderingInfo(VkExtent2D render_extent,
 
 VkImageSubresourceRange imageSubresourceRange(VkImageAspectFlags aspect_mask);
 
+/// @param value  Ignored by binary semaphores.
 VkSemaphoreSubmitInfo semaphoreSubmitInfo(VkPipelineStageFlags2 stage_mask,
-                                          VkSemaphore semaphore);
+                                          VkSemaphore semaphore,
+                                          uint64_t value = 1);
 VkDescriptorSetLayoutBinding
 descriptorsetLayoutBinding(VkDescriptorType type,
                            VkShaderStageFlags stage_flags, uint32_t binding);
@@ -4,8 +4,60 @@
 #include <unordered_map>
 #include <filesystem>
 
+namespace fastgltf {
+class Asset;
+struct Primitive;
+} // namespace fastgltf
+
 std::optional<std::vector<std::shared_ptr<MeshAsset>>>
 loadGltfMeshes(Engine *engine, std::filesystem::path file_path);
 
+/// @brief Load a file in one go, main thread only.
 std::optional<std::shared_ptr<LoadedGLTF>>
 loadGltf(Engine *engine, std::filesystem::path file_path);
+
+/**
+ * @brief Append indices and vertices of a primitive, indices offset past the
+ *        vertices already there. Thread safe.
+ * @return Whether the primitive has vertex colors.
+ */
+bool readPrimitive(fastgltf::Asset &gltf, fastgltf::Primitive &primitive,
+                   std::vector<uint32_t> &indices,
+                   std::vector<Vertex> &vertices);
+
+/// @brief CPU side of a file between the two loading stages.
+struct GltfStaging;
+/**
+ * @brief Parse, decode images and process geometry. Creates no Vulkan
+ *        object, safe off the main thread.
+ * @return Null if the file could not be parsed.
+ */
+std::shared_ptr<GltfStaging> parseGltf(Engine *engine,
+                                       std::filesystem::path file_path,
+                                       bool compact_vertices);
+/// @brief Random scene for scaling tests, same seed gives the same scene.
+struct SyntheticSceneConfig {
+  uint32_t n_objects{1000}; // Mesh nodes.
+  uint32_t n_meshes{16};    // Unique meshes the objects pick from.
+  uint32_t n_materials{16};
+  uint32_t n_textures{8}; // Color textures, shared by the materials.
+  uint32_t texture_size{256};
+  uint32_t mesh_rings{32};     // Detail of the finest mesh.
+  uint32_t hierarchy_depth{2}; // Levels of group nodes above the objects.
+  uint32_t branching{8};       // Children per group node.
+  float spacing{4.f};          // Between objects on the grid.
+  uint32_t seed{1};
+};
+/**
+ * @brief Build the staging of a synthetic scene, for finishGltf(). Creates
+ *        no Vulkan object, safe off the main thread.
+ * @note  Texture and mesh jobs go to the calling thread's deque. Off the
+ *        main thread, call from a worker or a thread given a background
+ *        deque by JobSystem::registerThread(), as the scene loader is.
+ */
+std::shared_ptr<GltfStaging>
+generateScene(Engine *engine, const SyntheticSceneConfig &config,
+              bool compact_vertices);
+/// @brief Upload and build the scene of a parsed file, main thread only.
+std::optional<std::shared_ptr<LoadedGLTF>> finishGltf(Engine *engine,
+                                                      GltfStaging &staging);
@@ -21,6 +21,8 @@ struct PipelineBuilder {
   void clear();
   VkPipeline buildPipeline(VkDevice device);
   void setShaders(VkShaderModule vert, VkShaderModule frag);
+  /// @brief For depth only pipelines, no color attachment.
+  void setVertexShader(VkShaderModule vert);
   void setInputTopology(VkPrimitiveTopology topology);
   void setPolygonMode(VkPolygonMode mode);
   void setCullMode(VkCullModeFlags mode, VkFrontFace front);
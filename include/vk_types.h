@@ -70,6 +70,7 @@ struct AllocatedImage {
  */
 struct AllocatedBuffer {
   VkBuffer buffer;
+  VkDeviceSize size; // As requested, the allocation may be larger.
 
   VmaAllocation allocation;
   VmaAllocationInfo alloc_info;
@@ -81,14 +82,51 @@ struct Vertex {
   float uv_y;
   glm::vec4 color;
 };
+/**
+ * @brief Cluster of triangles, a contiguous index range of a surface.
+ *        GPU layout, see cluster_cull.comp.
+ */
+struct Meshlet {
+  glm::vec4 sphere; // Object space center and radius.
+  glm::vec4 cone;   // Axis and cutoff of normals, cutoff 1 never culls.
+  uint32_t first_index;
+  uint32_t index_count;
+  uint32_t padding[2];
+};
+/**
+ * @brief 16 bytes, see vertex_fetch.glsl. Position is relative to the bound
+ *        of the surface using it, color goes to a separate stream.
+ */
+struct CompactVertex {
+  uint32_t position_xy; // snorm16x2.
+  uint32_t position_z;  // snorm16, high half unused.
+  uint32_t normal;      // Octahedral, snorm16x2.
+  uint32_t uv;          // half2.
+};
+/// @brief Bit flags, match vertex_fetch.glsl.
+enum VertexLayoutFlags : uint32_t {
+  kVertexLayoutFull = 0,
+  kVertexLayoutCompact = 1,
+  kVertexLayoutColor = 2, // Compact layout with color stream.
+};
 struct GPUMeshBuffers {
   AllocatedBuffer index_buffer;
   AllocatedBuffer vertex_buffer;
+  AllocatedBuffer color_buffer;   // Empty if not compact or no color.
+  AllocatedBuffer meshlet_buffer; // Empty if no meshlets.
   VkDeviceAddress vertex_buffer_address;
+  VkDeviceAddress color_buffer_address;
+  VkDeviceAddress index_buffer_address;
+  VkDeviceAddress meshlet_buffer_address;
+  uint32_t vertex_layout; // VertexLayoutFlags.
+  VkIndexType index_type;
 };
 struct GPUDrawPushConstants {
   glm::mat4 world_mat;
   VkDeviceAddress vertex_buffer_address;
+  VkDeviceAddress color_buffer_address;
+  glm::vec4 position_bound; // Dequantization of compact positions.
+  uint32_t vertex_layout;
 };
 
 struct MaterialPipeline {
@@ -113,11 +151,26 @@ struct GeometryBound {
   glm::vec3 origin;
   float radius;
 };
+/// @brief Coarser index range of a surface, same vertices.
+struct SurfaceLod {
+  uint32_t start_index;
+  uint32_t count;
+  float error; // Geometric error in object space.
+  uint32_t first_meshlet;
+  uint32_t meshlet_count;
+};
 struct GeometrySurface {
   uint32_t start_index;
   uint32_t count;
   std::shared_ptr<GLTFMaterial> material;
   GeometryBound bound;
+  // From fine to coarse, not including the full detail range above.
+  std::vector<SurfaceLod> lods;
+  // Meshlets of the full detail range.
+  uint32_t first_meshlet{0};
+  uint32_t meshlet_count{0};
+  // Added to every index of the surface and its LODs, keeps them 16-bit.
+  uint32_t base_vertex{0};
 };
 struct MeshAsset {
   std::string name;
@@ -0,0 +1,121 @@
+#include "asset_cache.h"
+
+#include "engine.h"
+
+uint64_t assetutil::hashBytes(const void *data, size_t size, uint64_t seed) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+uint64_t assetutil::hashSampler(const VkSamplerCreateInfo &info) {
+  // Field by field, padding bytes are not guaranteed to be zero.
+  uint64_t hash = kHashSeed;
+  auto add = [&](const auto &field) {
+    hash = hashBytes(&field, sizeof(field), hash);
+  };
+  add(info.flags);
+  add(info.magFilter);
+  add(info.minFilter);
+  add(info.mipmapMode);
+  add(info.addressModeU);
+  add(info.addressModeV);
+  add(info.addressModeW);
+  add(info.mipLodBias);
+  add(info.anisotropyEnable);
+  add(info.maxAnisotropy);
+  add(info.compareEnable);
+  add(info.compareOp);
+  add(info.minLod);
+  add(info.maxLod);
+  add(info.borderColor);
+  add(info.unnormalizedCoordinates);
+  return hash;
+}
+
+void AssetCache::init(Engine *engine) { m_engine = engine; }
+void AssetCache::destroy() {
+  for (auto &[handle, texture] : m_textures)
+    m_engine->m_texture_streamer.removeTexture(handle);
+  for (auto &[hash, sampler] : m_samplers)
+    vkDestroySampler(m_engine->m_device, sampler.sampler, nullptr);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_texture_by_hash.clear();
+  }
+  m_textures.clear();
+  m_samplers.clear();
+  m_sampler_hashes.clear();
+}
+
+bool AssetCache::hasTexture(uint64_t hash) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_texture_by_hash.contains(hash);
+}
+std::optional<TextureHandle> AssetCache::acquireTexture(uint64_t hash) {
+  auto it = m_texture_by_hash.find(hash);
+  if (it == m_texture_by_hash.end())
+    return {};
+  CachedTexture &texture = m_textures.at(it->second);
+  texture.refs++;
+  m_stats.texture_hits++;
+  m_stats.texture_bytes_saved += texture.bytes;
+  return it->second;
+}
+TextureHandle AssetCache::addTexture(uint64_t hash, TextureSource &&source) {
+  size_t bytes = source.bytesFrom(0);
+  TextureHandle handle =
+      m_engine->m_texture_streamer.addTexture(std::move(source));
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_texture_by_hash[hash] = handle;
+  }
+  m_textures[handle] = CachedTexture{hash, 1, bytes};
+  m_stats.texture_misses++;
+  m_stats.n_textures++;
+  return handle;
+}
+void AssetCache::releaseTexture(TextureHandle handle) {
+  auto it = m_textures.find(handle);
+  if (it == m_textures.end() || --it->second.refs > 0)
+    return;
+  m_engine->m_texture_streamer.removeTexture(handle);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_texture_by_hash.erase(it->second.hash);
+  }
+  m_textures.erase(it);
+  m_stats.n_textures--;
+}
+
+VkSampler AssetCache::acquireSampler(const VkSamplerCreateInfo &info) {
+  uint64_t hash = assetutil::hashSampler(info);
+  auto it = m_samplers.find(hash);
+  if (it != m_samplers.end()) {
+    it->second.refs++;
+    m_stats.sampler_hits++;
+    return it->second.sampler;
+  }
+  VkSampler sampler;
+  VK_CHECK(vkCreateSampler(m_engine->m_device, &info, nullptr, &sampler));
+  m_samplers[hash] = CachedSampler{sampler, 1};
+  m_sampler_hashes[sampler] = hash;
+  m_stats.sampler_misses++;
+  m_stats.n_samplers++;
+  return sampler;
+}
+void AssetCache::releaseSampler(VkSampler sampler) {
+  auto hash = m_sampler_hashes.find(sampler);
+  if (hash == m_sampler_hashes.end())
+    return;
+  auto it = m_samplers.find(hash->second);
+  if (--it->second.refs > 0)
+    return;
+  vkDestroySampler(m_engine->m_device, sampler, nullptr);
+  m_samplers.erase(it);
+  m_sampler_hashes.erase(hash);
+  m_stats.n_samplers--;
+}
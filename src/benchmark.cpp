@@ -0,0 +1,353 @@
+#include "benchmark.h"
+
+#include "engine.h"
+#include "vk_call_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <glm/gtc/constants.hpp>
+
+bool CameraPath::load(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (!file)
+    return false;
+  keys.clear();
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#')
+      continue;
+    CameraKey key;
+    if (sscanf(line, "%f %f %f %f %f %f", &key.time, &key.position.x,
+               &key.position.y, &key.position.z, &key.pitch,
+               &key.yaw) == 6)
+      keys.push_back(key);
+  }
+  fclose(file);
+  std::stable_sort(keys.begin(), keys.end(),
+                   [](const CameraKey &a, const CameraKey &b) {
+                     return a.time < b.time;
+                   });
+  return !keys.empty();
+}
+bool CameraPath::save(const std::string &path) const {
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+  fmt::print(file, "# time x y z pitch yaw\n");
+  for (const CameraKey &key : keys)
+    fmt::print(file, "{} {} {} {} {} {}\n", key.time, key.position.x,
+               key.position.y, key.position.z, key.pitch, key.yaw);
+  fclose(file);
+  return true;
+}
+void CameraPath::orbit(glm::vec3 center, float radius, float height,
+                       float duration, uint32_t n_keys) {
+  keys.clear();
+  for (uint32_t i = 0; i <= n_keys; i++) {
+    float t = static_cast<float>(i) / n_keys;
+    float angle = t * glm::two_pi<float>();
+    CameraKey key;
+    key.time = t * duration;
+    key.position =
+        center + glm::vec3{radius * std::sin(angle), height,
+                           radius * std::cos(angle)};
+    // Yaw turns around -y, zero looks down -z.
+    key.yaw = -angle;
+    key.pitch = -std::atan2(height, radius);
+    keys.push_back(key);
+  }
+}
+void CameraPath::sample(float time, Camera &camera) const {
+  camera.velocity = glm::vec3{0.f};
+  if (keys.empty())
+    return;
+  time = std::clamp(time, keys.front().time, keys.back().time);
+  size_t i = 0;
+  while (i + 2 < keys.size() && keys[i + 1].time <= time)
+    i++;
+  const CameraKey &k1 = keys[i];
+  const CameraKey &k2 = keys[std::min(i + 1, keys.size() - 1)];
+  const CameraKey &k0 = keys[i > 0 ? i - 1 : 0];
+  const CameraKey &k3 = keys[std::min(i + 2, keys.size() - 1)];
+  float span = k2.time - k1.time;
+  float u = span > 0.f ? (time - k1.time) / span : 0.f;
+  // Uniform Catmull-Rom, passes through every key.
+  auto spline = [u](auto p0, auto p1, auto p2, auto p3) {
+    float u2 = u * u;
+    float u3 = u2 * u;
+    return 0.5f * ((2.f * p1) + (p2 - p0) * u +
+                   (2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * u2 +
+                   (3.f * p1 - p0 - 3.f * p2 + p3) * u3);
+  };
+  camera.position = spline(k0.position, k1.position, k2.position,
+                           k3.position);
+  camera.pitch = spline(k0.pitch, k1.pitch, k2.pitch, k3.pitch);
+  camera.yaw = spline(k0.yaw, k1.yaw, k2.yaw, k3.yaw);
+}
+
+bool parseBenchmarkArgs(int argc, char *argv[], BenchmarkConfig &config) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    bool has_value = i + 1 < argc && argv[i + 1][0] != '-';
+    if (strcmp(arg, "--benchmark") == 0) {
+      config.enabled = true;
+      if (has_value)
+        config.scene_path = argv[++i];
+    } else if (strcmp(arg, "--hidden") == 0) {
+      config.hidden_window = true;
+    } else if (strcmp(arg, "--time-calls") == 0) {
+      config.time_calls = true;
+    } else if (strcmp(arg, "--pin-threads") == 0) {
+      config.pin_threads = true;
+    } else if (!has_value) {
+      fmt::println("Unknown or incomplete argument {}", arg);
+      return false;
+    } else if (strcmp(arg, "--synthetic") == 0) {
+      config.synthetic_objects = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (strcmp(arg, "--camera-path") == 0) {
+      config.camera_path = argv[++i];
+    } else if (strcmp(arg, "--report") == 0) {
+      config.report_path = argv[++i];
+    } else if (strcmp(arg, "--frames") == 0) {
+      config.n_frames = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (strcmp(arg, "--warmup") == 0) {
+      config.n_warmup_frames = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (strcmp(arg, "--timestep") == 0) {
+      config.timestep = static_cast<float>(std::atof(argv[++i]));
+    } else if (strcmp(arg, "--call-stats") == 0) {
+      config.call_stats_path = argv[++i];
+    } else if (strcmp(arg, "--lights") == 0) {
+      config.n_lights = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else {
+      fmt::println("Unknown argument {}", arg);
+      return false;
+    }
+  }
+  return true;
+}
+
+void BenchmarkRunner::init(Engine *engine, const BenchmarkConfig &config) {
+  m_engine = engine;
+  m_config = config;
+  if (!m_config.enabled)
+    return;
+  m_config.n_frames = std::max(1u, m_config.n_frames);
+  if (m_config.camera_path.empty() || !m_path.load(m_config.camera_path)) {
+    if (!m_config.camera_path.empty())
+      fmt::println("Failed to load camera path {}, orbiting instead",
+                   m_config.camera_path);
+    m_path.orbit(glm::vec3{0.f}, 30.f, 10.f,
+                 m_config.n_frames * m_config.timestep);
+  }
+  m_samples.clear();
+  m_samples.reserve(m_config.n_frames);
+  if (m_config.synthetic_objects > 0) {
+    SyntheticSceneConfig synthetic;
+    synthetic.n_objects = m_config.synthetic_objects;
+    m_scene = engine->m_scenes.requestScene("benchmark", synthetic);
+    m_config.scene_path =
+        fmt::format("synthetic:{}", m_config.synthetic_objects);
+  } else {
+    m_scene =
+        engine->m_scenes.requestScene("benchmark", m_config.scene_path);
+  }
+  if (m_config.n_lights > 0) {
+    // Same box as the orbit, seeded, so runs light the same.
+    engine->m_lighting.scatter(m_config.n_lights, glm::vec3{0.f},
+                               glm::vec3{30.f, 5.f, 30.f});
+    engine->m_use_clustered_lighting = true;
+  }
+  m_state = State::Loading;
+  m_frame = 0;
+}
+
+void BenchmarkRunner::beginFrame(Camera &camera) {
+  if (!running())
+    return;
+  // Warm up at the first key, measured frames walk the path.
+  float time = m_state == State::Measuring ? m_frame * m_config.timestep : 0.f;
+  m_path.sample(time, camera);
+}
+void BenchmarkRunner::endFrame(const EngineStats &stats) {
+  switch (m_state) {
+  case State::Loading:
+    if (m_scene.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready)
+      return;
+    if (!m_scene.get()) {
+      fmt::println("Benchmark scene {} failed to load", m_config.scene_path);
+      m_failed = true;
+      m_state = State::Done;
+      return;
+    }
+    m_state = State::Warmup;
+    m_frame = 0;
+    return;
+  case State::Warmup:
+    if (++m_frame < m_config.n_warmup_frames)
+      return;
+    m_state = State::Measuring;
+    m_frame = 0;
+    // Counting starts with the next frame drawn.
+    if (!m_config.call_stats_path.empty()) {
+      vkstats::setEnabled(true);
+      vkstats::setTimeCalls(m_config.time_calls);
+      vkstats::reset();
+    }
+    return;
+  case State::Measuring: {
+    BenchmarkSample sample;
+    sample.frame_ms = stats.t_frame.period_ms;
+    sample.cpu_draw_ms = stats.t_cpu_draw.period_ms;
+    sample.scene_update_ms = stats.t_scene_update.period_ms;
+    sample.update_wait_ms = stats.t_update_wait.period_ms;
+    sample.record_ms = stats.t_record.period_ms;
+    sample.gpu_ms = stats.gpu_frame_ms;
+    sample.n_drawcalls = stats.n_drawcalls;
+    sample.n_triangles = stats.n_triangles;
+    sample.device_memory = 0;
+    for (const HeapBudget &heap : stats.heaps) {
+      if (heap.device_local)
+        sample.device_memory += heap.usage;
+    }
+    m_samples.push_back(sample);
+    if (++m_frame < m_config.n_frames)
+      return;
+    writeReport();
+    if (!m_config.call_stats_path.empty()) {
+      vkstats::setEnabled(false);
+      if (!vkstats::dump(m_config.call_stats_path))
+        m_failed = true;
+    }
+    m_state = State::Done;
+    return;
+  }
+  default:
+    return;
+  }
+}
+
+namespace {
+std::string jsonString(const std::string &s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+/// @brief Write "name": {mean, percentiles, max} of one sample field.
+template <typename Field>
+void writeSummary(FILE *file, const char *name,
+                  const std::vector<BenchmarkSample> &samples, Field field) {
+  std::vector<double> values;
+  values.reserve(samples.size());
+  for (const BenchmarkSample &sample : samples)
+    values.push_back(static_cast<double>(field(sample)));
+  std::sort(values.begin(), values.end());
+  double total = 0.0;
+  for (double v : values)
+    total += v;
+  // Nearest rank.
+  auto percentile = [&](double p) {
+    size_t i = static_cast<size_t>(p * values.size());
+    return values[std::min(i, values.size() - 1)];
+  };
+  fmt::print(file,
+             "    \"{}\": {{\"mean\": {:.4f}, \"min\": {:.4f}, "
+             "\"median\": {:.4f}, \"p95\": {:.4f}, \"p99\": {:.4f}, "
+             "\"max\": {:.4f}}}",
+             name, total / values.size(), values.front(), percentile(0.5),
+             percentile(0.95), percentile(0.99), values.back());
+}
+} // namespace
+
+void BenchmarkRunner::writeReport() {
+  FILE *file = fopen(m_config.report_path.c_str(), "w");
+  if (!file) {
+    fmt::println("Failed to open {}", m_config.report_path);
+    m_failed = true;
+    return;
+  }
+  Engine &engine = *m_engine;
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(engine.m_chosen_GPU, &properties);
+  fmt::print(file, "{{\n");
+  fmt::print(file, "  \"scene\": {},\n", jsonString(m_config.scene_path));
+  fmt::print(file, "  \"camera_path\": {},\n",
+             jsonString(m_config.camera_path));
+  fmt::print(file, "  \"gpu\": {},\n", jsonString(properties.deviceName));
+  fmt::print(file, "  \"extent\": [{}, {}],\n",
+             engine.m_swapchain_extent.width,
+             engine.m_swapchain_extent.height);
+  fmt::print(file, "  \"warmup_frames\": {},\n", m_config.n_warmup_frames);
+  fmt::print(file, "  \"frames\": {},\n", m_samples.size());
+  fmt::print(file, "  \"timestep\": {},\n", m_config.timestep);
+  fmt::print(file,
+             "  \"settings\": {{\"render_scale\": {}, \"upscaler\": {}, "
+             "\"occlusion_culling\": {}, \"cluster_culling\": {}, "
+             "\"depth_prepass\": {}, \"lod\": {}, \"record_threads\": {}, "
+             "\"lights\": {}, \"pinned_threads\": {}}},\n",
+             engine.m_render_scale, engine.m_use_upscaler,
+             engine.m_use_occlusion_culling, engine.m_use_cluster_culling,
+             engine.m_use_depth_prepass, engine.m_use_lod,
+             engine.m_record_threads,
+             engine.m_use_clustered_lighting ? engine.m_lighting.lights.size()
+                                             : 0,
+             m_config.pin_threads);
+  fmt::print(file, "  \"summary\": {{\n");
+  using Sample = BenchmarkSample;
+  writeSummary(file, "frame_ms", m_samples,
+               [](const Sample &s) { return s.frame_ms; });
+  fmt::print(file, ",\n");
+  writeSummary(file, "cpu_draw_ms", m_samples,
+               [](const Sample &s) { return s.cpu_draw_ms; });
+  fmt::print(file, ",\n");
+  writeSummary(file, "scene_update_ms", m_samples,
+               [](const Sample &s) { return s.scene_update_ms; });
+  fmt::print(file, ",\n");
+  writeSummary(file, "update_wait_ms", m_samples,
+               [](const Sample &s) { return s.update_wait_ms; });
+  fmt::print(file, ",\n");
+  writeSummary(file, "record_ms", m_samples,
+               [](const Sample &s) { return s.record_ms; });
+  fmt::print(file, ",\n");
+  writeSummary(file, "gpu_ms", m_samples,
+               [](const Sample &s) { return s.gpu_ms; });
+  fmt::print(file, ",\n");
+  writeSummary(file, "drawcalls", m_samples,
+               [](const Sample &s) { return s.n_drawcalls; });
+  fmt::print(file, ",\n");
+  writeSummary(file, "triangles", m_samples,
+               [](const Sample &s) { return s.n_triangles; });
+  fmt::print(file, ",\n");
+  writeSummary(file, "device_memory_bytes", m_samples,
+               [](const Sample &s) { return s.device_memory; });
+  fmt::print(file, "\n  }},\n");
+  // Per frame, for plotting or diffing two runs.
+  fmt::print(file, "  \"samples\": [\n");
+  for (size_t i = 0; i < m_samples.size(); i++) {
+    const BenchmarkSample &s = m_samples[i];
+    fmt::print(file,
+               "    [{:.4f}, {:.4f}, {:.4f}, {:.4f}, {:.4f}, {:.4f}, {}, {}, "
+               "{}]{}\n",
+               s.frame_ms, s.cpu_draw_ms, s.scene_update_ms, s.update_wait_ms,
+               s.record_ms, s.gpu_ms, s.n_drawcalls, s.n_triangles,
+               s.device_memory,
+               i + 1 < m_samples.size() ? "," : "");
+  }
+  fmt::print(file, "  ],\n");
+  fmt::print(file,
+             "  \"sample_fields\": [\"frame_ms\", \"cpu_draw_ms\", "
+             "\"scene_update_ms\", \"update_wait_ms\", \"record_ms\", "
+             "\"gpu_ms\", \"drawcalls\", \"triangles\", "
+             "\"device_memory_bytes\"]\n");
+  fmt::print(file, "}}\n");
+  fclose(file);
+  fmt::println("Benchmark report written to {}", m_config.report_path);
+}
@@ -0,0 +1,221 @@
+#include "clustered_lighting.h"
+
+#include "engine.h"
+#include "vk_images.h"
+#include "vk_initializers.h"
+#include "vk_pipelines.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <random>
+
+// Last, it routes vkCmd* calls below through the counters.
+#include "vk_call_stats.h"
+
+static_assert(ClusteredLighting::kSlots == kFrameOverlap);
+
+struct LightCullPushConstants {
+  glm::mat4 view;
+  glm::vec4 projection; // proj[0][0], proj[1][1], near and far depth.
+  glm::uvec4 grid;      // Tiles x and y, slices, max lights a cluster.
+  uint32_t n_lights;
+};
+
+void ClusteredLighting::init(Engine *engine) {
+  m_engine = engine;
+  VkDevice device = engine->m_device;
+  {
+    DescriptorLayoutBuilder builder;
+    builder.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Lights.
+    builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Counts.
+    builder.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Indices.
+    m_ds_layout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+  VkPushConstantRange push_range = {};
+  push_range.offset = 0;
+  push_range.size = sizeof(LightCullPushConstants);
+  push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkPipelineLayoutCreateInfo ci_layout = vkinit::pipelineLayoutCreateInfo();
+  ci_layout.pSetLayouts = &m_ds_layout;
+  ci_layout.setLayoutCount = 1;
+  ci_layout.pPushConstantRanges = &push_range;
+  ci_layout.pushConstantRangeCount = 1;
+  VK_CHECK(
+      vkCreatePipelineLayout(device, &ci_layout, nullptr, &m_pipeline_layout));
+
+  VkShaderModule cull_shader;
+  if (!vkutil::loadShaderModule("../../assets/shaders/light_cull.comp.spv",
+                                device, &cull_shader)) {
+    fmt::println("Error building compute shader.");
+  }
+  VkComputePipelineCreateInfo ci_pipeline = {};
+  ci_pipeline.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  ci_pipeline.pNext = nullptr;
+  ci_pipeline.layout = m_pipeline_layout;
+  ci_pipeline.stage = vkinit::pipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_COMPUTE_BIT, cull_shader);
+  VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &ci_pipeline,
+                                    nullptr, &m_pipeline));
+  vkDestroyShaderModule(device, cull_shader, nullptr);
+
+  // Frame sets always bind these, lit or not.
+  for (FrameBuffers &frame : m_frames) {
+    frame.light_capacity = 64;
+    frame.lights = engine->createBuffer(
+        frame.light_capacity * sizeof(GPULight),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    frame.counts = engine->createBuffer(kClusters * sizeof(uint32_t),
+                                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                        VMA_MEMORY_USAGE_GPU_ONLY);
+    frame.indices = engine->createBuffer(
+        kClusters * kMaxLightsPerCluster * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    frame.n_lights = 0;
+  }
+}
+void ClusteredLighting::destroy() {
+  for (FrameBuffers &frame : m_frames) {
+    m_engine->destroyBuffer(frame.lights);
+    m_engine->destroyBuffer(frame.counts);
+    m_engine->destroyBuffer(frame.indices);
+    frame = FrameBuffers{};
+  }
+  VkDevice device = m_engine->m_device;
+  vkDestroyPipeline(device, m_pipeline, nullptr);
+  vkDestroyPipelineLayout(device, m_pipeline_layout, nullptr);
+  vkDestroyDescriptorSetLayout(device, m_ds_layout, nullptr);
+}
+
+void ClusteredLighting::scatter(uint32_t n, glm::vec3 center,
+                                glm::vec3 half_extent, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  auto signedUnit = [&]() { return 2.f * unit(rng) - 1.f; };
+  lights.clear();
+  lights.reserve(n);
+  for (uint32_t i = 0; i < n; i++) {
+    Light light;
+    light.position =
+        center + half_extent * glm::vec3{signedUnit(), signedUnit(),
+                                         signedUnit()};
+    // Saturated colors, so overlapping lights stay apart.
+    light.color = glm::vec3{unit(rng), unit(rng), unit(rng)};
+    light.color /= std::max({light.color.r, light.color.g, light.color.b,
+                             1e-3f});
+    light.intensity = 1.f + 4.f * unit(rng);
+    light.range = 2.f + 6.f * unit(rng);
+    if (i % 4 == 3) {
+      light.type = LightType::Spot;
+      light.direction = glm::normalize(
+          glm::vec3{0.5f * signedUnit(), -1.f, 0.5f * signedUnit()});
+      light.range *= 2.f;
+    }
+    lights.push_back(light);
+  }
+}
+
+ClusteredLighting::FrameBuffers &ClusteredLighting::currentFrame() {
+  return m_frames[m_engine->frame_number % kSlots];
+}
+
+void ClusteredLighting::prepare(GPUSceneData &scene_data, VkExtent2D extent) {
+  FrameBuffers &frame = currentFrame();
+  // Slot was last used kSlots frames ago, its timeline value is reached.
+  if (frame.light_capacity < lights.size()) {
+    m_engine->destroyBuffer(frame.lights);
+    frame.light_capacity = std::bit_ceil(lights.size());
+    frame.lights = m_engine->createBuffer(
+        frame.light_capacity * sizeof(GPULight),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+  }
+  // Frustum planes, with the near one of [-1, 1] depth, so it holds for
+  // either depth range.
+  glm::mat4 m = glm::transpose(scene_data.view_proj);
+  std::array<glm::vec4, 6> planes = {m[3] + m[0], m[3] - m[0], m[3] + m[1],
+                                     m[3] - m[1], m[3] + m[2], m[3] - m[2]};
+  for (glm::vec4 &plane : planes)
+    plane /= glm::length(glm::vec3(plane));
+
+  GPULight *gpu_lights =
+      static_cast<GPULight *>(frame.lights.alloc_info.pMappedData);
+  uint32_t n_uploaded = 0;
+  for (const Light &light : lights) {
+    bool inside = true;
+    for (const glm::vec4 &plane : planes)
+      inside = inside &&
+               glm::dot(glm::vec3(plane), light.position) + plane.w >
+                   -light.range;
+    if (!inside)
+      continue;
+    GPULight &gpu = gpu_lights[n_uploaded++];
+    gpu.position_range = glm::vec4(light.position, light.range);
+    gpu.color_intensity = glm::vec4(light.color, light.intensity);
+    gpu.direction_type = glm::vec4(light.direction,
+                                   static_cast<float>(light.type));
+    float cos_outer = std::cos(light.outer_angle);
+    float cos_inner = std::cos(std::min(light.inner_angle, light.outer_angle));
+    float cos_range = std::max(cos_inner - cos_outer, 1e-4f);
+    gpu.spot = glm::vec4(cos_outer, 1.f / cos_range, 0.f, 0.f);
+  }
+  frame.n_lights = n_uploaded;
+  m_stats.n_lights = static_cast<uint32_t>(lights.size());
+  m_stats.n_uploaded = n_uploaded;
+
+  // Slices 1 to kSlices - 2 split [near, far] evenly in log depth.
+  float scale = (kSlices - 2) / std::log(far_depth / near_depth);
+  scene_data.light_grid =
+      glm::uvec4(kTilesX, kTilesY, kSlices, kMaxLightsPerCluster);
+  scene_data.light_slicing =
+      glm::vec4(scale, -scale * std::log(near_depth),
+                static_cast<float>(extent.width) / kTilesX,
+                static_cast<float>(extent.height) / kTilesY);
+}
+
+void ClusteredLighting::writeFrameSet(DescriptorWriter &writer) {
+  FrameBuffers &frame = currentFrame();
+  writer.writeBuffer(1, frame.lights.buffer,
+                     frame.light_capacity * sizeof(GPULight), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(2, frame.counts.buffer, kClusters * sizeof(uint32_t), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(3, frame.indices.buffer,
+                     kClusters * kMaxLightsPerCluster * sizeof(uint32_t), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+}
+
+void ClusteredLighting::record(VkCommandBuffer cmd,
+                               const GPUSceneData &scene_data) {
+  FrameBuffers &frame = currentFrame();
+  VkDescriptorSet ds = m_engine->getCurrentFrame().frame_descriptors.allocate(
+      m_engine->m_device, m_ds_layout);
+  DescriptorWriter writer;
+  writer.writeBuffer(0, frame.lights.buffer,
+                     frame.light_capacity * sizeof(GPULight), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(1, frame.counts.buffer, kClusters * sizeof(uint32_t), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(2, frame.indices.buffer,
+                     kClusters * kMaxLightsPerCluster * sizeof(uint32_t), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.updateDescriptorSet(m_engine->m_device, ds);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_pipeline_layout, 0, 1, &ds, 0, nullptr);
+  LightCullPushConstants push_const;
+  push_const.view = scene_data.view;
+  push_const.projection = glm::vec4(scene_data.proj[0][0],
+                                    scene_data.proj[1][1], near_depth,
+                                    far_depth);
+  push_const.grid = scene_data.light_grid;
+  push_const.n_lights = frame.n_lights;
+  vkCmdPushConstants(cmd, m_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(LightCullPushConstants), &push_const);
+  // One invocation a cluster, see light_cull.comp.
+  vkCmdDispatch(cmd, (kClusters + 127) / 128, 1, 1);
+  vkutil::memoryBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+}
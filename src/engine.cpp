@@ -14,12 +14,16 @@
 #include <backends/imgui_impl_sdl3.h>
 #include <backends/imgui_impl_vulkan.h>
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/transform.hpp>
 
+// Last, it routes vkCmd* calls below through the counters.
+#include "vk_call_stats.h"
+
 constexpr bool bUseValidationLayers = true;
 
 static Engine *loaded_engine = nullptr;
@@ -55,6 +59,29 @@ bool isVisible(const RenderObject &obj, const glm::mat4 &view_proj) {
   }
 }
 
+float ResolutionController::update(float gpu_ms, float scale) {
+  if (gpu_ms <= 0.f)
+    return scale;
+  if (smoothed_ms <= 0.f)
+    smoothed_ms = gpu_ms;
+  smoothed_ms += (gpu_ms - smoothed_ms) * smoothing;
+  if (cooldown > 0) {
+    cooldown--;
+    return scale;
+  }
+  if (smoothed_ms <= budget_ms * upper_ratio &&
+      smoothed_ms >= budget_ms * lower_ratio)
+    return scale;
+  // Pixel count goes with scale^2. Aim at the middle of the band.
+  float target_ms = budget_ms * 0.5f * (upper_ratio + lower_ratio);
+  float new_scale = scale * std::sqrt(target_ms / smoothed_ms);
+  new_scale = std::clamp(new_scale, scale - max_step, scale + max_step);
+  new_scale = std::clamp(new_scale, min_scale, max_scale);
+  if (new_scale != scale)
+    cooldown = kFrameOverlap + 2;
+  return new_scale;
+}
+
 Engine &Engine::get() { return *loaded_engine; }
 void Engine::init() {
   // Only one engine initialization is allowed with the application.
@@ -62,13 +89,23 @@ void Engine::init() {
   loaded_engine = this;
   // We initialize SDL and create a window with it.
   SDL_Init(SDL_INIT_VIDEO);
-  SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
-  // (SDL_WindowFlags)(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+  SDL_WindowFlags window_flags =
+      (SDL_WindowFlags)(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+  if (benchmark_config.enabled && benchmark_config.hidden_window)
+    window_flags |= SDL_WINDOW_HIDDEN;
   window = SDL_CreateWindow("Vulkan Engine", window_extent.width,
                             window_extent.height, window_flags);
 
   initVulkan();
+  initMemoryPools();
   initSwapchain();
+  // This thread runs jobs too while waiting. Background deques for the scene
+  // update job and the scene loader thread.
+  m_jobs.init(std::max(1u, std::thread::hardware_concurrency()) - 1, 2,
+              benchmark_config.pin_threads);
+  // Before the loader registers, so workers steal updates first.
+  m_update_queue = m_jobs.reserveQueue();
+  m_record_threads = static_cast<int>(m_jobs.size());
   initCommands();
   initSyncStructures();
   initDescriptors();
@@ -76,8 +113,17 @@ void Engine::init() {
 
   initImGui();
 
+  m_capture.init(this);
+  m_lighting.init(this);
+  m_texture_streamer.init(this);
+  m_assets.init(this);
+  m_scenes.init(this);
+  updateMemoryBudget(); // Loads check it.
   initDefaultData();
   m_main_camera.init();
+  m_benchmark.init(this, benchmark_config);
+  // First frame to draw.
+  kickSceneUpdate();
   is_initialized = true;
 }
 
@@ -85,16 +131,38 @@ void Engine::cleanup() {
   if (is_initialized) {
     // Order matters, reversed of initialization.
     vkDeviceWaitIdle(m_device); // Wait for GPU to finish.
+    m_jobs.wait(m_update_done); // Update job reads the scenes.
+    m_scenes.destroy();
     m_loaded_scenes.clear();
+    m_assets.destroy();
+    m_texture_streamer.destroy();
+    m_lighting.destroy();
+    m_capture.destroy();
     for (uint32_t i = 0; i < kFrameOverlap; i++) {
       // Cmd buffer is destroyed with pool it comes from.
       vkDestroyCommandPool(m_device, m_frames[i].cmd_pool, nullptr);
-      vkDestroyFence(m_device, m_frames[i].render_fence, nullptr);
+      for (SecondaryCommands &secondary : m_frames[i].secondary_cmds)
+        vkDestroyCommandPool(m_device, secondary.pool, nullptr);
       vkDestroySemaphore(m_device, m_frames[i].render_semaphore, nullptr);
       vkDestroySemaphore(m_device, m_frames[i].swapchain_semaphore, nullptr);
+      if (m_has_async_compute)
+        vkDestroyCommandPool(m_device, m_frames[i].compute_cmd_pool, nullptr);
+      if (m_frames[i].cluster_object_capacity > 0) {
+        destroyBuffer(m_frames[i].cluster_object_buffer);
+        destroyBuffer(m_frames[i].cluster_index_buffer);
+        destroyBuffer(m_frames[i].cluster_draw_buffer);
+        destroyBuffer(m_frames[i].cluster_stats_buffer);
+      }
+      if (m_frames[i].cull_capacity > 0) {
+        destroyBuffer(m_frames[i].cull_object_buffer);
+        destroyBuffer(m_frames[i].draw_cmd_buffer);
+        destroyBuffer(m_frames[i].visibility_buffer);
+        destroyBuffer(m_frames[i].cull_stats_buffer);
+      }
       m_frames[i].deletion_queue.flush();
     }
     m_metal_rough_mat.clearResources(m_device);
+    m_jobs.destroy();
 
     /**
      * @note  Global vma allocator must be deleted last.
@@ -110,16 +178,27 @@ void Engine::cleanup() {
 }
 
 void Engine::draw() {
-  stats.t_scene_update.begin();
-  updateScene();
-  stats.t_scene_update.end();
+  // Next frame updates while this one records.
+  acquireSnapshot();
+  // No update job is reading the scenes in between.
+  m_scenes.update();
+  kickSceneUpdate();
   stats.t_cpu_draw.begin();
-  VK_CHECK(vkWaitForFences(m_device, 1, &getCurrentFrame().render_fence, true,
-                           VK_ONE_SEC));
+  m_graphics_timeline.wait(m_device, getCurrentFrame().render_value);
+  // Readbacks of any finished frame, not only this one.
+  m_capture.poll();
   // Free objects dedicated to this frame (in last iteration).
   getCurrentFrame().deletion_queue.flush();
   getCurrentFrame().frame_descriptors.clearPools(m_device);
-  VK_CHECK(vkResetFences(m_device, 1, &getCurrentFrame().render_fence));
+  for (SecondaryCommands &secondary : getCurrentFrame().secondary_cmds) {
+    VK_CHECK(vkResetCommandPool(m_device, secondary.pool, 0));
+    secondary.n_used = 0;
+  }
+  updateMemoryBudget();
+  // Queries of this frame have finished with its timeline value.
+  readTimestamps();
+  readCullStats();
+  readClusterStats();
 
   // Request an image to draw to.
   uint32_t swapchain_img_idx;
@@ -132,13 +211,9 @@ void Engine::draw() {
     stats.t_cpu_draw.end();
     return;
   }
-
-  // Clear the cmd buffer.
-  VkCommandBuffer cmd = getCurrentFrame().cmd_buffer_main;
-  VK_CHECK(vkResetCommandBuffer(cmd, 0));
-  // Record cmd. Bit is to tell vulkan buffer is used exactly once.
-  VkCommandBufferBeginInfo cmd_begin_info =
-      vkinit::cmdBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  if (m_resolution_controller.enabled)
+    m_render_scale =
+        m_resolution_controller.update(stats.gpu_frame_ms, m_render_scale);
 
   m_draw_extent.width =
       std::min(m_color_image.extent.width, m_swapchain_extent.width) *
@@ -147,39 +222,113 @@ void Engine::draw() {
       std::min(m_color_image.extent.height, m_swapchain_extent.height) *
       m_render_scale;
 
+  // Counted from here, async compute recording included.
+  vkstats::beginFrame();
+  // Background goes first, so it may overlap with previous frame on GPU.
+  bool async_compute = m_has_async_compute && m_use_async_compute;
+  if (async_compute)
+    submitAsyncCompute();
+
+  // Clear the cmd buffer.
+  VkCommandBuffer cmd = getCurrentFrame().cmd_buffer_main;
+  VK_CHECK(vkResetCommandBuffer(cmd, 0));
+  // Record cmd. Bit is to tell vulkan buffer is used exactly once.
+  VkCommandBufferBeginInfo cmd_begin_info =
+      vkinit::cmdBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
   VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
-  vkCmdResetQueryPool(cmd, m_query_pool_timestamp, 0,
+  VkQueryPool query_pool = getCurrentFrame().query_pool_timestamp;
+  vkCmdResetQueryPool(cmd, query_pool, 0,
                       static_cast<uint32_t>(m_timestamps.size()));
+  // Before recording, as it may replace material sets.
+  m_texture_streamer.update(
+      cmd, m_main_draw_context, m_visible_opaque,
+      0.5f * m_draw_extent.height * std::abs(m_scene_data.proj[1][1]));
   { // Drawing commands.
-    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                        m_query_pool_timestamp, 0);
-    vkutil::transitionImage(cmd, m_color_image.image, VK_IMAGE_LAYOUT_UNDEFINED,
-                            VK_IMAGE_LAYOUT_GENERAL);
-    drawBackground(cmd);
-    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                        m_query_pool_timestamp, 1);
-
-    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                        m_query_pool_timestamp, 2);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+    if (async_compute) {
+      // Acquire the background from compute queue and copy it.
+      AllocatedImage &background = getCurrentFrame().background_image;
+      vkutil::transferImageOwnership(
+          cmd, background.image, VK_IMAGE_LAYOUT_GENERAL,
+          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_compute_queue_family,
+          m_graphic_queue_family);
+      vkutil::transitionImage(cmd, m_color_image.image,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+      vkutil::copyImage(cmd, background.image, m_color_image.image,
+                        m_draw_extent, m_draw_extent);
+      vkutil::transitionImage(cmd, m_color_image.image,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              VK_IMAGE_LAYOUT_GENERAL);
+    } else {
+      vkutil::transitionImage(cmd, m_color_image.image,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_GENERAL);
+      drawBackground(cmd, m_draw_image_ds);
+    }
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool,
+                        1);
+
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 2);
     vkutil::transitionImage(cmd, m_color_image.image, VK_IMAGE_LAYOUT_GENERAL,
                             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
     vkutil::transitionImage(cmd, m_depth_image.image, VK_IMAGE_LAYOUT_UNDEFINED,
                             VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    stats.t_record.begin();
     drawGeometry(cmd);
-    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                        m_query_pool_timestamp, 3);
+    stats.t_record.end();
+    stepRecordBenchmark();
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool,
+                        3);
     // Copy to swapchain.
-    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                        m_query_pool_timestamp, 4);
-    vkutil::transitionImage(cmd, m_color_image.image,
-                            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 4);
     vkutil::transitionImage(cmd, m_swapchain_imgs[swapchain_img_idx],
                             VK_IMAGE_LAYOUT_UNDEFINED,
                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    vkutil::copyImage(cmd, m_color_image.image,
-                      m_swapchain_imgs[swapchain_img_idx], m_draw_extent,
-                      m_swapchain_extent);
+    bool upscale = m_use_upscaler &&
+                   (m_draw_extent.width != m_swapchain_extent.width ||
+                    m_draw_extent.height != m_swapchain_extent.height);
+    // Source of the swapchain copy, left in TRANSFER_SRC_OPTIMAL.
+    AllocatedImage *final_image = &m_color_image;
+    VkExtent2D final_extent = m_draw_extent;
+    if (upscale) {
+      // Upscaled image has the swapchain size, plain copy with no filtering.
+      VkExtent2D upscale_extent{
+          std::min(m_upscale_image.extent.width, m_swapchain_extent.width),
+          std::min(m_upscale_image.extent.height, m_swapchain_extent.height)};
+      final_image = &m_upscale_image;
+      final_extent = upscale_extent;
+      vkutil::transitionImage(cmd, m_color_image.image,
+                              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                              VK_IMAGE_LAYOUT_GENERAL);
+      vkutil::transitionImage(cmd, m_upscale_image.image,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_GENERAL);
+      drawUpscale(cmd, upscale_extent);
+      vkutil::transitionImage(cmd, m_upscale_image.image,
+                              VK_IMAGE_LAYOUT_GENERAL,
+                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+      vkutil::copyImage(cmd, m_upscale_image.image,
+                        m_swapchain_imgs[swapchain_img_idx], upscale_extent,
+                        m_swapchain_extent);
+    } else {
+      vkutil::transitionImage(cmd, m_color_image.image,
+                              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+      vkutil::copyImage(cmd, m_color_image.image,
+                        m_swapchain_imgs[swapchain_img_idx], m_draw_extent,
+                        m_swapchain_extent);
+    }
+    // Scaled as the copy, so captured frames keep the swapchain size
+    // whatever the render scale. No GUI on them.
+    if (m_capture.capturing()) {
+      vkutil::transitionImage(cmd, final_image->image,
+                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                              VK_IMAGE_LAYOUT_GENERAL);
+      vkstats::PassScope pass_scope(vkstats::Pass::Capture);
+      m_capture.record(cmd, *final_image, final_extent, m_swapchain_extent);
+    }
     vkutil::transitionImage(cmd, m_swapchain_imgs[swapchain_img_idx],
                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
@@ -188,22 +337,38 @@ void Engine::draw() {
     vkutil::transitionImage(cmd, m_swapchain_imgs[swapchain_img_idx],
                             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
                             VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                        m_query_pool_timestamp, 5);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool,
+                        5);
   }
   VK_CHECK(vkEndCommandBuffer(cmd));
+  vkstats::endFrame();
 
   // Submit commands.
   VkCommandBufferSubmitInfo cmd_submit_info = vkinit::cmdBufferSubmitInfo(cmd);
-  VkSemaphoreSubmitInfo wait_info = vkinit::semaphoreSubmitInfo(
-      VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
-      getCurrentFrame().swapchain_semaphore);
-  VkSemaphoreSubmitInfo signal_info = vkinit::semaphoreSubmitInfo(
-      VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, getCurrentFrame().render_semaphore);
+  VkSemaphoreSubmitInfo wait_infos[2] = {
+      vkinit::semaphoreSubmitInfo(
+          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+          getCurrentFrame().swapchain_semaphore),
+      vkinit::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                  m_compute_timeline.semaphore,
+                                  getCurrentFrame().compute_value),
+  };
+  // Binary one for present, timeline one for the CPU.
+  getCurrentFrame().render_value = m_graphics_timeline.next();
+  VkSemaphoreSubmitInfo signal_infos[2] = {
+      vkinit::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
+                                  getCurrentFrame().render_semaphore),
+      vkinit::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                                  m_graphics_timeline.semaphore,
+                                  getCurrentFrame().render_value),
+  };
   VkSubmitInfo2 submit_info =
-      vkinit::submitInfo(&cmd_submit_info, &signal_info, &wait_info);
-  VK_CHECK(vkQueueSubmit2(m_graphic_queue, 1, &submit_info,
-                          getCurrentFrame().render_fence));
+      vkinit::submitInfo(&cmd_submit_info, signal_infos, wait_infos);
+  submit_info.waitSemaphoreInfoCount = async_compute ? 2 : 1;
+  submit_info.signalSemaphoreInfoCount = 2;
+  VK_CHECK(vkQueueSubmit2(m_graphic_queue, 1, &submit_info, VK_NULL_HANDLE));
+  getCurrentFrame().timestamp_written = true;
+  m_capture.submitted(getCurrentFrame().render_value);
 
   // Present image.
   VkPresentInfoKHR present_info = vkinit::presentInfo();
@@ -222,17 +387,77 @@ void Engine::draw() {
 
   frame_number++;
   stats.t_cpu_draw.end();
-  vkGetQueryPoolResults(m_device, m_query_pool_timestamp, 0,
-                        static_cast<uint32_t>(m_timestamps.size()),
-                        m_timestamps.size() * sizeof(uint64_t),
-                        m_timestamps.data(), sizeof(uint64_t),
-                        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
 }
-void Engine::drawBackground(VkCommandBuffer cmd) {
+void Engine::submitAsyncCompute() {
+  FrameData &frame = getCurrentFrame();
+  VkCommandBuffer cmd = frame.cmd_buffer_compute;
+  VK_CHECK(vkResetCommandBuffer(cmd, 0));
+  VkCommandBufferBeginInfo cmd_begin_info =
+      vkinit::cmdBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
+  vkCmdResetQueryPool(cmd, frame.query_pool_compute, 0,
+                      static_cast<uint32_t>(m_compute_timestamps.size()));
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      frame.query_pool_compute, 0);
+  // Content of last use is discarded, no need to acquire from graphics queue.
+  vkutil::transitionImage(cmd, frame.background_image.image,
+                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+  drawBackground(cmd, frame.background_ds);
+  // Release to graphics queue, which does the same barrier to acquire.
+  vkutil::transferImageOwnership(
+      cmd, frame.background_image.image, VK_IMAGE_LAYOUT_GENERAL,
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_compute_queue_family,
+      m_graphic_queue_family);
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      frame.query_pool_compute, 1);
+  VK_CHECK(vkEndCommandBuffer(cmd));
+
+  VkCommandBufferSubmitInfo cmd_submit_info = vkinit::cmdBufferSubmitInfo(cmd);
+  frame.compute_value = m_compute_timeline.next();
+  // All commands, so the release above is surely in the signal's scope.
+  VkSemaphoreSubmitInfo signal_info = vkinit::semaphoreSubmitInfo(
+      VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_compute_timeline.semaphore,
+      frame.compute_value);
+  VkSubmitInfo2 submit_info =
+      vkinit::submitInfo(&cmd_submit_info, &signal_info, nullptr);
+  // Nothing to wait, render_value of the frame was reached so the image is
+  // free.
+  VK_CHECK(vkQueueSubmit2(m_compute_queue, 1, &submit_info, VK_NULL_HANDLE));
+  frame.compute_timestamp_written = true;
+}
+void Engine::readTimestamps() {
+  FrameData &frame = getCurrentFrame();
+  // No wait bit, queries are already done once the frame value is reached.
+  if (frame.timestamp_written) {
+    std::vector<uint64_t> timestamps(m_timestamps.size());
+    VkResult e = vkGetQueryPoolResults(
+        m_device, frame.query_pool_timestamp, 0,
+        static_cast<uint32_t>(timestamps.size()),
+        timestamps.size() * sizeof(uint64_t), timestamps.data(),
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (e == VK_SUCCESS) {
+      m_prev_timestamps = m_timestamps;
+      m_timestamps = timestamps;
+      stats.gpu_frame_ms =
+          static_cast<float>(m_timestamps[5] - m_timestamps[0]) *
+          m_timestamp_period / 1000000.f;
+    }
+  }
+  if (frame.compute_timestamp_written) {
+    frame.compute_timestamp_written = false;
+    vkGetQueryPoolResults(m_device, frame.query_pool_compute, 0,
+                          static_cast<uint32_t>(m_compute_timestamps.size()),
+                          m_compute_timestamps.size() * sizeof(uint64_t),
+                          m_compute_timestamps.data(), sizeof(uint64_t),
+                          VK_QUERY_RESULT_64_BIT);
+  }
+}
+void Engine::drawBackground(VkCommandBuffer cmd, VkDescriptorSet target_ds) {
+  vkstats::PassScope pass_scope(vkstats::Pass::Background);
   auto &background = m_compute_pipelines[m_cur_comp_pipeline_idx];
   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, background.pipeline);
   vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
-                          m_compute_pipeline_layout, 0, 1, &m_draw_image_ds, 0,
+                          m_compute_pipeline_layout, 0, 1, &target_ds, 0,
                           nullptr);
   vkCmdPushConstants(cmd, m_compute_pipeline_layout,
                      VK_SHADER_STAGE_COMPUTE_BIT, 0,
@@ -240,118 +465,651 @@ void Engine::drawBackground(VkCommandBuffer cmd) {
   vkCmdDispatch(cmd, std::ceil(m_draw_extent.width / 16.f),
                 std::ceil(m_draw_extent.height / 16.f), 1);
 }
+void Engine::drawUpscale(VkCommandBuffer cmd, VkExtent2D output_extent) {
+  vkstats::PassScope pass_scope(vkstats::Pass::Upscale);
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_upscale_pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_upscale_pipeline_layout, 0, 1, &m_upscale_ds, 0,
+                          nullptr);
+  UpscalePushConstants push_const;
+  push_const.sizes = glm::vec4{m_draw_extent.width, m_draw_extent.height,
+                               output_extent.width, output_extent.height};
+  push_const.params = glm::vec4{m_upscale_sharpness, 0.f, 0.f, 0.f};
+  vkCmdPushConstants(cmd, m_upscale_pipeline_layout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(UpscalePushConstants), &push_const);
+  vkCmdDispatch(cmd, std::ceil(output_extent.width / 16.f),
+                std::ceil(output_extent.height / 16.f), 1);
+}
+uint32_t Engine::cullClusters(VkCommandBuffer cmd,
+                              std::span<size_t> opaque_index,
+                              std::span<uint32_t> cluster_draw) {
+  vkstats::PassScope pass_scope(vkstats::Pass::Culling);
+  FrameData &frame = getCurrentFrame();
+  uint32_t n_clustered = 0;
+  uint32_t n_indices = 0;
+  for (size_t i = 0; i < opaque_index.size(); i++) {
+    const RenderObject &r =
+        m_main_draw_context.opaque_surfaces[opaque_index[i]];
+    if (r.n_meshlets == 0)
+      continue;
+    cluster_draw[i] = n_clustered++;
+    n_indices += r.n_index;
+  }
+  if (n_clustered == 0)
+    return 0;
+  // Slot is idle after the frame value, safe to recreate.
+  if (n_clustered > frame.cluster_object_capacity ||
+      n_indices > frame.cluster_index_capacity) {
+    if (frame.cluster_object_capacity > 0) {
+      destroyBuffer(frame.cluster_object_buffer);
+      destroyBuffer(frame.cluster_index_buffer);
+      destroyBuffer(frame.cluster_draw_buffer);
+      destroyBuffer(frame.cluster_stats_buffer);
+    }
+    frame.cluster_object_capacity =
+        std::max({n_clustered, frame.cluster_object_capacity * 3 / 2, 64u});
+    frame.cluster_index_capacity =
+        std::max({n_indices, frame.cluster_index_capacity * 3 / 2, 65536u});
+    frame.cluster_object_buffer =
+        createBuffer(frame.cluster_object_capacity * sizeof(ClusterObject),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VMA_MEMORY_USAGE_CPU_TO_GPU);
+    frame.cluster_index_buffer =
+        createBuffer(frame.cluster_index_capacity * sizeof(uint32_t),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                     VMA_MEMORY_USAGE_GPU_ONLY);
+    frame.cluster_draw_buffer = createBuffer(
+        frame.cluster_object_capacity * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    frame.cluster_stats_buffer =
+        createBuffer(sizeof(ClusterStats),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VMA_MEMORY_USAGE_GPU_TO_CPU);
+    frame.cluster_stats_written = false;
+  }
+
+  ClusterObject *objects =
+      (ClusterObject *)frame.cluster_object_buffer.allocation->GetMappedData();
+  // Each object may keep all of its indices.
+  uint32_t output_offset = 0;
+  for (size_t i = 0; i < opaque_index.size(); i++) {
+    if (cluster_draw[i] == UINT32_MAX)
+      continue;
+    const RenderObject &r =
+        m_main_draw_context.opaque_surfaces[opaque_index[i]];
+    ClusterObject &obj = objects[cluster_draw[i]];
+    obj.transform = r.transform;
+    obj.meshlet_buffer = r.meshlet_buffer_address;
+    obj.index_buffer = r.index_buffer_address;
+    obj.first_meshlet = r.first_meshlet;
+    obj.meshlet_count = r.n_meshlets;
+    obj.output_offset = output_offset;
+    obj.vertex_offset = r.vertex_offset;
+    obj.index_16bit = r.index_type == VK_INDEX_TYPE_UINT16;
+    output_offset += r.n_index;
+  }
+
+  VkDescriptorSet cluster_ds =
+      frame.frame_descriptors.allocate(m_device, m_cluster_ds_layout);
+  DescriptorWriter writer;
+  writer.writeBuffer(0, frame.cluster_object_buffer.buffer,
+                     frame.cluster_object_capacity * sizeof(ClusterObject), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(1, frame.cluster_index_buffer.buffer,
+                     frame.cluster_index_capacity * sizeof(uint32_t), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(
+      2, frame.cluster_draw_buffer.buffer,
+      frame.cluster_object_capacity * sizeof(VkDrawIndexedIndirectCommand), 0,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(3, frame.cluster_stats_buffer.buffer,
+                     sizeof(ClusterStats), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.updateDescriptorSet(m_device, cluster_ds);
+
+  vkCmdFillBuffer(cmd, frame.cluster_stats_buffer.buffer, 0,
+                  sizeof(ClusterStats), 0);
+  frame.cluster_stats_written = true;
+  vkutil::memoryBarrier(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                        VK_ACCESS_2_MEMORY_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_READ_BIT |
+                            VK_ACCESS_2_SHADER_WRITE_BIT);
+
+  ClusterPushConstants push_const;
+  push_const.view_proj = m_scene_data.view_proj;
+  push_const.camera = glm::vec4(m_main_draw_context.camera_position, 1.f);
+  push_const.n_objects = n_clustered;
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cluster_pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_cluster_pipeline_layout, 0, 1, &cluster_ds, 0,
+                          nullptr);
+  vkCmdPushConstants(cmd, m_cluster_pipeline_layout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(ClusterPushConstants), &push_const);
+  // One workgroup per object.
+  vkCmdDispatch(cmd, n_clustered, 1, 1);
+
+  vkutil::memoryBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                            VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT |
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT |
+                            VK_ACCESS_2_INDEX_READ_BIT |
+                            VK_ACCESS_2_SHADER_READ_BIT);
+  return n_clustered;
+}
+void Engine::readClusterStats() {
+  FrameData &frame = getCurrentFrame();
+  if (!frame.cluster_stats_written)
+    return;
+  vmaInvalidateAllocation(m_allocator, frame.cluster_stats_buffer.allocation,
+                          0, VK_WHOLE_SIZE);
+  m_cluster_stats =
+      *(ClusterStats *)frame.cluster_stats_buffer.allocation->GetMappedData();
+  stats.n_clusters_tested = m_cluster_stats.n_tested;
+  stats.n_clusters_culled = m_cluster_stats.n_culled;
+}
+VkDescriptorSet Engine::prepareCulling(std::span<size_t> opaque_index,
+                                       std::span<uint32_t> cluster_draw) {
+  FrameData &frame = getCurrentFrame();
+  uint32_t n_objects = static_cast<uint32_t>(opaque_index.size());
+  // Slot is idle after the frame value, safe to recreate.
+  if (n_objects > frame.cull_capacity) {
+    if (frame.cull_capacity > 0) {
+      destroyBuffer(frame.cull_object_buffer);
+      destroyBuffer(frame.draw_cmd_buffer);
+      destroyBuffer(frame.visibility_buffer);
+      destroyBuffer(frame.cull_stats_buffer);
+    }
+    frame.cull_capacity = std::max(n_objects, frame.cull_capacity * 3 / 2);
+    frame.cull_capacity = std::max(frame.cull_capacity, 64u);
+    frame.cull_object_buffer =
+        createBuffer(frame.cull_capacity * sizeof(CullObject),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VMA_MEMORY_USAGE_CPU_TO_GPU);
+    // Three regions, see occlusion_cull.comp.
+    frame.draw_cmd_buffer = createBuffer(
+        3 * frame.cull_capacity * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    frame.visibility_buffer = createBuffer(
+        frame.cull_capacity * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    frame.cull_stats_buffer =
+        createBuffer(sizeof(CullStats),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VMA_MEMORY_USAGE_GPU_TO_CPU);
+    frame.cull_stats_written = false;
+  }
+
+  CullObject *objects =
+      (CullObject *)frame.cull_object_buffer.allocation->GetMappedData();
+  for (uint32_t i = 0; i < n_objects; i++) {
+    const RenderObject &r =
+        m_main_draw_context.opaque_surfaces[opaque_index[i]];
+    // Conservative world bound, scaled by the longest axis.
+    float scale = std::max({glm::length(glm::vec3(r.transform[0])),
+                            glm::length(glm::vec3(r.transform[1])),
+                            glm::length(glm::vec3(r.transform[2]))});
+    glm::vec4 center = r.transform * glm::vec4(r.bound.origin, 1.f);
+    objects[i].sphere = glm::vec4(glm::vec3(center), r.bound.radius * scale);
+    objects[i].index_count = r.n_index;
+    objects[i].first_index = r.first_index;
+    objects[i].vertex_offset = r.vertex_offset;
+    objects[i].cluster_draw = cluster_draw[i];
+  }
+
+  VkDescriptorSet cull_ds =
+      frame.frame_descriptors.allocate(m_device, m_cull_ds_layout);
+  DescriptorWriter writer;
+  writer.writeBuffer(0, frame.cull_object_buffer.buffer,
+                     frame.cull_capacity * sizeof(CullObject), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(
+      1, frame.draw_cmd_buffer.buffer,
+      3 * frame.cull_capacity * sizeof(VkDrawIndexedIndirectCommand), 0,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(2, frame.visibility_buffer.buffer,
+                     frame.cull_capacity * sizeof(uint32_t), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeBuffer(3, frame.cull_stats_buffer.buffer, sizeof(CullStats), 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.writeImage(4, m_depth_pyramid.view, m_depth_sampler,
+                    VK_IMAGE_LAYOUT_GENERAL,
+                    VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+  // Never read without clusters, any valid buffer does.
+  if (frame.cluster_object_capacity > 0)
+    writer.writeBuffer(
+        5, frame.cluster_draw_buffer.buffer,
+        frame.cluster_object_capacity * sizeof(VkDrawIndexedIndirectCommand),
+        0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  else
+    writer.writeBuffer(5, frame.cull_stats_buffer.buffer, sizeof(CullStats),
+                       0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.updateDescriptorSet(m_device, cull_ds);
+  return cull_ds;
+}
+void Engine::cullOcclusion(VkCommandBuffer cmd, VkDescriptorSet cull_ds,
+                           uint32_t n_objects, uint32_t phase) {
+  vkstats::PassScope pass_scope(vkstats::Pass::Culling);
+  if (phase == 0) {
+    FrameData &frame = getCurrentFrame();
+    vkCmdFillBuffer(cmd, frame.cull_stats_buffer.buffer, 0, sizeof(CullStats),
+                    0);
+    frame.cull_stats_written = true;
+    // Nothing to test against yet, farthest depth lets everything pass.
+    if (!m_depth_pyramid_valid) {
+      vkutil::transitionImage(cmd, m_depth_pyramid.image,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_GENERAL);
+      VkClearColorValue far_depth = {{1.f, 1.f, 1.f, 1.f}};
+      VkImageSubresourceRange range =
+          vkinit::imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+      vkCmdClearColorImage(cmd, m_depth_pyramid.image, VK_IMAGE_LAYOUT_GENERAL,
+                           &far_depth, 1, &range);
+    }
+  }
+  // Clears, visibility of phase 0 and pyramid writes.
+  vkutil::memoryBarrier(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                        VK_ACCESS_2_MEMORY_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_READ_BIT |
+                            VK_ACCESS_2_SHADER_WRITE_BIT);
+
+  const glm::mat4 &proj = m_scene_data.proj;
+  CullPushConstants push_const;
+  push_const.view = m_scene_data.view;
+  push_const.proj = glm::vec4(proj[0][0], proj[1][1], proj[2][2], proj[3][2]);
+  // Near plane recovered from the projection.
+  push_const.pyramid = glm::vec4(m_depth_pyramid_extent.width,
+                                 m_depth_pyramid_extent.height,
+                                 m_depth_pyramid_levels,
+                                 proj[3][2] / proj[2][2]);
+  push_const.n_objects = n_objects;
+  push_const.phase = phase;
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cull_pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_cull_pipeline_layout, 0, 1, &cull_ds, 0, nullptr);
+  vkCmdPushConstants(cmd, m_cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                     0, sizeof(CullPushConstants), &push_const);
+  vkCmdDispatch(cmd, std::ceil(n_objects / 64.f), 1, 1);
+
+  vkutil::memoryBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT |
+                            VK_ACCESS_2_SHADER_READ_BIT);
+}
+void Engine::buildDepthPyramid(VkCommandBuffer cmd) {
+  vkstats::PassScope pass_scope(vkstats::Pass::DepthPyramid);
+  vkutil::transitionImage(cmd, m_depth_image.image,
+                          VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                          VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    m_depth_pyramid_pipeline);
+  VkExtent2D src_extent = m_draw_extent;
+  for (uint32_t level = 0; level < m_depth_pyramid_levels; level++) {
+    VkExtent2D dst_extent = {
+        std::max(1u, m_depth_pyramid_extent.width >> level),
+        std::max(1u, m_depth_pyramid_extent.height >> level)};
+    VkDescriptorSet ds = getCurrentFrame().frame_descriptors.allocate(
+        m_device, m_depth_pyramid_ds_layout);
+    DescriptorWriter writer;
+    if (level == 0)
+      writer.writeImage(0, m_depth_image.view, m_depth_sampler,
+                        VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    else
+      writer.writeImage(0, m_depth_pyramid_mips[level - 1], m_depth_sampler,
+                        VK_IMAGE_LAYOUT_GENERAL,
+                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.writeImage(1, m_depth_pyramid_mips[level], VK_NULL_HANDLE,
+                      VK_IMAGE_LAYOUT_GENERAL,
+                      VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    writer.updateDescriptorSet(m_device, ds);
+
+    DepthPyramidPushConstants push_const;
+    push_const.sizes = glm::vec4(src_extent.width, src_extent.height,
+                                 dst_extent.width, dst_extent.height);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_depth_pyramid_pipeline_layout, 0, 1, &ds, 0,
+                            nullptr);
+    vkCmdPushConstants(cmd, m_depth_pyramid_pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(DepthPyramidPushConstants), &push_const);
+    vkCmdDispatch(cmd, std::ceil(dst_extent.width / 16.f),
+                  std::ceil(dst_extent.height / 16.f), 1);
+    vkutil::memoryBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                          VK_ACCESS_2_SHADER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                          VK_ACCESS_2_SHADER_READ_BIT);
+    src_extent = dst_extent;
+  }
+  vkutil::transitionImage(cmd, m_depth_image.image,
+                          VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+                          VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+  m_depth_pyramid_valid = true;
+}
+void Engine::readCullStats() {
+  FrameData &frame = getCurrentFrame();
+  if (!frame.cull_stats_written)
+    return;
+  vmaInvalidateAllocation(m_allocator, frame.cull_stats_buffer.allocation, 0,
+                          VK_WHOLE_SIZE);
+  m_cull_stats =
+      *(CullStats *)frame.cull_stats_buffer.allocation->GetMappedData();
+  stats.n_occlusion_visible =
+      m_cull_stats.n_visible_phase0 + m_cull_stats.n_visible_phase1;
+  stats.n_occlusion_culled = m_cull_stats.n_culled;
+}
 void Engine::drawGeometry(VkCommandBuffer cmd) {
+  bool occlusion = m_use_occlusion_culling;
+  bool prepass = m_use_depth_prepass;
+  // Culled draws are counted on GPU, a few frames late.
   stats.n_triangles = 0;
+  if (occlusion)
+    stats.n_triangles = m_cull_stats.n_triangles;
+  else if (m_use_cluster_culling)
+    stats.n_triangles = m_cluster_stats.n_triangles;
   stats.n_drawcalls = 0;
-  std::vector<size_t> opaque_index;
-  opaque_index.reserve(m_main_draw_context.opaque_surfaces.size());
-  // Visibility culling.
-  for (size_t i = 0; i < m_main_draw_context.opaque_surfaces.size(); i++) {
-    if (isVisible(m_main_draw_context.opaque_surfaces[i],
-                  m_scene_data.view_proj))
-      opaque_index.push_back(i);
+  // Frustum culled in the update stage.
+  std::vector<size_t> &opaque_index = m_visible_opaque;
+  uint32_t n_objects = static_cast<uint32_t>(opaque_index.size());
+
+  AllocatedBuffer gpu_scene_data_buffer =
+      createBuffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                   VMA_MEMORY_USAGE_CPU_TO_GPU);
+  getCurrentFrame().deletion_queue.push(
+      [=, this]() { destroyBuffer(gpu_scene_data_buffer); });
+  bool lit = m_use_clustered_lighting;
+  if (lit)
+    m_lighting.prepare(m_scene_data, m_draw_extent);
+  GPUSceneData *scene_uniform_data =
+      (GPUSceneData *)gpu_scene_data_buffer.allocation->GetMappedData();
+  *scene_uniform_data = m_scene_data;
+  VkDescriptorSet frame_ds = getCurrentFrame().frame_descriptors.allocate(
+      m_device, m_GPU_scene_data_ds_layout);
+  {
+    DescriptorWriter writer;
+    writer.writeBuffer(0, gpu_scene_data_buffer.buffer, sizeof(GPUSceneData),
+                       0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    m_lighting.writeFrameSet(writer);
+    writer.updateDescriptorSet(m_device, frame_ds);
+  }
+
+  // Meshlets first, their compacted indices feed all draws below.
+  std::vector<uint32_t> cluster_draw(n_objects, UINT32_MAX);
+  if (m_use_cluster_culling && n_objects > 0)
+    cullClusters(cmd, opaque_index, cluster_draw);
+  if (lit) {
+    vkstats::PassScope pass_scope(vkstats::Pass::Lighting);
+    m_lighting.record(cmd, m_scene_data);
+  }
+  VkBuffer cluster_index_buffer =
+      getCurrentFrame().cluster_index_buffer.buffer;
+  VkBuffer cluster_draw_buffer = getCurrentFrame().cluster_draw_buffer.buffer;
+
+  // Phase 0 keeps what was visible in last frame's pyramid.
+  VkDescriptorSet cull_ds = VK_NULL_HANDLE;
+  if (occlusion && n_objects > 0) {
+    cull_ds = prepareCulling(opaque_index, cluster_draw);
+    cullOcclusion(cmd, cull_ds, n_objects, 0);
+  } else {
+    occlusion = false;
+    // Camera may have moved a lot meanwhile.
+    m_depth_pyramid_valid = false;
+  }
+  VkBuffer draw_cmd_buffer = getCurrentFrame().draw_cmd_buffer.buffer;
+
+  // Region of indirect commands, see occlusion_cull.comp.
+  auto opaqueDraws = [&](uint32_t region) {
+    std::vector<DrawItem> items(n_objects);
+    for (uint32_t i = 0; i < n_objects; i++) {
+      const RenderObject &r =
+          m_main_draw_context.opaque_surfaces[opaque_index[i]];
+      bool clustered = cluster_draw[i] != UINT32_MAX;
+      DrawItem &item = items[i];
+      item.object = &r;
+      // Compacted cluster indices are always 32-bit.
+      item.index_buffer = clustered ? cluster_index_buffer : r.index_buffer;
+      item.index_type = clustered ? VK_INDEX_TYPE_UINT32 : r.index_type;
+      item.indirect_buffer = VK_NULL_HANDLE;
+      item.draw_idx = 0;
+      if (occlusion) {
+        item.indirect_buffer = draw_cmd_buffer;
+        item.draw_idx = region * n_objects + i;
+      } else if (clustered) {
+        item.indirect_buffer = cluster_draw_buffer;
+        item.draw_idx = cluster_draw[i];
+      }
+    }
+    return items;
+  };
+  std::vector<DrawItem> transparent_draws;
+  for (const RenderObject &r : m_main_draw_context.transparent_surfaces)
+    transparent_draws.push_back(
+        {&r, r.index_buffer, r.index_type, VK_NULL_HANDLE, 0});
+  auto withTransparent = [&](std::vector<DrawItem> items) {
+    items.insert(items.end(), transparent_draws.begin(),
+                 transparent_draws.end());
+    return items;
+  };
+
+  if (occlusion) {
+    // Phase 0, then pyramid of this frame to catch disoccluded objects.
+    recordPass(cmd, opaqueDraws(0), frame_ds, prepass, true, prepass);
+    buildDepthPyramid(cmd);
+    cullOcclusion(cmd, cull_ds, n_objects, 1);
+    if (prepass) {
+      recordPass(cmd, opaqueDraws(1), frame_ds, true, false, prepass);
+      recordPass(cmd, withTransparent(opaqueDraws(2)), frame_ds, false, false,
+                 prepass);
+    } else {
+      recordPass(cmd, withTransparent(opaqueDraws(1)), frame_ds, false, false,
+                 prepass);
+    }
+  } else {
+    if (prepass)
+      recordPass(cmd, opaqueDraws(0), frame_ds, true, true, prepass);
+    recordPass(cmd, withTransparent(opaqueDraws(0)), frame_ds, false,
+               !prepass, prepass);
+  }
+}
+void Engine::recordPass(VkCommandBuffer cmd, std::span<const DrawItem> items,
+                        VkDescriptorSet frame_ds, bool depth_only,
+                        bool clear_depth, bool prepassed) {
+  vkstats::PassScope pass_scope(depth_only ? vkstats::Pass::DepthPrepass
+                                          : vkstats::Pass::Geometry);
+  VkRenderingAttachmentInfo color_attach = vkinit::attachmentInfo(
+      m_color_image.view, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+  VkRenderingAttachmentInfo depth_attach = vkinit::depthAttachmentInfo(
+      m_depth_image.view, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+  if (!clear_depth)
+    depth_attach.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  VkRenderingInfo i_render = vkinit::renderingInfo(
+      m_draw_extent, depth_only ? nullptr : &color_attach, &depth_attach);
+  uint32_t n_chunks = static_cast<uint32_t>(
+      std::min<size_t>(m_record_threads, items.size() / kMinDrawsPerThread));
+  stats.n_drawcalls += static_cast<int>(items.size());
+  if (n_chunks <= 1) {
+    vkCmdBeginRendering(cmd, &i_render);
+    stats.n_triangles +=
+        recordDraws(cmd, items, frame_ds, depth_only, prepassed);
+    vkCmdEndRendering(cmd);
+    return;
   }
+
+  // Secondaries continue the rendering scope begun here.
+  i_render.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+  vkCmdBeginRendering(cmd, &i_render);
+  FrameData &frame = getCurrentFrame();
+  VkCommandBufferInheritanceRenderingInfo i_inherit_rendering{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+      .colorAttachmentCount = depth_only ? 0u : 1u,
+      .pColorAttachmentFormats = &m_color_image.format,
+      .depthAttachmentFormat = m_depth_image.format,
+      .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+  };
+  VkCommandBufferInheritanceInfo i_inherit{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+      .pNext = &i_inherit_rendering,
+  };
+  std::vector<VkCommandBuffer> secondaries(n_chunks);
+  std::vector<uint32_t> n_triangles(n_chunks, 0);
+  // Chunk i always goes to pool i, so no pool is shared between threads.
+  auto recordChunk = [&](size_t chunk) {
+    VkCommandBuffer secondary =
+        acquireSecondary(frame.secondary_cmds[chunk]);
+    VkCommandBufferBeginInfo i_begin = vkinit::cmdBufferBeginInfo(
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+        VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+    i_begin.pInheritanceInfo = &i_inherit;
+    VK_CHECK(vkBeginCommandBuffer(secondary, &i_begin));
+    size_t first = items.size() * chunk / n_chunks;
+    size_t last = items.size() * (chunk + 1) / n_chunks;
+    n_triangles[chunk] =
+        recordDraws(secondary, items.subspan(first, last - first), frame_ds,
+                    depth_only, prepassed);
+    VK_CHECK(vkEndCommandBuffer(secondary));
+    secondaries[chunk] = secondary;
+  };
+  m_jobs.parallelFor("record draws", n_chunks, 1,
+                     [&](size_t begin, size_t end) {
+                       for (size_t chunk = begin; chunk < end; chunk++)
+                         recordChunk(chunk);
+                     });
+  // Executed in order, so transparent draws keep their order.
+  vkCmdExecuteCommands(cmd, n_chunks, secondaries.data());
+  vkCmdEndRendering(cmd);
+  for (uint32_t n : n_triangles)
+    stats.n_triangles += n;
+}
+uint32_t Engine::recordDraws(VkCommandBuffer cmd,
+                             std::span<const DrawItem> items,
+                             VkDescriptorSet frame_ds, bool depth_only,
+                             bool prepassed) {
   // Should reduce rebinding?
   MaterialPipeline *last_pipeline = nullptr;
   MaterialInstance *last_material = nullptr;
   VkBuffer last_index_buffer = VK_NULL_HANDLE;
-  auto drawObjet = [&](const RenderObject &r, VkDescriptorSet &frame_ds) {
-    if (r.material != last_material) {
-      last_material = r.material;
-      if (r.material->p_pipeline != last_pipeline) {
-        last_pipeline = r.material->p_pipeline;
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          r.material->p_pipeline->pipeline);
+  VkIndexType last_index_type = VK_INDEX_TYPE_UINT32;
+  uint32_t n_triangles = 0;
+  auto setViewport = [&]() {
+    VkViewport view_port = {.x = 0, .y = 0, .minDepth = 0.f, .maxDepth = 1.f};
+    view_port.width = m_draw_extent.width;
+    view_port.height = m_draw_extent.height;
+    vkCmdSetViewport(cmd, 0, 1, &view_port);
+    VkRect2D scissor = {};
+    scissor.offset.x = scissor.offset.y = 0;
+    scissor.extent.width = m_draw_extent.width;
+    scissor.extent.height = m_draw_extent.height;
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+  };
+  if (depth_only) {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      m_depth_only_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_depth_only_pipeline_layout, 0, 1, &frame_ds, 0,
+                            nullptr);
+    setViewport();
+  }
+  for (const DrawItem &item : items) {
+    const RenderObject &r = *item.object;
+    VkPipelineLayout layout = m_depth_only_pipeline_layout;
+    if (!depth_only) {
+      // Depth is complete when prepassed, only test it.
+      MaterialPipeline *pipeline = m_metal_rough_mat.variant(
+          r.material->p_pipeline, prepassed, m_use_clustered_lighting);
+      layout = pipeline->layout;
+      if (r.material != last_material || pipeline != last_pipeline) {
+        last_material = r.material;
+        if (pipeline != last_pipeline) {
+          last_pipeline = pipeline;
+          vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipeline->pipeline);
+          vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                  pipeline->layout, 0, 1, &frame_ds, 0,
+                                  nullptr);
+          setViewport();
+        }
         vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                r.material->p_pipeline->layout, 0, 1, &frame_ds,
-                                0, nullptr);
-        VkViewport view_port = {
-            .x = 0, .y = 0, .minDepth = 0.f, .maxDepth = 1.f};
-        view_port.width = m_draw_extent.width;
-        view_port.height = m_draw_extent.height;
-        vkCmdSetViewport(cmd, 0, 1, &view_port);
-        VkRect2D scissor = {};
-        scissor.offset.x = scissor.offset.y = 0;
-        scissor.extent.width = m_draw_extent.width;
-        scissor.extent.height = m_draw_extent.height;
-        vkCmdSetScissor(cmd, 0, 1, &scissor);
+                                pipeline->layout, 1, 1, &r.material->ds, 0,
+                                nullptr);
       }
-      vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              r.material->p_pipeline->layout, 1, 1,
-                              &r.material->ds, 0, nullptr);
     }
-    if (r.index_buffer != last_index_buffer) {
-      last_index_buffer = r.index_buffer;
-      vkCmdBindIndexBuffer(cmd, r.index_buffer, 0, VK_INDEX_TYPE_UINT32);
+    if (item.index_buffer != last_index_buffer ||
+        item.index_type != last_index_type) {
+      last_index_buffer = item.index_buffer;
+      last_index_type = item.index_type;
+      vkCmdBindIndexBuffer(cmd, item.index_buffer, 0, item.index_type);
     }
     GPUDrawPushConstants push_const;
     push_const.vertex_buffer_address = r.vertex_buffer_address;
     push_const.world_mat = r.transform;
-    vkCmdPushConstants(cmd, r.material->p_pipeline->layout,
-                       VK_SHADER_STAGE_VERTEX_BIT, 0,
+    push_const.color_buffer_address = r.color_buffer_address;
+    push_const.position_bound = glm::vec4(r.bound.origin, r.bound.radius);
+    push_const.vertex_layout = r.vertex_layout;
+    vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
                        sizeof(GPUDrawPushConstants), &push_const);
-    vkCmdDrawIndexed(cmd, r.n_index, 1, r.first_index, 0, 0);
-    stats.n_drawcalls += 1;
-    stats.n_triangles += r.n_index / 3;
-  };
-  VkRenderingAttachmentInfo color_attach = vkinit::attachmentInfo(
-      m_color_image.view, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-  VkRenderingAttachmentInfo depth_attach = vkinit::depthAttachmentInfo(
-      m_depth_image.view, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-  VkRenderingInfo i_render =
-      vkinit::renderingInfo(m_draw_extent, &color_attach, &depth_attach);
-  vkCmdBeginRendering(cmd, &i_render);
-  {
-    // vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-    //                   m_simple_mesh_pipeline);
-    // Bind texture.
-    VkDescriptorSet image_ds = getCurrentFrame().frame_descriptors.allocate(
-        m_device, m_single_image_ds_layout);
-    {
-      DescriptorWriter writer;
-      writer.writeImage(0, m_error_image.view, m_default_sampler_nearest,
-                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-      writer.updateDescriptorSet(m_device, image_ds);
-    }
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            m_simple_mesh_pipeline_layout, 0, 1, &image_ds, 0,
-                            nullptr);
-
-    AllocatedBuffer gpu_scene_data_buffer =
-        createBuffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                     VMA_MEMORY_USAGE_CPU_TO_GPU);
-    getCurrentFrame().deletion_queue.push(
-        [=, this]() { destroyBuffer(gpu_scene_data_buffer); });
-    GPUSceneData *scene_uniform_data =
-        (GPUSceneData *)gpu_scene_data_buffer.allocation->GetMappedData();
-    *scene_uniform_data = m_scene_data;
-    VkDescriptorSet frame_ds = getCurrentFrame().frame_descriptors.allocate(
-        m_device, m_GPU_scene_data_ds_layout);
-    {
-
-      DescriptorWriter writer;
-      writer.writeBuffer(0, gpu_scene_data_buffer.buffer, sizeof(GPUSceneData),
-                         0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-      writer.updateDescriptorSet(m_device, frame_ds);
+    if (item.indirect_buffer != VK_NULL_HANDLE) {
+      vkCmdDrawIndexedIndirect(
+          cmd, item.indirect_buffer,
+          item.draw_idx * sizeof(VkDrawIndexedIndirectCommand), 1,
+          sizeof(VkDrawIndexedIndirectCommand));
+    } else {
+      vkCmdDrawIndexed(cmd, r.n_index, 1, r.first_index, r.vertex_offset, 0);
+      n_triangles += r.n_index / 3;
     }
-
-    // for (auto &r : m_main_draw_context.opaque_surfaces)
-    //   drawObjet(r, frame_ds);
-    for (auto &idx : opaque_index)
-      drawObjet(m_main_draw_context.opaque_surfaces[idx], frame_ds);
-    for (auto &r : m_main_draw_context.transparent_surfaces)
-      drawObjet(r, frame_ds);
   }
-  vkCmdEndRendering(cmd);
-  m_main_draw_context.opaque_surfaces.clear();
-  m_main_draw_context.transparent_surfaces.clear();
+  return n_triangles;
+}
+VkCommandBuffer Engine::acquireSecondary(SecondaryCommands &secondary) {
+  if (secondary.n_used == secondary.buffers.size()) {
+    VkCommandBufferAllocateInfo cmd_alloc_info = vkinit::cmdBufferAllocInfo(
+        secondary.pool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+    VkCommandBuffer buffer;
+    VK_CHECK(vkAllocateCommandBuffers(m_device, &cmd_alloc_info, &buffer));
+    secondary.buffers.push_back(buffer);
+  }
+  return secondary.buffers[secondary.n_used++];
+}
+void Engine::stepRecordBenchmark() {
+  RecordBenchmark &bench = m_record_benchmark;
+  if (!bench.running)
+    return;
+  bench.total_ms += stats.t_record.period_ms;
+  if (++bench.n_frames < RecordBenchmark::kFramesPerStep)
+    return;
+  float average_ms = bench.total_ms / bench.n_frames;
+  bench.results_ms.push_back(average_ms);
+  fmt::println("Record benchmark: {} threads, {:.3f} ms, {:.2f}x",
+               bench.n_threads, average_ms,
+               bench.results_ms.front() / average_ms);
+  bench.n_frames = 0;
+  bench.total_ms = 0.f;
+  if (++bench.n_threads > m_jobs.size()) {
+    bench.running = false;
+    m_record_threads = static_cast<int>(m_jobs.size());
+    return;
+  }
+  m_record_threads = static_cast<int>(bench.n_threads);
 }
 void Engine::run() {
   SDL_Event e;
   bool b_quit = false;
   while (!b_quit) {
     stats.t_frame.begin();
+    m_job_profile = m_jobs.takeProfile();
 
     // Event handling.
     while (SDL_PollEvent(&e) != 0) {
@@ -363,10 +1121,13 @@ void Engine::run() {
           stop_rendering = true;
         if (e.window.type == SDL_EVENT_WINDOW_RESTORED)
           stop_rendering = false;
+        if (e.window.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED)
+          require_resize = true;
       }
       ImGui_ImplSDL3_ProcessEvent(&e);
       auto &io = ImGui::GetIO();
-      if (io.WantCaptureMouse == false) // Imgui intercepting mouse.
+      // Imgui intercepting mouse, or the benchmark driving the camera.
+      if (io.WantCaptureMouse == false && !m_benchmark.running())
         m_main_camera.processSDLEvent(e);
     }
 
@@ -386,6 +1147,137 @@ void Engine::run() {
     {
       if (ImGui::Begin("Panel")) {
         ImGui::SliderFloat("Render Scale", &m_render_scale, 0.3f, 1.f);
+        ImGui::Checkbox("Auto Render Scale", &m_resolution_controller.enabled);
+        if (m_resolution_controller.enabled) {
+          ImGui::SliderFloat("GPU Budget (ms)",
+                             &m_resolution_controller.budget_ms, 1.f, 50.f);
+          ImGui::SliderFloat("Min Scale", &m_resolution_controller.min_scale,
+                             0.1f, 1.f);
+          ImGui::Text("Smoothed GPU time %f ms",
+                      m_resolution_controller.smoothed_ms);
+        }
+        if (m_has_async_compute)
+          ImGui::Checkbox("Async Compute Background", &m_use_async_compute);
+        ImGui::Checkbox("Upscaler", &m_use_upscaler);
+        if (m_use_upscaler)
+          ImGui::SliderFloat("Sharpness", &m_upscale_sharpness, 0.f, 1.f);
+        ImGui::Checkbox("Occlusion Culling", &m_use_occlusion_culling);
+        ImGui::Checkbox("Depth Pre-pass", &m_use_depth_prepass);
+        ImGui::Checkbox("Cluster Culling", &m_use_cluster_culling);
+        ImGui::Checkbox("Clustered Lighting", &m_use_clustered_lighting);
+        ImGui::InputInt("Lights", &m_n_scatter_lights);
+        if (ImGui::Button("Scatter Lights")) {
+          m_lighting.scatter(std::max(m_n_scatter_lights, 0), glm::vec3{0.f},
+                             glm::vec3{30.f, 5.f, 30.f});
+          m_use_clustered_lighting = true;
+        }
+        if (m_use_clustered_lighting) {
+          const LightingStats &light_stats = m_lighting.stats();
+          ImGui::Text("Lights %u in view of %u", light_stats.n_uploaded,
+                      light_stats.n_lights);
+        }
+        ImGui::SliderInt("Record Threads", &m_record_threads, 1,
+                         m_jobs.size());
+        if (!m_record_benchmark.running &&
+            ImGui::Button("Benchmark Recording")) {
+          m_record_benchmark = RecordBenchmark{};
+          m_record_benchmark.running = true;
+          m_record_threads = 1;
+        }
+        if (ImGui::Button("Add Camera Key")) {
+          CameraKey key;
+          key.time = 2.f * m_recorded_path.keys.size();
+          key.position = m_main_camera.position;
+          key.pitch = m_main_camera.pitch;
+          key.yaw = m_main_camera.yaw;
+          m_recorded_path.keys.push_back(key);
+        }
+        if (!m_recorded_path.keys.empty()) {
+          ImGui::SameLine();
+          if (ImGui::Button(
+                  fmt::format("Save {} Keys", m_recorded_path.keys.size())
+                      .c_str())) {
+            if (m_recorded_path.save("camera_path.txt"))
+              fmt::println("Camera path written to camera_path.txt");
+          }
+        }
+        for (size_t i = 0; i < m_record_benchmark.results_ms.size(); i++)
+          ImGui::Text("\t%zu threads: %.3f ms, %.2fx", i + 1,
+                      m_record_benchmark.results_ms[i],
+                      m_record_benchmark.results_ms[0] /
+                          m_record_benchmark.results_ms[i]);
+        int texture_budget_mib =
+            static_cast<int>(m_texture_streamer.budget_bytes >> 20);
+        if (ImGui::SliderInt("Texture Budget (MiB)", &texture_budget_mib, 16,
+                             2048))
+          m_texture_streamer.budget_bytes = size_t(texture_budget_mib) << 20;
+        if (ImGui::Button("Dump Memory Stats"))
+          dumpMemoryStats("vma_stats.json");
+        ImGui::SameLine();
+        if (ImGui::Button("Defragment Geometry"))
+          defragmentGeometry();
+        static char scene_path[256] = "../../assets/models/structure.glb";
+        ImGui::InputText("Scene Path", scene_path, sizeof(scene_path));
+        static SyntheticSceneConfig synthetic;
+        static int synthetic_objects = static_cast<int>(synthetic.n_objects);
+        ImGui::InputInt("Synthetic Objects", &synthetic_objects, 1000,
+                        100000);
+        synthetic_objects = std::clamp(synthetic_objects, 1, 1 << 22);
+        if (ImGui::Button("Load Scene")) {
+          std::filesystem::path path(scene_path);
+          m_scenes.requestScene(path.stem().string(), path);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Generate Scene")) {
+          synthetic.n_objects = static_cast<uint32_t>(synthetic_objects);
+          m_scenes.requestScene("synthetic", synthetic);
+        }
+        for (auto &[name, scene] : m_loaded_scenes) {
+          ImGui::SameLine();
+          if (ImGui::Button(fmt::format("Unload {}", name).c_str()))
+            m_scenes.unloadScene(name);
+        }
+        if (m_scenes.nPending() > 0 || m_scenes.nRetired() > 0)
+          ImGui::Text("Scenes loading %u, retired %u", m_scenes.nPending(),
+                      m_scenes.nRetired());
+        static int capture_format = static_cast<int>(CaptureFormat::NV12);
+        bool capturing = m_capture.capturing();
+        if (!capturing)
+          ImGui::Combo("Capture Format", &capture_format, "RGBA8\0NV12\0");
+        if (ImGui::Checkbox("Capture Frames", &capturing)) {
+          if (capturing)
+            startCapture(static_cast<CaptureFormat>(capture_format));
+          else
+            m_capture.stop();
+        }
+        FrameCaptureStats capture_stats = m_capture.stats();
+        if (capture_stats.n_delivered > 0 || capture_stats.n_dropped > 0)
+          ImGui::Text("Captured %u, dropped %u, %zu MiB",
+                      capture_stats.n_delivered, capture_stats.n_dropped,
+                      capture_stats.delivered_bytes >> 20);
+        bool job_profiling = m_jobs.profiling();
+        if (ImGui::Checkbox("Job Profiling", &job_profiling))
+          m_jobs.setProfiling(job_profiling);
+        bool call_stats = vkstats::enabled();
+        if (ImGui::Checkbox("Count Vulkan Calls", &call_stats)) {
+          vkstats::setEnabled(call_stats);
+          vkstats::reset();
+        }
+        if (call_stats) {
+          ImGui::SameLine();
+          bool time_calls = vkstats::timeCalls();
+          if (ImGui::Checkbox("Time Calls", &time_calls)) {
+            vkstats::setTimeCalls(time_calls);
+            vkstats::reset();
+          }
+          ImGui::SameLine();
+          if (ImGui::Button("Dump Call Stats"))
+            vkstats::dump("call_stats.json");
+        }
+        ImGui::Checkbox("LOD", &m_use_lod);
+        if (m_use_lod)
+          ImGui::SliderFloat("LOD Error (px)", &m_lod_max_error_pixels, 0.1f,
+                             8.f);
         auto &selected_pipeline = m_compute_pipelines[m_cur_comp_pipeline_idx];
         ImGui::Text("Selected Compute Pipeline: %s", selected_pipeline.name);
         ImGui::SliderInt("Effect Index", &m_cur_comp_pipeline_idx, 0,
@@ -401,25 +1293,186 @@ void Engine::run() {
                        m_timestamp_period / 1000000.f;
         float t_other = static_cast<float>(m_timestamps[5] - m_timestamps[4]) *
                         m_timestamp_period / 1000000.f;
+        // Async compute, relative to graphics begin of the same frame.
+        // Overlap counts the time both queues are busy, including the
+        // previous frame's graphics work.
+        auto toMs = [&](int64_t ticks) {
+          return static_cast<float>(ticks) * m_timestamp_period / 1000000.f;
+        };
+        int64_t c_begin = m_compute_timestamps[0];
+        int64_t c_end = m_compute_timestamps[1];
+        auto overlap = [&](int64_t g_begin, int64_t g_end) {
+          return std::max<int64_t>(
+              0, std::min(c_end, g_end) - std::max(c_begin, g_begin));
+        };
+        float t_async_comp = toMs(c_end - c_begin);
+        float t_async_start = toMs(c_begin - int64_t(m_timestamps[0]));
+        float t_async_overlap =
+            toMs(overlap(m_prev_timestamps[0], m_prev_timestamps[5]) +
+                 overlap(m_timestamps[0], m_timestamps[5]));
         ImGui::Text("Stats:");
         ImGui::Text("\t#triangles      %d", stats.n_triangles);
         ImGui::Text("\t#drawcalls      %d", stats.n_drawcalls);
+        if (m_use_occlusion_culling) {
+          ImGui::Text("\t#occl. visible  %d", stats.n_occlusion_visible);
+          ImGui::Text("\t#occl. culled   %d", stats.n_occlusion_culled);
+        }
+        if (m_use_cluster_culling) {
+          ImGui::Text("\t#clusters       %d", stats.n_clusters_tested);
+          ImGui::Text("\t#clusters culled %d", stats.n_clusters_culled);
+        }
+        for (auto &[name, scene] : m_loaded_scenes)
+          ImGui::Text("\t%s vertex data %zu KiB / %zu KiB full",
+                      name.c_str(), scene->vertex_bytes / 1024,
+                      scene->vertex_bytes_full / 1024);
+        static const char *kPressureNames[] = {"normal", "high", "critical"};
+        ImGui::Text("\tmemory pressure %s%s",
+                    kPressureNames[static_cast<int>(stats.memory_pressure)],
+                    m_has_memory_budget ? "" : " (estimated)");
+        for (size_t i = 0; i < stats.heaps.size(); i++) {
+          const HeapBudget &heap = stats.heaps[i];
+          ImGui::Text("\theap %zu %-4s     %.1f / %.1f MiB", i,
+                      heap.device_local ? "VRAM" : "host",
+                      heap.usage / 1048576.f, heap.budget / 1048576.f);
+        }
+        static const char *kPoolNames[] = {"default", "geometry", "texture",
+                                           "target", "upload"};
+        for (size_t i = 1; i < m_pools.size(); i++) {
+          VmaStatistics pool_stats;
+          vmaGetPoolStatistics(m_allocator, m_pools[i], &pool_stats);
+          ImGui::Text("\t%-8s pool  %.1f / %.1f MiB, %u allocs", kPoolNames[i],
+                      pool_stats.allocationBytes / 1048576.f,
+                      pool_stats.blockBytes / 1048576.f,
+                      pool_stats.allocationCount);
+        }
+        const TextureStreamingStats &tex_stats = m_texture_streamer.stats();
+        ImGui::Text("\ttextures        %.1f / %.1f MiB (%.1f full)",
+                    tex_stats.resident_bytes / 1048576.f,
+                    m_texture_streamer.budget_bytes / 1048576.f,
+                    tex_stats.full_bytes / 1048576.f);
+        ImGui::Text("\ttex. streaming  +%u -%u, %u refused, %zu KiB",
+                    tex_stats.n_upgraded, tex_stats.n_evicted,
+                    tex_stats.n_refused, tex_stats.uploaded_bytes / 1024);
+        const AssetCacheStats &cache_stats = m_assets.stats();
+        ImGui::Text("\tasset cache     %u textures, %u samplers",
+                    cache_stats.n_textures, cache_stats.n_samplers);
+        ImGui::Text("\t  texture hits  %u / %u, %.1f MiB not uploaded",
+                    cache_stats.texture_hits,
+                    cache_stats.texture_hits + cache_stats.texture_misses,
+                    cache_stats.texture_bytes_saved / 1048576.f);
+        ImGui::Text("\t  sampler hits  %u / %u", cache_stats.sampler_hits,
+                    cache_stats.sampler_hits + cache_stats.sampler_misses);
+        if (stats.n_lod_triangles_full > 0)
+          ImGui::Text("\tLOD triangles   %d / %d (%.1f%%)",
+                      stats.n_lod_triangles, stats.n_lod_triangles_full,
+                      100.f * stats.n_lod_triangles /
+                          stats.n_lod_triangles_full);
         ImGui::Text("CPU time:");
         ImGui::Text("\tframe time      %f ms", stats.t_frame.period_ms);
         ImGui::Text("\tscene update    %f ms", stats.t_scene_update.period_ms);
+        ImGui::Text("\t  waited for    %f ms", stats.t_update_wait.period_ms);
         ImGui::Text("\tCPU draw time   %f ms", stats.t_cpu_draw.period_ms);
+        ImGui::Text("\trecord geometry %f ms (%d threads)",
+                    stats.t_record.period_ms, m_record_threads);
         ImGui::Text("GPU time:");
         ImGui::Text("\tGPU compute     %f ms", t_comp);
         ImGui::Text("\tGPU geometry    %f ms", t_geom);
         ImGui::Text("\tGPU others      %f ms", t_other);
+        if (m_has_async_compute && m_use_async_compute) {
+          ImGui::Text("Async compute queue:");
+          ImGui::Text("\tGPU compute     %f ms", t_async_comp);
+          ImGui::Text("\tstart offset    %f ms", t_async_start);
+          ImGui::Text("\toverlap         %f ms", t_async_overlap);
+        }
+        if (m_jobs.profiling()) {
+          // Names are static strings, same name same pointer.
+          struct JobSummary {
+            const char *name;
+            int count;
+            float total_ms;
+          };
+          std::vector<JobSummary> summary;
+          std::vector<float> busy_ms(m_jobs.nQueues(), 0.f);
+          for (const JobProfile &job : m_job_profile) {
+            auto it = std::find_if(
+                summary.begin(), summary.end(),
+                [&](const JobSummary &s) { return s.name == job.name; });
+            if (it == summary.end())
+              it = summary.insert(summary.end(), {job.name, 0, 0.f});
+            it->count++;
+            it->total_ms += job.duration_ms;
+            busy_ms[job.thread] += job.duration_ms;
+          }
+          ImGui::Text("Jobs:");
+          for (const JobSummary &s : summary)
+            ImGui::Text("\t%-16s %4d, %f ms", s.name, s.count, s.total_ms);
+          for (size_t i = 0; i < busy_ms.size(); i++)
+            ImGui::Text("\tthread %2zu busy  %f ms", i, busy_ms[i]);
+        }
       }
       ImGui::End();
+      if (vkstats::enabled()) {
+        if (ImGui::Begin("Vulkan Calls")) {
+          using vkstats::kCalls;
+          const vkstats::FrameCallStats &calls = vkstats::lastFrame();
+          bool timed = vkstats::timeCalls();
+          ImGui::Text("Recording %f ms", calls.record_ms);
+          // Short names, in the order of vkstats::Call.
+          static const char *kColumns[kCalls] = {
+              "pipeline", "sets", "push", "index", "draw", "indirect",
+              "dispatch"};
+          if (ImGui::BeginTable("calls", kCalls + 2,
+                                ImGuiTableFlags_Borders |
+                                    ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("pass");
+            ImGui::TableSetupColumn(timed ? "ms (in calls)" : "ms");
+            for (const char *name : kColumns)
+              ImGui::TableSetupColumn(name);
+            ImGui::TableHeadersRow();
+            vkstats::PassCallStats total;
+            auto row = [&](const char *name,
+                           const vkstats::PassCallStats &pass) {
+              float call_ms = 0.f;
+              for (float ms : pass.call_ms)
+                call_ms += ms;
+              ImGui::TableNextRow();
+              ImGui::TableNextColumn();
+              ImGui::TextUnformatted(name);
+              ImGui::TableNextColumn();
+              if (timed)
+                ImGui::Text("%.3f (%.3f)", pass.record_ms, call_ms);
+              else
+                ImGui::Text("%.3f", pass.record_ms);
+              for (uint32_t count : pass.counts) {
+                ImGui::TableNextColumn();
+                ImGui::Text("%u", count);
+              }
+            };
+            for (size_t p = 0; p < vkstats::kPasses; p++) {
+              const vkstats::PassCallStats &pass = calls.passes[p];
+              for (size_t c = 0; c < kCalls; c++) {
+                total.counts[c] += pass.counts[c];
+                total.call_ms[c] += pass.call_ms[c];
+              }
+              total.record_ms += pass.record_ms;
+              row(vkstats::passName(static_cast<vkstats::Pass>(p)), pass);
+            }
+            row("total", total);
+            ImGui::EndTable();
+          }
+        }
+        ImGui::End();
+      }
     }
     ImGui::Render();
 
     // Pipeline draw.
+    m_benchmark.beginFrame(m_main_camera);
     draw();
     stats.t_frame.end();
+    m_benchmark.endFrame(stats);
+    if (m_benchmark.done())
+      b_quit = true;
   }
 }
 
@@ -447,6 +1500,7 @@ void Engine::initVulkan() {
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
   features12.bufferDeviceAddress = true;
   features12.descriptorIndexing = true;
+  features12.timelineSemaphore = true;
 
   // Select a gpu.
   // We want a gpu that can write to the SDL surface and supports vulkan 1.3
@@ -480,6 +1534,12 @@ void Engine::initVulkan() {
         "No suitable physical devices by device properties."};
   }
 
+  // Real heap budgets for VMA, otherwise it estimates from heap sizes.
+  m_has_memory_budget = physical_device.enable_extension_if_present(
+      VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  fmt::println("memory budget extension {}",
+               m_has_memory_budget ? "on" : "off");
+
   // Final vulkan device.
   vkb::DeviceBuilder device_builder{physical_device};
   vkb::Device vkb_device = device_builder.build().value();
@@ -489,6 +1549,23 @@ void Engine::initVulkan() {
   m_graphic_queue = vkb_device.get_queue(vkb::QueueType::graphics).value();
   m_graphic_queue_family =
       vkb_device.get_queue_index(vkb::QueueType::graphics).value();
+  // Prefer a compute family without graphics, so work can truly overlap.
+  // Timestamps are required to report the overlap.
+  auto compute_queue = vkb_device.get_queue(vkb::QueueType::compute);
+  auto compute_family = vkb_device.get_queue_index(vkb::QueueType::compute);
+  if (compute_queue.has_value() && compute_family.has_value() &&
+      compute_family.value() != m_graphic_queue_family &&
+      physical_device.get_queue_families()[compute_family.value()]
+              .timestampValidBits > 0) {
+    m_compute_queue = compute_queue.value();
+    m_compute_queue_family = compute_family.value();
+    m_has_async_compute = true;
+    m_use_async_compute = true;
+  } else {
+    m_compute_queue = m_graphic_queue;
+    m_compute_queue_family = m_graphic_queue_family;
+  }
+  fmt::println("async compute {}", m_has_async_compute ? "on" : "off");
 
   // Mem allocator.
   VmaAllocatorCreateInfo ci_alloc = {};
@@ -496,32 +1573,257 @@ void Engine::initVulkan() {
   ci_alloc.device = m_device;
   ci_alloc.instance = m_instance;
   ci_alloc.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+  if (m_has_memory_budget)
+    ci_alloc.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
   vmaCreateAllocator(&ci_alloc, &m_allocator);
 
-  // Profiler.
+  // Profiler, one pool per frame to read results without waiting.
   m_timestamps.resize(6);
+  m_prev_timestamps.resize(m_timestamps.size());
+  m_compute_timestamps.resize(2);
   VkQueryPoolCreateInfo ci_query_pool = {};
   ci_query_pool.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
   ci_query_pool.queryType = VK_QUERY_TYPE_TIMESTAMP;
-  ci_query_pool.queryCount = static_cast<uint32_t>(m_timestamps.size());
-  VK_CHECK(vkCreateQueryPool(m_device, &ci_query_pool, nullptr,
-                             &m_query_pool_timestamp));
+  for (uint32_t i = 0; i < kFrameOverlap; i++) {
+    ci_query_pool.queryCount = static_cast<uint32_t>(m_timestamps.size());
+    VK_CHECK(vkCreateQueryPool(m_device, &ci_query_pool, nullptr,
+                               &m_frames[i].query_pool_timestamp));
+    ci_query_pool.queryCount =
+        static_cast<uint32_t>(m_compute_timestamps.size());
+    VK_CHECK(vkCreateQueryPool(m_device, &ci_query_pool, nullptr,
+                               &m_frames[i].query_pool_compute));
+  }
 
   m_main_deletion_queue.push([&]() {
     vmaDestroyAllocator(m_allocator);
-    vkDestroyQueryPool(m_device, m_query_pool_timestamp, nullptr);
+    for (uint32_t i = 0; i < kFrameOverlap; i++) {
+      vkDestroyQueryPool(m_device, m_frames[i].query_pool_timestamp, nullptr);
+      vkDestroyQueryPool(m_device, m_frames[i].query_pool_compute, nullptr);
+    }
     vkDestroyDevice(m_device, nullptr);
     vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
     vkb::destroy_debug_utils_messenger(m_instance, m_debug_msngr);
     vkDestroyInstance(m_instance, nullptr);
   });
 }
+void Engine::initMemoryPools() {
+  // Memory type of each pool, from a typical resource of its class.
+  VkBufferCreateInfo ci_buffer = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  ci_buffer.size = 65536;
+  VmaAllocationCreateInfo ci_alloc = {};
+  uint32_t geometry_type, upload_type, texture_type, target_type;
+  ci_buffer.usage = kGeometryBufferUsage;
+  ci_alloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  VK_CHECK(vmaFindMemoryTypeIndexForBufferInfo(m_allocator, &ci_buffer,
+                                               &ci_alloc, &geometry_type));
+  ci_buffer.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  ci_alloc.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+  VK_CHECK(vmaFindMemoryTypeIndexForBufferInfo(m_allocator, &ci_buffer,
+                                               &ci_alloc, &upload_type));
+  ci_alloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  ci_alloc.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  VkImageCreateInfo ci_image = vkinit::imageCreateInfo(
+      VK_FORMAT_R8G8B8A8_UNORM,
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      VkExtent3D{256, 256, 1});
+  VK_CHECK(vmaFindMemoryTypeIndexForImageInfo(m_allocator, &ci_image,
+                                              &ci_alloc, &texture_type));
+  ci_image = vkinit::imageCreateInfo(
+      VK_FORMAT_R16G16B16A16_SFLOAT,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      VkExtent3D{window_extent.width, window_extent.height, 1});
+  VK_CHECK(vmaFindMemoryTypeIndexForImageInfo(m_allocator, &ci_image,
+                                              &ci_alloc, &target_type));
+
+  auto createPool = [&](MemoryClass mem_class, uint32_t memory_type,
+                        VkDeviceSize block_size) {
+    VmaPoolCreateInfo ci_pool = {};
+    ci_pool.memoryTypeIndex = memory_type;
+    ci_pool.blockSize = block_size; // 0 for VMA default.
+    VK_CHECK(vmaCreatePool(m_allocator, &ci_pool,
+                           &m_pools[static_cast<size_t>(mem_class)]));
+  };
+  // Geometry lives as long as its scene, in large blocks.
+  createPool(MemoryClass::Geometry, geometry_type, kPoolBlockSize);
+  createPool(MemoryClass::Texture, texture_type, kPoolBlockSize);
+  // Few and large, recreated on resize.
+  createPool(MemoryClass::RenderTarget, target_type, 0);
+  // Short lived, small blocks so they return to the driver quickly.
+  createPool(MemoryClass::Upload, upload_type, kUploadBlockSize);
+  m_main_deletion_queue.push([&]() {
+    for (VmaPool pool : m_pools) {
+      if (pool)
+        vmaDestroyPool(m_allocator, pool);
+    }
+  });
+}
+void Engine::dumpMemoryStats(const std::string &path) {
+  char *json = nullptr;
+  vmaBuildStatsString(m_allocator, &json, VK_TRUE);
+  FILE *file = fopen(path.c_str(), "w");
+  if (file) {
+    fputs(json, file);
+    fclose(file);
+    fmt::println("Memory stats written to {}", path);
+  } else {
+    fmt::println("Failed to open {}", path);
+  }
+  vmaFreeStatsString(m_allocator, json);
+}
+void Engine::startCapture(CaptureFormat format) {
+  const char *pixel_format = format == CaptureFormat::NV12 ? "nv12" : "rgba";
+  std::string path = fmt::format("capture.{}", pixel_format);
+  FILE *raw_file = fopen(path.c_str(), "wb");
+  if (!raw_file) {
+    fmt::println("Failed to open {}", path);
+    return;
+  }
+  // Closed once no slot holds the callback any more, or on the next file.
+  std::shared_ptr<FILE> file(raw_file, [](FILE *f) { fclose(f); });
+  uint32_t n_files = 0;
+  VkExtent2D extent{0, 0};
+  m_capture.start(format, [=](const CapturedFrame &frame) mutable {
+    if (frame.extent.width != extent.width ||
+        frame.extent.height != extent.height) {
+      // Raw frames have no size, a resized window starts a new file.
+      if (extent.width != 0) {
+        path = fmt::format("capture_{}.{}", ++n_files, pixel_format);
+        raw_file = fopen(path.c_str(), "wb");
+        if (raw_file)
+          file.reset(raw_file, [](FILE *f) { fclose(f); });
+        else
+          file.reset();
+      }
+      extent = frame.extent;
+      if (!file)
+        fmt::println("Failed to open {}, dropping {}x{} frames", path,
+                     extent.width, extent.height);
+      else
+        fmt::println("Capturing {}x{} frames to {}, play with ffplay -f "
+                     "rawvideo -pixel_format {} -video_size {}x{} {}",
+                     extent.width, extent.height, path, pixel_format,
+                     extent.width, extent.height, path);
+    }
+    if (file)
+      fwrite(frame.data.data(), 1, frame.data.size(), file.get());
+  });
+}
+void Engine::defragmentGeometry() {
+  // Buffers move, nothing may use them meanwhile.
+  m_jobs.wait(m_update_done);
+  VK_CHECK(vkDeviceWaitIdle(m_device));
+  struct Movable {
+    AllocatedBuffer *buffer;
+    VkDeviceAddress *address;
+  };
+  std::unordered_map<VmaAllocation, Movable> movable;
+  for (auto &[name, scene] : m_loaded_scenes) {
+    for (auto &[mesh_name, mesh] : scene->meshes) {
+      GPUMeshBuffers &buffers = mesh->mesh_buffers;
+      for (Movable m : {Movable{&buffers.index_buffer,
+                                &buffers.index_buffer_address},
+                        Movable{&buffers.vertex_buffer,
+                                &buffers.vertex_buffer_address},
+                        Movable{&buffers.color_buffer,
+                                &buffers.color_buffer_address},
+                        Movable{&buffers.meshlet_buffer,
+                                &buffers.meshlet_buffer_address}}) {
+        if (m.buffer->allocation)
+          movable[m.buffer->allocation] = m;
+      }
+    }
+  }
+
+  VmaDefragmentationInfo info = {};
+  info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_FULL_BIT;
+  info.pool = m_pools[static_cast<size_t>(MemoryClass::Geometry)];
+  VmaDefragmentationContext context;
+  VK_CHECK(vmaBeginDefragmentation(m_allocator, &info, &context));
+  VmaDefragmentationPassMoveInfo pass;
+  while (true) {
+    VkResult result = vmaBeginDefragmentationPass(m_allocator, context, &pass);
+    if (result == VK_SUCCESS)
+      break;
+    if (result != VK_INCOMPLETE)
+      VK_CHECK(result);
+    // Same buffer bound at the new place, contents copied over.
+    std::vector<std::pair<Movable, VkBuffer>> moved;
+    for (uint32_t i = 0; i < pass.moveCount; i++) {
+      VmaDefragmentationMove &move = pass.pMoves[i];
+      auto it = movable.find(move.srcAllocation);
+      if (it == movable.end()) {
+        move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+        continue;
+      }
+      VkBufferCreateInfo ci_buffer = {
+          .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+      ci_buffer.size = it->second.buffer->size;
+      ci_buffer.usage = kGeometryBufferUsage;
+      VkBuffer buffer;
+      VK_CHECK(vkCreateBuffer(m_device, &ci_buffer, nullptr, &buffer));
+      VK_CHECK(vmaBindBufferMemory(m_allocator, move.dstTmpAllocation, buffer));
+      moved.push_back({it->second, buffer});
+    }
+    immediateSubmit([&](VkCommandBuffer cmd) {
+      for (auto &[m, buffer] : moved) {
+        VkBufferCopy copy = {};
+        copy.size = m.buffer->size;
+        vkCmdCopyBuffer(cmd, m.buffer->buffer, buffer, 1, &copy);
+      }
+    });
+    VkBufferDeviceAddressInfo i_device_address{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
+    for (auto &[m, buffer] : moved) {
+      vkDestroyBuffer(m_device, m.buffer->buffer, nullptr);
+      m.buffer->buffer = buffer;
+      i_device_address.buffer = buffer;
+      *m.address = vkGetBufferDeviceAddress(m_device, &i_device_address);
+    }
+    // Allocation handles now point to the new places.
+    result = vmaEndDefragmentationPass(m_allocator, context, &pass);
+    for (auto &[m, buffer] : moved)
+      vmaGetAllocationInfo(m_allocator, m.buffer->allocation,
+                           &m.buffer->alloc_info);
+    if (result == VK_SUCCESS)
+      break;
+    if (result != VK_INCOMPLETE)
+      VK_CHECK(result);
+  }
+  VmaDefragmentationStats defrag_stats;
+  vmaEndDefragmentation(m_allocator, context, &defrag_stats);
+  fmt::println("Geometry defragmented: {} allocations, {} KiB moved, {} "
+               "blocks ({} KiB) freed",
+               defrag_stats.allocationsMoved, defrag_stats.bytesMoved / 1024,
+               defrag_stats.deviceMemoryBlocksFreed,
+               defrag_stats.bytesFreed / 1024);
+  // Pending snapshot holds old handles and addresses.
+  kickSceneUpdate(false);
+}
 void Engine::initSwapchain() {
   fmt::print("init swapchain\n");
   createSwapchain(window_extent.width, window_extent.height);
+  createRenderTargets(window_extent);
 
+  // Latest ones, those replaced on resize are retired with frames.
+  m_main_deletion_queue.push([&]() {
+    destroyImage(m_color_image);
+    destroyImage(m_depth_image);
+    for (auto &view : m_depth_pyramid_mips)
+      vkDestroyImageView(m_device, view, nullptr);
+    destroyImage(m_depth_pyramid);
+    destroyImage(m_upscale_image);
+    if (m_has_async_compute)
+      for (uint32_t i = 0; i < kFrameOverlap; i++)
+        destroyImage(m_frames[i].background_image);
+    destroySwapchain();
+  });
+}
+void Engine::createRenderTargets(VkExtent2D extent) {
   // Custom draw image.
-  VkExtent3D color_img_ext = {window_extent.width, window_extent.height, 1};
+  VkExtent3D color_img_ext = {extent.width, extent.height, 1};
   VkImageUsageFlags color_img_usage = {};
   // Copy from and into.
   color_img_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
@@ -530,23 +1832,110 @@ void Engine::initSwapchain() {
   color_img_usage |= VK_IMAGE_USAGE_STORAGE_BIT;
   // Graphics pipelines draw.
   color_img_usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  // Frame capture samples it.
+  color_img_usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
   m_color_image = createImage(color_img_ext, VK_FORMAT_R16G16B16A16_SFLOAT,
                               color_img_usage);
 
-  VkExtent3D depth_img_ext = {window_extent.width, window_extent.height, 1};
-  m_depth_image.format = VK_FORMAT_D32_SFLOAT;
-  m_depth_image.extent = depth_img_ext;
+  VkExtent3D depth_img_ext = {extent.width, extent.height, 1};
   VkImageUsageFlags depth_img_usage = {};
   depth_img_usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  // Source of depth pyramid.
+  depth_img_usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
   m_depth_image =
       createImage(depth_img_ext, VK_FORMAT_D32_SFLOAT, depth_img_usage);
 
-  m_main_deletion_queue.push([&]() {
-    destroyImage(m_color_image);
-    destroyImage(m_depth_image);
-    destroySwapchain();
+  // Power of two so every texel covers exactly 2x2 of the next level.
+  auto prevPow2 = [](uint32_t v) {
+    uint32_t r = 1;
+    while (r * 2 <= v)
+      r *= 2;
+    return r;
+  };
+  m_depth_pyramid_extent = {prevPow2(extent.width), prevPow2(extent.height)};
+  m_depth_pyramid_levels =
+      static_cast<uint32_t>(std::floor(std::log2(std::max(
+          m_depth_pyramid_extent.width, m_depth_pyramid_extent.height)))) +
+      1;
+  VkImageUsageFlags pyramid_usage = {};
+  pyramid_usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  pyramid_usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+  pyramid_usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  m_depth_pyramid = createImage(
+      {m_depth_pyramid_extent.width, m_depth_pyramid_extent.height, 1},
+      VK_FORMAT_R32_SFLOAT, pyramid_usage, true);
+  m_depth_pyramid_mips.resize(m_depth_pyramid_levels);
+  for (uint32_t i = 0; i < m_depth_pyramid_levels; i++) {
+    VkImageViewCreateInfo ci_view = vkinit::imageViewCreateInfo(
+        VK_FORMAT_R32_SFLOAT, m_depth_pyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+    ci_view.subresourceRange.baseMipLevel = i;
+    ci_view.subresourceRange.levelCount = 1;
+    VK_CHECK(vkCreateImageView(m_device, &ci_view, nullptr,
+                               &m_depth_pyramid_mips[i]));
+  }
+
+  // Storage for upscaler output, transfer for copying to swapchain, sampled
+  // for frame capture.
+  VkImageUsageFlags upscale_img_usage = {};
+  upscale_img_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  upscale_img_usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  upscale_img_usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+  m_upscale_image =
+      createImage(color_img_ext, VK_FORMAT_R8G8B8A8_UNORM, upscale_img_usage);
+
+  // Compute queue writes, graphics queue copies into color image.
+  if (m_has_async_compute) {
+    VkImageUsageFlags background_usage = {};
+    background_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    background_usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+    for (uint32_t i = 0; i < kFrameOverlap; i++)
+      m_frames[i].background_image = createImage(
+          color_img_ext, m_color_image.format, background_usage);
+  }
+
+  m_depth_pyramid_valid = false;
+}
+void Engine::retireRenderTargets(DeletionQueue &queue) {
+  std::vector<AllocatedImage> images = {m_color_image, m_depth_image,
+                                        m_depth_pyramid, m_upscale_image};
+  if (m_has_async_compute)
+    for (uint32_t i = 0; i < kFrameOverlap; i++)
+      images.push_back(m_frames[i].background_image);
+  queue.push([this, images, views = m_depth_pyramid_mips]() {
+    for (VkImageView view : views)
+      vkDestroyImageView(m_device, view, nullptr);
+    for (const AllocatedImage &image : images)
+      destroyImage(image);
   });
 }
+void Engine::writeRenderTargetSets() {
+  // Fresh sets, as old ones may be in use by frames in flight. Those leak
+  // into the global pool, only render target growth allocates more.
+  m_draw_image_ds =
+      m_global_ds_allocator.allocate(m_device, m_draw_image_ds_layout);
+  m_upscale_ds = m_global_ds_allocator.allocate(m_device, m_upscale_ds_layout);
+  DescriptorWriter writer;
+  writer.writeImage(0, m_color_image.view, VK_NULL_HANDLE,
+                    VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+  writer.updateDescriptorSet(m_device, m_draw_image_ds);
+  writer.clear();
+  writer.writeImage(0, m_color_image.view, VK_NULL_HANDLE,
+                    VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+  writer.writeImage(1, m_upscale_image.view, VK_NULL_HANDLE,
+                    VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+  writer.updateDescriptorSet(m_device, m_upscale_ds);
+  if (m_has_async_compute) {
+    for (uint32_t i = 0; i < kFrameOverlap; i++) {
+      m_frames[i].background_ds =
+          m_global_ds_allocator.allocate(m_device, m_draw_image_ds_layout);
+      writer.clear();
+      writer.writeImage(0, m_frames[i].background_image.view, VK_NULL_HANDLE,
+                        VK_IMAGE_LAYOUT_GENERAL,
+                        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+      writer.updateDescriptorSet(m_device, m_frames[i].background_ds);
+    }
+  }
+}
 void Engine::initCommands() {
   fmt::print("init commands\n");
   // Create a command pool for commands submitted to the graphics queue.
@@ -561,6 +1950,26 @@ void Engine::initCommands() {
         vkinit::cmdBufferAllocInfo(m_frames[i].cmd_pool, 1);
     VK_CHECK(vkAllocateCommandBuffers(m_device, &cmd_alloc_info,
                                       &m_frames[i].cmd_buffer_main));
+    // Reset as a whole each frame, buffers are allocated when first needed.
+    VkCommandPoolCreateInfo ci_secondary_pool = vkinit::cmdPoolCreateInfo(
+        m_graphic_queue_family, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+    m_frames[i].secondary_cmds.resize(m_jobs.size());
+    for (SecondaryCommands &secondary : m_frames[i].secondary_cmds)
+      VK_CHECK(vkCreateCommandPool(m_device, &ci_secondary_pool, nullptr,
+                                   &secondary.pool));
+  }
+  if (m_has_async_compute) {
+    VkCommandPoolCreateInfo ci_compute_pool = vkinit::cmdPoolCreateInfo(
+        m_compute_queue_family,
+        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+    for (uint32_t i = 0; i < kFrameOverlap; i++) {
+      VK_CHECK(vkCreateCommandPool(m_device, &ci_compute_pool, nullptr,
+                                   &m_frames[i].compute_cmd_pool));
+      VkCommandBufferAllocateInfo cmd_alloc_info =
+          vkinit::cmdBufferAllocInfo(m_frames[i].compute_cmd_pool, 1);
+      VK_CHECK(vkAllocateCommandBuffers(m_device, &cmd_alloc_info,
+                                        &m_frames[i].cmd_buffer_compute));
+    }
   }
 
   // Init immediate cmd.
@@ -573,28 +1982,50 @@ void Engine::initCommands() {
       [&]() { vkDestroyCommandPool(m_device, m_imm_cmd_pool, nullptr); });
 }
 void Engine::initSyncStructures() {
-  // One fence to control when the gpu has finished rendering the frame.
-  // 2 semaphores to synchronize rendering with swapchain.
+  // One timeline per queue for CPU waits and cross-queue dependencies.
+  // 2 binary semaphores per frame to synchronize rendering with swapchain.
   fmt::print("init sync structures\n");
 
-  // The fence starts signalled so we can wait on it on the first frame.
-  VkFenceCreateInfo ci_fence =
-      vkinit::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
   VkSemaphoreCreateInfo ci_semaphore = vkinit::semaphoreCreateInfo();
-
   for (uint32_t i = 0; i < kFrameOverlap; i++) {
-    VK_CHECK(
-        vkCreateFence(m_device, &ci_fence, nullptr, &m_frames[i].render_fence));
     VK_CHECK(vkCreateSemaphore(m_device, &ci_semaphore, nullptr,
                                &m_frames[i].swapchain_semaphore));
     VK_CHECK(vkCreateSemaphore(m_device, &ci_semaphore, nullptr,
                                &m_frames[i].render_semaphore));
   }
-  VK_CHECK(vkCreateFence(m_device, &ci_fence, nullptr, &m_imm_fence));
-  m_main_deletion_queue.push(
-      [&]() { vkDestroyFence(m_device, m_imm_fence, nullptr); });
+  // Start at zero, which frames not submitted yet wait for.
+  VkSemaphoreTypeCreateInfo ci_timeline =
+      vkinit::semaphoreTypeCreateInfo(VK_SEMAPHORE_TYPE_TIMELINE, 0);
+  VkSemaphoreCreateInfo ci_timeline_semaphore = vkinit::semaphoreCreateInfo();
+  ci_timeline_semaphore.pNext = &ci_timeline;
+  VK_CHECK(vkCreateSemaphore(m_device, &ci_timeline_semaphore, nullptr,
+                             &m_graphics_timeline.semaphore));
+  m_main_deletion_queue.push([&]() {
+    vkDestroySemaphore(m_device, m_graphics_timeline.semaphore, nullptr);
+  });
+  if (m_has_async_compute) {
+    VK_CHECK(vkCreateSemaphore(m_device, &ci_timeline_semaphore, nullptr,
+                               &m_compute_timeline.semaphore));
+    m_main_deletion_queue.push([&]() {
+      vkDestroySemaphore(m_device, m_compute_timeline.semaphore, nullptr);
+    });
+  }
+}
+uint64_t QueueTimeline::poll(VkDevice device) {
+  VK_CHECK(vkGetSemaphoreCounterValue(device, semaphore, &completed));
+  return completed;
 }
-void Engine::createSwapchain(int w, int h) {
+void QueueTimeline::wait(VkDevice device, uint64_t value) {
+  if (value <= completed)
+    return;
+  VkSemaphoreWaitInfo wait_info{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+  wait_info.semaphoreCount = 1;
+  wait_info.pSemaphores = &semaphore;
+  wait_info.pValues = &value;
+  VK_CHECK(vkWaitSemaphores(device, &wait_info, VK_ONE_SEC));
+  completed = std::max(completed, value);
+}
+void Engine::createSwapchain(int w, int h, VkSwapchainKHR old_swapchain) {
   vkb::SwapchainBuilder swapchainBuilder{m_chosen_GPU, m_device, m_surface};
   m_swapchain_img_format = VK_FORMAT_B8G8R8A8_UNORM;
   vkb::Swapchain vkbSwapchain =
@@ -602,10 +2033,13 @@ void Engine::createSwapchain(int w, int h) {
           .set_desired_format(VkSurfaceFormatKHR{
               .format = m_swapchain_img_format,
               .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR})
-          // use v-sync present mode
-          .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+          // V-sync, but benchmarks run uncapped where supported.
+          .set_desired_present_mode(benchmark_config.enabled
+                                        ? VK_PRESENT_MODE_IMMEDIATE_KHR
+                                        : VK_PRESENT_MODE_FIFO_KHR)
           .set_desired_extent(w, h)
           .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+          .set_old_swapchain(old_swapchain)
           .build()
           .value();
 
@@ -631,12 +2065,44 @@ void Engine::initDescriptors() {
     builder.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
     m_draw_image_ds_layout =
         builder.build(m_device, VK_SHADER_STAGE_COMPUTE_BIT);
-    m_draw_image_ds =
-        m_global_ds_allocator.allocate(m_device, m_draw_image_ds_layout);
+  }
+  {
+    DescriptorLayoutBuilder builder;
+    builder.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE); // Input.
+    builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE); // Output.
+    m_upscale_ds_layout = builder.build(m_device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+  {
+    DescriptorLayoutBuilder builder;
+    builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER); // Input.
+    builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);          // Output.
+    m_depth_pyramid_ds_layout =
+        builder.build(m_device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+  {
+    DescriptorLayoutBuilder builder;
+    builder.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Objects.
+    builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Draws.
+    builder.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Visibility.
+    builder.addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Stats.
+    builder.addBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.addBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Cluster draws.
+    m_cull_ds_layout = builder.build(m_device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+  {
+    DescriptorLayoutBuilder builder;
+    builder.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Objects.
+    builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Indices.
+    builder.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Draws.
+    builder.addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Stats.
+    m_cluster_ds_layout = builder.build(m_device, VK_SHADER_STAGE_COMPUTE_BIT);
   }
   {
     DescriptorLayoutBuilder builder;
     builder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Lights.
+    builder.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Counts.
+    builder.addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // Indices.
     m_GPU_scene_data_ds_layout = builder.build(
         m_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
   }
@@ -648,14 +2114,15 @@ void Engine::initDescriptors() {
         builder.build(m_device, VK_SHADER_STAGE_FRAGMENT_BIT);
   }
 
-  DescriptorWriter writer;
-  writer.writeImage(0, m_color_image.view, VK_NULL_HANDLE,
-                    VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-  writer.updateDescriptorSet(m_device, m_draw_image_ds);
+  writeRenderTargetSets();
 
   m_main_deletion_queue.push([&]() {
     m_global_ds_allocator.destroyPools(m_device);
     vkDestroyDescriptorSetLayout(m_device, m_draw_image_ds_layout, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_upscale_ds_layout, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_depth_pyramid_ds_layout, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_cull_ds_layout, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_cluster_ds_layout, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_GPU_scene_data_ds_layout, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_single_image_ds_layout, nullptr);
   });
@@ -676,8 +2143,11 @@ void Engine::initDescriptors() {
 void Engine::initPipelines() {
   // Compute pipelines.
   initBackgroundPipelines();
+  initUpscalePipeline();
+  initCullingPipelines();
   // Graphics pipelines.
   initSimpleMeshPipeline();
+  initDepthOnlyPipeline();
   m_metal_rough_mat.buildPipelines(this);
 }
 void Engine::initBackgroundPipelines() {
@@ -783,6 +2253,157 @@ void Engine::initBackgroundPipelines() {
     }
   });
 }
+void Engine::initUpscalePipeline() {
+  VkPushConstantRange push_range = {};
+  push_range.offset = 0;
+  push_range.size = sizeof(UpscalePushConstants);
+  push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkPipelineLayoutCreateInfo ci_layout = vkinit::pipelineLayoutCreateInfo();
+  ci_layout.pSetLayouts = &m_upscale_ds_layout;
+  ci_layout.setLayoutCount = 1;
+  ci_layout.pPushConstantRanges = &push_range;
+  ci_layout.pushConstantRangeCount = 1;
+  VK_CHECK(vkCreatePipelineLayout(m_device, &ci_layout, nullptr,
+                                  &m_upscale_pipeline_layout));
+
+  VkShaderModule upscale_shader;
+  if (!vkutil::loadShaderModule("../../assets/shaders/upscale.comp.spv",
+                                m_device, &upscale_shader)) {
+    fmt::println("Error building compute shader.");
+  }
+  VkComputePipelineCreateInfo ci_pipeline = {};
+  ci_pipeline.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  ci_pipeline.pNext = nullptr;
+  ci_pipeline.layout = m_upscale_pipeline_layout;
+  ci_pipeline.stage = vkinit::pipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_COMPUTE_BIT, upscale_shader);
+  VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &ci_pipeline,
+                                    nullptr, &m_upscale_pipeline));
+  vkDestroyShaderModule(m_device, upscale_shader, nullptr);
+
+  m_main_deletion_queue.push([&]() {
+    vkDestroyPipelineLayout(m_device, m_upscale_pipeline_layout, nullptr);
+    vkDestroyPipeline(m_device, m_upscale_pipeline, nullptr);
+  });
+}
+void Engine::initCullingPipelines() {
+  // Pyramid reads texels directly, no filtering.
+  VkSamplerCreateInfo ci_sampler = {
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  ci_sampler.magFilter = VK_FILTER_NEAREST;
+  ci_sampler.minFilter = VK_FILTER_NEAREST;
+  ci_sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  ci_sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  ci_sampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  ci_sampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  ci_sampler.minLod = 0.f;
+  ci_sampler.maxLod = VK_LOD_CLAMP_NONE;
+  VK_CHECK(vkCreateSampler(m_device, &ci_sampler, nullptr, &m_depth_sampler));
+
+  VkPushConstantRange push_range = {};
+  push_range.offset = 0;
+  push_range.size = sizeof(DepthPyramidPushConstants);
+  push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkPipelineLayoutCreateInfo ci_layout = vkinit::pipelineLayoutCreateInfo();
+  ci_layout.pSetLayouts = &m_depth_pyramid_ds_layout;
+  ci_layout.setLayoutCount = 1;
+  ci_layout.pPushConstantRanges = &push_range;
+  ci_layout.pushConstantRangeCount = 1;
+  VK_CHECK(vkCreatePipelineLayout(m_device, &ci_layout, nullptr,
+                                  &m_depth_pyramid_pipeline_layout));
+  push_range.size = sizeof(CullPushConstants);
+  ci_layout.pSetLayouts = &m_cull_ds_layout;
+  VK_CHECK(vkCreatePipelineLayout(m_device, &ci_layout, nullptr,
+                                  &m_cull_pipeline_layout));
+  push_range.size = sizeof(ClusterPushConstants);
+  ci_layout.pSetLayouts = &m_cluster_ds_layout;
+  VK_CHECK(vkCreatePipelineLayout(m_device, &ci_layout, nullptr,
+                                  &m_cluster_pipeline_layout));
+
+  VkShaderModule pyramid_shader;
+  if (!vkutil::loadShaderModule("../../assets/shaders/depth_pyramid.comp.spv",
+                                m_device, &pyramid_shader)) {
+    fmt::println("Error building compute shader.");
+  }
+  VkShaderModule cull_shader;
+  if (!vkutil::loadShaderModule("../../assets/shaders/occlusion_cull.comp.spv",
+                                m_device, &cull_shader)) {
+    fmt::println("Error building compute shader.");
+  }
+  VkShaderModule cluster_shader;
+  if (!vkutil::loadShaderModule("../../assets/shaders/cluster_cull.comp.spv",
+                                m_device, &cluster_shader)) {
+    fmt::println("Error building compute shader.");
+  }
+  VkComputePipelineCreateInfo ci_pipeline = {};
+  ci_pipeline.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  ci_pipeline.pNext = nullptr;
+  ci_pipeline.layout = m_depth_pyramid_pipeline_layout;
+  ci_pipeline.stage = vkinit::pipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_COMPUTE_BIT, pyramid_shader);
+  VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &ci_pipeline,
+                                    nullptr, &m_depth_pyramid_pipeline));
+  ci_pipeline.layout = m_cull_pipeline_layout;
+  ci_pipeline.stage = vkinit::pipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_COMPUTE_BIT, cull_shader);
+  VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &ci_pipeline,
+                                    nullptr, &m_cull_pipeline));
+  ci_pipeline.layout = m_cluster_pipeline_layout;
+  ci_pipeline.stage = vkinit::pipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_COMPUTE_BIT, cluster_shader);
+  VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &ci_pipeline,
+                                    nullptr, &m_cluster_pipeline));
+  vkDestroyShaderModule(m_device, pyramid_shader, nullptr);
+  vkDestroyShaderModule(m_device, cull_shader, nullptr);
+  vkDestroyShaderModule(m_device, cluster_shader, nullptr);
+
+  m_main_deletion_queue.push([&]() {
+    vkDestroySampler(m_device, m_depth_sampler, nullptr);
+    vkDestroyPipelineLayout(m_device, m_depth_pyramid_pipeline_layout, nullptr);
+    vkDestroyPipeline(m_device, m_depth_pyramid_pipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_cull_pipeline_layout, nullptr);
+    vkDestroyPipeline(m_device, m_cull_pipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_cluster_pipeline_layout, nullptr);
+    vkDestroyPipeline(m_device, m_cluster_pipeline, nullptr);
+  });
+}
+void Engine::initDepthOnlyPipeline() {
+  VkShaderModule depth_shader_vert;
+  if (!vkutil::loadShaderModule("../../assets/shaders/depth_only.vert.spv",
+                                m_device, &depth_shader_vert)) {
+    fmt::println("Error loading vert shader.");
+  }
+  VkPushConstantRange buffer_range = {};
+  buffer_range.offset = 0;
+  buffer_range.size = sizeof(GPUDrawPushConstants);
+  buffer_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  VkPipelineLayoutCreateInfo ci_pipeline_layout =
+      vkinit::pipelineLayoutCreateInfo();
+  ci_pipeline_layout.pPushConstantRanges = &buffer_range;
+  ci_pipeline_layout.pushConstantRangeCount = 1;
+  ci_pipeline_layout.pSetLayouts = &m_GPU_scene_data_ds_layout;
+  ci_pipeline_layout.setLayoutCount = 1;
+  VK_CHECK(vkCreatePipelineLayout(m_device, &ci_pipeline_layout, nullptr,
+                                  &m_depth_only_pipeline_layout));
+  PipelineBuilder builder;
+  builder.pipeline_layout = m_depth_only_pipeline_layout;
+  builder.setVertexShader(depth_shader_vert);
+  builder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+  builder.setPolygonMode(VK_POLYGON_MODE_FILL);
+  builder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+  builder.setMultisamplingNone();
+  builder.disableBlending();
+  builder.enableDepthTest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
+  // No color attachment.
+  builder.setDepthFormat(m_depth_image.format);
+  m_depth_only_pipeline = builder.buildPipeline(m_device);
+
+  vkDestroyShaderModule(m_device, depth_shader_vert, nullptr);
+  m_main_deletion_queue.push([&]() {
+    vkDestroyPipelineLayout(m_device, m_depth_only_pipeline_layout, nullptr);
+    vkDestroyPipeline(m_device, m_depth_only_pipeline, nullptr);
+  });
+}
 void Engine::initSimpleMeshPipeline() {
   VkShaderModule mesh_shader_vert;
   VkShaderModule mesh_shader_frag;
@@ -829,7 +2450,6 @@ void Engine::initSimpleMeshPipeline() {
 }
 
 void Engine::immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&func) {
-  VK_CHECK(vkResetFences(m_device, 1, &m_imm_fence));
   VK_CHECK(vkResetCommandBuffer(m_imm_cmd, 0));
 
   VkCommandBuffer cmd = m_imm_cmd;
@@ -841,12 +2461,16 @@ void Engine::immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&func) {
 
   VK_CHECK(vkEndCommandBuffer(cmd));
   VkCommandBufferSubmitInfo cmd_info = vkinit::cmdBufferSubmitInfo(cmd);
-  VkSubmitInfo2 submit = vkinit::submitInfo(&cmd_info, nullptr, nullptr);
+  uint64_t value = m_graphics_timeline.next();
+  VkSemaphoreSubmitInfo signal_info = vkinit::semaphoreSubmitInfo(
+      VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_graphics_timeline.semaphore,
+      value);
+  VkSubmitInfo2 submit = vkinit::submitInfo(&cmd_info, &signal_info, nullptr);
 
   // Submit command buffer to the queue and execute it.
-  // imm_fence will now block until the graphic commands finish execution.
-  VK_CHECK(vkQueueSubmit2(m_graphic_queue, 1, &submit, m_imm_fence));
-  VK_CHECK(vkWaitForFences(m_device, 1, &m_imm_fence, true, VK_ONE_SEC));
+  // Block until the graphics timeline reaches this submit.
+  VK_CHECK(vkQueueSubmit2(m_graphic_queue, 1, &submit, VK_NULL_HANDLE));
+  m_graphics_timeline.wait(m_device, value);
 }
 
 void Engine::initImGui() {
@@ -919,7 +2543,8 @@ void Engine::drawImGui(VkCommandBuffer cmd, VkImageView target_img_view) {
 }
 AllocatedBuffer Engine::createBuffer(size_t alloc_size,
                                      VkBufferUsageFlags usage,
-                                     VmaMemoryUsage mem_usage) {
+                                     VmaMemoryUsage mem_usage,
+                                     MemoryClass mem_class) {
   VkBufferCreateInfo ci_buffer = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = nullptr,
@@ -928,58 +2553,138 @@ AllocatedBuffer Engine::createBuffer(size_t alloc_size,
   ci_buffer.usage = usage;
   VmaAllocationCreateInfo ci_alloc = {};
   ci_alloc.usage = mem_usage;
-  ci_alloc.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+  // Mapping GPU-only memory would force it host visible on some devices.
+  if (mem_usage != VMA_MEMORY_USAGE_GPU_ONLY)
+    ci_alloc.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+  ci_alloc.pool = poolFor(mem_class, alloc_size);
   AllocatedBuffer buffer;
-  VK_CHECK(vmaCreateBuffer(m_allocator, &ci_buffer, &ci_alloc, &buffer.buffer,
-                           &buffer.allocation, &buffer.alloc_info));
+  buffer.size = alloc_size;
+  VkResult result =
+      vmaCreateBuffer(m_allocator, &ci_buffer, &ci_alloc, &buffer.buffer,
+                      &buffer.allocation, &buffer.alloc_info);
+  if (result == VK_ERROR_FEATURE_NOT_PRESENT && ci_alloc.pool) {
+    // Memory type of the pool does not suit this buffer.
+    ci_alloc.pool = VK_NULL_HANDLE;
+    result = vmaCreateBuffer(m_allocator, &ci_buffer, &ci_alloc,
+                             &buffer.buffer, &buffer.allocation,
+                             &buffer.alloc_info);
+  }
+  VK_CHECK(result);
   return buffer;
 }
+VmaPool Engine::poolFor(MemoryClass mem_class, VkDeviceSize size) const {
+  VmaPool pool = m_pools[static_cast<size_t>(mem_class)];
+  if (pool == VK_NULL_HANDLE)
+    return pool;
+  // Larger ones would waste most of a block, VMA gives them their own.
+  switch (mem_class) {
+  case MemoryClass::Geometry:
+  case MemoryClass::Texture:
+    return size > kPoolBlockSize / 2 ? VK_NULL_HANDLE : pool;
+  case MemoryClass::Upload:
+    return size > kUploadBlockSize / 2 ? VK_NULL_HANDLE : pool;
+  default:
+    return pool;
+  }
+}
 void Engine::destroyBuffer(const AllocatedBuffer &buffer) {
   vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.allocation);
 }
 GPUMeshBuffers Engine::uploadMesh(std::span<uint32_t> indices,
-                                  std::span<Vertex> vertices) {
-  const size_t kVertexBufferSize = vertices.size() * sizeof(Vertex);
-  const size_t kIndexBufferSize = indices.size() * sizeof(uint32_t);
-
-  GPUMeshBuffers mesh;
-  mesh.vertex_buffer = createBuffer(
-      kVertexBufferSize,
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-      VMA_MEMORY_USAGE_GPU_ONLY);
+                                  std::span<Vertex> vertices,
+                                  std::span<Meshlet> meshlets) {
+  GPUMeshBuffers mesh = uploadMeshBuffers(indices, std::as_bytes(vertices), {},
+                                          std::as_bytes(meshlets));
+  mesh.vertex_layout = kVertexLayoutFull;
+  return mesh;
+}
+GPUMeshBuffers Engine::uploadMesh(std::span<uint32_t> indices,
+                                  std::span<CompactVertex> vertices,
+                                  std::span<uint32_t> colors,
+                                  std::span<Meshlet> meshlets) {
+  GPUMeshBuffers mesh =
+      uploadMeshBuffers(indices, std::as_bytes(vertices),
+                        std::as_bytes(colors), std::as_bytes(meshlets));
+  mesh.vertex_layout = kVertexLayoutCompact;
+  if (!colors.empty())
+    mesh.vertex_layout |= kVertexLayoutColor;
+  return mesh;
+}
+GPUMeshBuffers
+Engine::uploadMeshBuffers(std::span<uint32_t> indices,
+                          std::span<const std::byte> vertices,
+                          std::span<const std::byte> colors,
+                          std::span<const std::byte> meshlets) {
+  // 16-bit whenever every index fits, padded to whole words for shaders.
+  GPUMeshBuffers mesh = {};
+  bool index_16bit =
+      std::all_of(indices.begin(), indices.end(),
+                  [](uint32_t idx) { return idx <= UINT16_MAX; });
+  mesh.index_type = index_16bit ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+  const size_t kIndexBufferSize =
+      index_16bit ? (indices.size() * sizeof(uint16_t) + 3) & ~size_t(3)
+                  : indices.size() * sizeof(uint32_t);
+
   VkBufferDeviceAddressInfo i_device_address{
       .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-      .buffer = mesh.vertex_buffer.buffer,
   };
-  mesh.vertex_buffer_address =
+  // Shader storage read through device address, empty data gets no buffer.
+  auto createStorage = [&](size_t size, AllocatedBuffer &buffer,
+                           VkDeviceAddress &address) {
+    if (size == 0)
+      return;
+    buffer = createBuffer(size, kGeometryBufferUsage,
+                          VMA_MEMORY_USAGE_GPU_ONLY, MemoryClass::Geometry);
+    i_device_address.buffer = buffer.buffer;
+    address = vkGetBufferDeviceAddress(m_device, &i_device_address);
+  };
+  createStorage(vertices.size(), mesh.vertex_buffer,
+                mesh.vertex_buffer_address);
+  createStorage(colors.size(), mesh.color_buffer, mesh.color_buffer_address);
+  createStorage(meshlets.size(), mesh.meshlet_buffer,
+                mesh.meshlet_buffer_address);
+
+  // Also read by cluster culling.
+  mesh.index_buffer =
+      createBuffer(kIndexBufferSize, kGeometryBufferUsage,
+                   VMA_MEMORY_USAGE_GPU_ONLY, MemoryClass::Geometry);
+  i_device_address.buffer = mesh.index_buffer.buffer;
+  mesh.index_buffer_address =
       vkGetBufferDeviceAddress(m_device, &i_device_address);
 
-  mesh.index_buffer = createBuffer(kIndexBufferSize,
-                                   VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-                                       VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                   VMA_MEMORY_USAGE_GPU_ONLY);
-
   // Write data into a CPU-only staging buffer, then upload to GPU-only buffer.
-  AllocatedBuffer staging =
-      createBuffer(kVertexBufferSize + kIndexBufferSize,
-                   VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-  void *data = staging.allocation->GetMappedData();
-  memcpy(data, vertices.data(), kVertexBufferSize);
-  memcpy((char *)data + kVertexBufferSize, indices.data(), kIndexBufferSize);
+  AllocatedBuffer staging = createBuffer(
+      vertices.size() + colors.size() + meshlets.size() + kIndexBufferSize,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+      MemoryClass::Upload);
+  char *data = (char *)staging.allocation->GetMappedData();
+  std::vector<std::pair<VkBuffer, VkBufferCopy>> copies;
+  size_t offset = 0;
+  auto stage = [&](const void *src, size_t size, VkBuffer dst) {
+    if (size == 0)
+      return;
+    memcpy(data + offset, src, size);
+    VkBufferCopy copy = {};
+    copy.dstOffset = 0;
+    copy.srcOffset = offset;
+    copy.size = size;
+    copies.push_back({dst, copy});
+    offset += size;
+  };
+  stage(vertices.data(), vertices.size(), mesh.vertex_buffer.buffer);
+  stage(colors.data(), colors.size(), mesh.color_buffer.buffer);
+  stage(meshlets.data(), meshlets.size(), mesh.meshlet_buffer.buffer);
+  if (index_16bit) {
+    std::vector<uint16_t> indices_16bit(kIndexBufferSize / sizeof(uint16_t),
+                                        0);
+    std::copy(indices.begin(), indices.end(), indices_16bit.begin());
+    stage(indices_16bit.data(), kIndexBufferSize, mesh.index_buffer.buffer);
+  } else {
+    stage(indices.data(), kIndexBufferSize, mesh.index_buffer.buffer);
+  }
   immediateSubmit([&](VkCommandBuffer cmd) {
-    VkBufferCopy vertex_copy = {};
-    vertex_copy.dstOffset = 0;
-    vertex_copy.srcOffset = 0;
-    vertex_copy.size = kVertexBufferSize;
-    vkCmdCopyBuffer(cmd, staging.buffer, mesh.vertex_buffer.buffer, 1,
-                    &vertex_copy);
-    VkBufferCopy index_copy = {};
-    index_copy.dstOffset = 0;
-    index_copy.srcOffset = kVertexBufferSize;
-    index_copy.size = kIndexBufferSize;
-    vkCmdCopyBuffer(cmd, staging.buffer, mesh.index_buffer.buffer, 1,
-                    &index_copy);
+    for (auto &[dst, copy] : copies)
+      vkCmdCopyBuffer(cmd, staging.buffer, dst, 1, &copy);
   });
   destroyBuffer(staging);
   return mesh;
@@ -1090,37 +2795,91 @@ void Engine::initDefaultData() {
   //   m_loaded_nodes[m->name] = std::move(node);
   // }
 
-  std::string structurePath = {"../../assets/models/structure.glb"};
-  auto structureFile = loadGltf(this, structurePath);
-  assert(structureFile.has_value());
-  m_loaded_scenes["structure"] = *structureFile;
+  // Benchmarks load their own scene.
+  if (!benchmark_config.enabled)
+    m_scenes.requestScene("structure", "../../assets/models/structure.glb");
 }
 void Engine::resizeSwapchain() {
-  vkDeviceWaitIdle(m_device);
-  destroySwapchain();
   int w, h;
-  SDL_GetWindowSize(window, &w, &h);
-  createSwapchain(w, h);
+  SDL_GetWindowSizeInPixels(window, &w, &h);
+  if (w == 0 || h == 0)
+    return; // Minimized, retried until it has a size.
+  // Frames in flight may still use old objects. The last one finishes before
+  // its slot is reused, after the others.
+  DeletionQueue &last_frame_queue =
+      m_frames[(frame_number + kFrameOverlap - 1) % kFrameOverlap]
+          .deletion_queue;
+  VkSwapchainKHR old_swapchain = m_swapchain;
+  std::vector<VkImageView> old_views = m_swapchain_img_views;
+  createSwapchain(w, h, old_swapchain);
+  last_frame_queue.push([this, old_swapchain, old_views]() {
+    for (VkImageView view : old_views)
+      vkDestroyImageView(m_device, view, nullptr);
+    vkDestroySwapchainKHR(m_device, old_swapchain, nullptr);
+  });
+  window_extent = m_swapchain_extent;
+  // Draw extent is clamped to render targets, they only grow when the
+  // window outgrows them.
+  VkExtent3D target_extent = m_color_image.extent;
+  if (m_swapchain_extent.width > target_extent.width ||
+      m_swapchain_extent.height > target_extent.height) {
+    retireRenderTargets(last_frame_queue);
+    createRenderTargets(
+        {std::max(m_swapchain_extent.width, target_extent.width),
+         std::max(m_swapchain_extent.height, target_extent.height)});
+    writeRenderTargetSets();
+  }
   require_resize = false;
 }
 AllocatedImage Engine::createImage(VkExtent3D size, VkFormat format,
                                    VkImageUsageFlags usage, bool mipmap) {
+  uint32_t mip_levels = 1;
+  if (mipmap)
+    mip_levels = static_cast<uint32_t>(std::floor(
+                     std::log2(std::max(size.width, size.height)))) +
+                 1;
+  return createImage(size, format, usage, mip_levels);
+}
+AllocatedImage Engine::createImage(VkExtent3D size, VkFormat format,
+                                   VkImageUsageFlags usage,
+                                   uint32_t mip_levels) {
   AllocatedImage image;
+  VK_CHECK(allocateImage(size, format, usage, mip_levels, 0, image));
+  return image;
+}
+VkResult Engine::allocateImage(VkExtent3D size, VkFormat format,
+                               VkImageUsageFlags usage, uint32_t mip_levels,
+                               VmaAllocationCreateFlags flags,
+                               AllocatedImage &image) {
   image.format = format;
   image.extent = size;
   VkImageCreateInfo ci_image = vkinit::imageCreateInfo(format, usage, size);
-  if (mipmap)
-    ci_image.mipLevels = static_cast<uint32_t>(std::floor(
-                             std::log2(std::max(size.width, size.height)))) +
-                         1;
+  ci_image.mipLevels = mip_levels;
 
   VmaAllocationCreateInfo ci_alloc = {};
   ci_alloc.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  ci_alloc.flags = flags;
   ci_alloc.requiredFlags =
       // Double check the allocation is in VRAM.
       VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-  VK_CHECK(vmaCreateImage(m_allocator, &ci_image, &ci_alloc, &image.image,
-                          &image.allocation, nullptr));
+  // Written by the GPU or sampled only, they age differently.
+  constexpr VkImageUsageFlags kTargetUsage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+  MemoryClass mem_class = (usage & kTargetUsage) ? MemoryClass::RenderTarget
+                                                 : MemoryClass::Texture;
+  VkDeviceSize texels = VkDeviceSize(size.width) * size.height * size.depth;
+  ci_alloc.pool = poolFor(mem_class, texels * 4);
+  VkResult result = vmaCreateImage(m_allocator, &ci_image, &ci_alloc,
+                                   &image.image, &image.allocation, nullptr);
+  if (result == VK_ERROR_FEATURE_NOT_PRESENT && ci_alloc.pool) {
+    // Depth formats may need another memory type than the pool's.
+    ci_alloc.pool = VK_NULL_HANDLE;
+    result = vmaCreateImage(m_allocator, &ci_image, &ci_alloc, &image.image,
+                            &image.allocation, nullptr);
+  }
+  if (result != VK_SUCCESS)
+    return result;
   VkImageAspectFlags aspect_flags = format == VK_FORMAT_D32_SFLOAT
                                         ? VK_IMAGE_ASPECT_DEPTH_BIT
                                         : VK_IMAGE_ASPECT_COLOR_BIT;
@@ -1128,14 +2887,15 @@ AllocatedImage Engine::createImage(VkExtent3D size, VkFormat format,
       vkinit::imageViewCreateInfo(format, image.image, aspect_flags);
   ci_view.subresourceRange.levelCount = ci_image.mipLevels;
   VK_CHECK(vkCreateImageView(m_device, &ci_view, nullptr, &image.view));
-  return image;
+  return VK_SUCCESS;
 }
 AllocatedImage Engine::createImage(void *data, VkExtent3D size, VkFormat format,
                                    VkImageUsageFlags usage, bool mipmap) {
   // Assume R8G8B8A8 format.
   size_t data_size = size.depth * size.width * size.height * 4;
-  AllocatedBuffer upload = createBuffer(
-      data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+  AllocatedBuffer upload =
+      createBuffer(data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryClass::Upload);
   memcpy(upload.alloc_info.pMappedData, data, data_size);
 
   AllocatedImage new_image = createImage(
@@ -1175,10 +2935,76 @@ void Engine::destroyImage(const AllocatedImage &image) {
   vkDestroyImageView(m_device, image.view, nullptr);
   vmaDestroyImage(m_allocator, image.image, image.allocation);
 }
-void Engine::updateScene() {
-  m_main_camera.update();
-  m_main_draw_context.opaque_surfaces.clear();
-  m_main_draw_context.transparent_surfaces.clear();
+void Engine::updateMemoryBudget() {
+  // Budgets are refreshed by VMA once per frame index.
+  vmaSetCurrentFrameIndex(m_allocator, static_cast<uint32_t>(frame_number));
+  const VkPhysicalDeviceMemoryProperties *mem_props;
+  vmaGetMemoryProperties(m_allocator, &mem_props);
+  VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+  vmaGetHeapBudgets(m_allocator, budgets);
+  stats.heaps.resize(mem_props->memoryHeapCount);
+  // Fullest device local heap decides.
+  float ratio = 0.f;
+  VkDeviceSize usage = 0, budget = 0;
+  for (uint32_t i = 0; i < mem_props->memoryHeapCount; i++) {
+    HeapBudget &heap = stats.heaps[i];
+    heap.usage = budgets[i].usage;
+    heap.budget = budgets[i].budget;
+    heap.device_local =
+        mem_props->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+    float r = 1.f * heap.usage / std::max<VkDeviceSize>(heap.budget, 1);
+    if (heap.device_local && r >= ratio) {
+      ratio = r;
+      usage = heap.usage;
+      budget = heap.budget;
+    }
+  }
+  stats.memory_pressure = ratio > m_memory_critical ? MemoryPressure::Critical
+                          : ratio > m_memory_high   ? MemoryPressure::High
+                                                    : MemoryPressure::Normal;
+  // Streamed mips may grow until the heap reaches the high mark, and shrink
+  // when past it. Frees land kFrameOverlap frames later, so this lags a bit.
+  VkDeviceSize high = static_cast<VkDeviceSize>(m_memory_high * budget);
+  VkDeviceSize resident = m_texture_streamer.stats().resident_bytes;
+  m_texture_streamer.pressure_limit_bytes =
+      resident + high > usage ? resident + high - usage : 0;
+}
+bool Engine::hasMemoryFor(VkDeviceSize bytes) const {
+  if (stats.memory_pressure == MemoryPressure::Critical)
+    return false;
+  for (const HeapBudget &heap : stats.heaps) {
+    VkDeviceSize limit =
+        static_cast<VkDeviceSize>(m_memory_critical * heap.budget);
+    if (heap.device_local && heap.usage + bytes > limit)
+      return false;
+  }
+  return true;
+}
+void Engine::updateScene(const SceneInputs &inputs, FrameSnapshot &snapshot) {
+  auto start = std::chrono::steady_clock::now();
+  GPUSceneData &scene_data = snapshot.scene_data;
+  DrawContext &context = snapshot.draw_context;
+  context.opaque_surfaces.clear();
+  context.transparent_surfaces.clear();
+
+  scene_data.view = inputs.view;
+  scene_data.proj =
+      glm::perspective(glm::radians(70.f), inputs.aspect, 0.1f, 10000.f);
+  scene_data.proj[1][1] *= -1;
+  scene_data.view_proj = scene_data.proj * scene_data.view;
+  scene_data.ambient_color = glm::vec4(.1f);
+  scene_data.sunlight_color = glm::vec4(1.f);
+  scene_data.sunlight_dir = glm::vec4(0, 1, 0.5, 1.f);
+
+  context.camera_position = inputs.camera_position;
+  // Half of the rendered height spans tan(fov / 2) at distance 1.
+  context.lod_pixels_per_unit =
+      inputs.use_lod
+          ? 0.5f * inputs.draw_height * std::abs(scene_data.proj[1][1])
+          : 0.f;
+  context.lod_max_error_pixels = inputs.lod_max_error_pixels;
+  context.n_triangles_full = 0;
+  context.n_triangles_selected = 0;
 
   // m_loaded_nodes["Suzanne"]->draw(glm::mat4{1.f}, m_main_draw_context);
   // for (int x = -3; x < 3; x++) {
@@ -1186,17 +3012,62 @@ void Engine::updateScene() {
   //   glm::mat4 translation = glm::translate(glm::vec3{x + 0.5, 1, 0});
   //   m_loaded_nodes["Cube"]->draw(translation * scale, m_main_draw_context);
   // }
-  m_loaded_scenes["structure"]->draw(glm::mat4{1.f}, m_main_draw_context);
-
-  m_scene_data.view = m_main_camera.getViewMatrix();
-  m_scene_data.proj = glm::perspective(
-      glm::radians(70.f), 1.f * window_extent.width / window_extent.height,
-      0.1f, 10000.f);
-  m_scene_data.proj[1][1] *= -1;
-  m_scene_data.view_proj = m_scene_data.proj * m_scene_data.view;
-  m_scene_data.ambient_color = glm::vec4(.1f);
-  m_scene_data.sunlight_color = glm::vec4(1.f);
-  m_scene_data.sunlight_dir = glm::vec4(0, 1, 0.5, 1.f);
+  for (auto &[name, scene] : m_loaded_scenes)
+    scene->draw(glm::mat4{1.f}, context);
+
+  // Visibility culling, in parallel then compacted in order.
+  std::vector<RenderObject> &opaque = context.opaque_surfaces;
+  std::vector<uint8_t> visible(opaque.size());
+  m_jobs.parallelFor("frustum cull", opaque.size(), 1024,
+                     [&](size_t begin, size_t end) {
+                       for (size_t i = begin; i < end; i++)
+                         visible[i] =
+                             isVisible(opaque[i], scene_data.view_proj);
+                     });
+  snapshot.visible_opaque.clear();
+  for (size_t i = 0; i < opaque.size(); i++) {
+    if (visible[i])
+      snapshot.visible_opaque.push_back(i);
+  }
+  snapshot.update_ms = std::chrono::duration<float, std::milli>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+}
+void Engine::kickSceneUpdate(bool advance_camera) {
+  // Camera and settings belong to the main thread, copied for the job.
+  if (advance_camera)
+    m_main_camera.update();
+  SceneInputs inputs;
+  inputs.view = m_main_camera.getViewMatrix();
+  inputs.camera_position = m_main_camera.position;
+  inputs.aspect = 1.f * window_extent.width / window_extent.height;
+  inputs.draw_height = window_extent.height * m_render_scale;
+  inputs.use_lod = m_use_lod;
+  inputs.lod_max_error_pixels = m_lod_max_error_pixels;
+  // Coarser LODs shrink the per frame culling buffers grown on demand.
+  if (stats.memory_pressure != MemoryPressure::Normal) {
+    inputs.use_lod = true;
+    inputs.lod_max_error_pixels *=
+        stats.memory_pressure == MemoryPressure::Critical ? 4.f : 2.f;
+  }
+  // Workers only, this thread waiting on draw jobs must not pick it up and
+  // serialize it with recording.
+  m_jobs.runOn(
+      m_update_queue, "scene update",
+      [this, inputs]() { updateScene(inputs, m_update_snapshot); },
+      &m_update_done);
+}
+void Engine::acquireSnapshot() {
+  // Update time not hidden behind recording.
+  stats.t_update_wait.begin();
+  m_jobs.wait(m_update_done);
+  stats.t_update_wait.end();
+  std::swap(m_scene_data, m_update_snapshot.scene_data);
+  std::swap(m_main_draw_context, m_update_snapshot.draw_context);
+  std::swap(m_visible_opaque, m_update_snapshot.visible_opaque);
+  stats.t_scene_update.period_ms = m_update_snapshot.update_ms;
+  stats.n_lod_triangles_full = m_main_draw_context.n_triangles_full;
+  stats.n_lod_triangles = m_main_draw_context.n_triangles_selected;
 }
 void GLTFMetallicRoughness::buildPipelines(Engine *engine) {
   VkShaderModule mesh_frag_shader;
@@ -1204,6 +3075,11 @@ void GLTFMetallicRoughness::buildPipelines(Engine *engine) {
                                 engine->m_device, &mesh_frag_shader)) {
     fmt::println("Error when building the triangle fragment shader module");
   }
+  VkShaderModule clustered_frag_shader;
+  if (!vkutil::loadShaderModule("../../assets/shaders/mesh_clustered.frag.spv",
+                                engine->m_device, &clustered_frag_shader)) {
+    fmt::println("Error when building the clustered fragment shader module");
+  }
   VkShaderModule mesh_vert_shader;
   if (!vkutil::loadShaderModule("../../assets/shaders/mesh.vert.spv",
                                 engine->m_device, &mesh_vert_shader)) {
@@ -1237,6 +3113,10 @@ void GLTFMetallicRoughness::buildPipelines(Engine *engine) {
   // Same layout but different configure.
   pipeline_opaque.layout = layout;
   pipeline_transparent.layout = layout;
+  pipeline_opaque_prepassed.layout = layout;
+  pipeline_opaque_clustered.layout = layout;
+  pipeline_transparent_clustered.layout = layout;
+  pipeline_opaque_prepassed_clustered.layout = layout;
 
   PipelineBuilder pipeline_builder;
   pipeline_builder.setShaders(mesh_vert_shader, mesh_frag_shader);
@@ -1250,12 +3130,29 @@ void GLTFMetallicRoughness::buildPipelines(Engine *engine) {
   pipeline_builder.setDepthFormat(engine->m_depth_image.format);
   pipeline_builder.pipeline_layout = layout;
   pipeline_opaque.pipeline = pipeline_builder.buildPipeline(engine->m_device);
+  pipeline_builder.enableDepthTest(false, VK_COMPARE_OP_LESS_OR_EQUAL);
+  pipeline_opaque_prepassed.pipeline =
+      pipeline_builder.buildPipeline(engine->m_device);
   pipeline_builder.enableBlendingAdd();
   pipeline_builder.enableDepthTest(false, VK_COMPARE_OP_LESS_OR_EQUAL);
   pipeline_transparent.pipeline =
       pipeline_builder.buildPipeline(engine->m_device);
 
+  pipeline_builder.setShaders(mesh_vert_shader, clustered_frag_shader);
+  pipeline_builder.disableBlending();
+  pipeline_builder.enableDepthTest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
+  pipeline_opaque_clustered.pipeline =
+      pipeline_builder.buildPipeline(engine->m_device);
+  pipeline_builder.enableDepthTest(false, VK_COMPARE_OP_LESS_OR_EQUAL);
+  pipeline_opaque_prepassed_clustered.pipeline =
+      pipeline_builder.buildPipeline(engine->m_device);
+  pipeline_builder.enableBlendingAdd();
+  pipeline_builder.enableDepthTest(false, VK_COMPARE_OP_LESS_OR_EQUAL);
+  pipeline_transparent_clustered.pipeline =
+      pipeline_builder.buildPipeline(engine->m_device);
+
   vkDestroyShaderModule(engine->m_device, mesh_frag_shader, nullptr);
+  vkDestroyShaderModule(engine->m_device, clustered_frag_shader, nullptr);
   vkDestroyShaderModule(engine->m_device, mesh_vert_shader, nullptr);
 }
 void GLTFMetallicRoughness::clearResources(VkDevice device) {
@@ -1264,6 +3161,24 @@ void GLTFMetallicRoughness::clearResources(VkDevice device) {
   vkDestroyPipelineLayout(device, pipeline_transparent.layout, nullptr);
   vkDestroyPipeline(device, pipeline_opaque.pipeline, nullptr);
   vkDestroyPipeline(device, pipeline_transparent.pipeline, nullptr);
+  vkDestroyPipeline(device, pipeline_opaque_prepassed.pipeline, nullptr);
+  vkDestroyPipeline(device, pipeline_opaque_clustered.pipeline, nullptr);
+  vkDestroyPipeline(device, pipeline_transparent_clustered.pipeline, nullptr);
+  vkDestroyPipeline(device, pipeline_opaque_prepassed_clustered.pipeline,
+                    nullptr);
+}
+MaterialPipeline *GLTFMetallicRoughness::variant(MaterialPipeline *base,
+                                                 bool prepassed,
+                                                 bool clustered) {
+  if (base == &pipeline_opaque) {
+    if (prepassed)
+      return clustered ? &pipeline_opaque_prepassed_clustered
+                       : &pipeline_opaque_prepassed;
+    return clustered ? &pipeline_opaque_clustered : &pipeline_opaque;
+  }
+  if (base == &pipeline_transparent && clustered)
+    return &pipeline_transparent_clustered;
+  return base;
 }
 
 MaterialInstance
@@ -1286,7 +3201,11 @@ GLTFMetallicRoughness::writeMaterial(VkDevice device, MaterialPass pass,
   }
 
   mat_data.ds = d_allocator.allocate(device, ds_layout);
-
+  writeMaterialSet(device, mat_data.ds, resources);
+  return mat_data;
+}
+void GLTFMetallicRoughness::writeMaterialSet(
+    VkDevice device, VkDescriptorSet ds, const MaterialResources &resources) {
   writer.clear();
   writer.writeBuffer(0, resources.data_buffer, sizeof(MaterialConstants),
                      resources.data_buffer_offset,
@@ -1298,7 +3217,5 @@ GLTFMetallicRoughness::writeMaterial(VkDevice device, MaterialPass pass,
                     resources.metal_rough_sampler,
                     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
                     VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-  writer.updateDescriptorSet(device, mat_data.ds);
-
-  return mat_data;
+  writer.updateDescriptorSet(device, ds);
 }
@@ -0,0 +1,260 @@
+#include "frame_capture.h"
+
+#include "engine.h"
+#include "vk_images.h"
+#include "vk_initializers.h"
+#include "vk_pipelines.h"
+
+#include <algorithm>
+
+// Last, it routes vkCmd* calls below through the counters.
+#include "vk_call_stats.h"
+
+static_assert(FrameCapture::kSlots == kFrameOverlap + 2);
+
+struct ReadbackPushConstants {
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t padding;
+  glm::vec2 uv_scale; // Output pixel to input texture coordinates.
+};
+
+void FrameCapture::init(Engine *engine) {
+  m_engine = engine;
+  VkDevice device = engine->m_device;
+  {
+    DescriptorLayoutBuilder builder;
+    builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER); // Input.
+    builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);         // Output.
+    m_ds_layout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+  VkPushConstantRange push_range = {};
+  push_range.offset = 0;
+  push_range.size = sizeof(ReadbackPushConstants);
+  push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkPipelineLayoutCreateInfo ci_layout = vkinit::pipelineLayoutCreateInfo();
+  ci_layout.pSetLayouts = &m_ds_layout;
+  ci_layout.setLayoutCount = 1;
+  ci_layout.pPushConstantRanges = &push_range;
+  ci_layout.pushConstantRangeCount = 1;
+  VK_CHECK(
+      vkCreatePipelineLayout(device, &ci_layout, nullptr, &m_pipeline_layout));
+
+  VkShaderModule readback_shader;
+  if (!vkutil::loadShaderModule("../../assets/shaders/readback.comp.spv",
+                                device, &readback_shader)) {
+    fmt::println("Error building compute shader.");
+  }
+  VkComputePipelineCreateInfo ci_pipeline = {};
+  ci_pipeline.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  ci_pipeline.pNext = nullptr;
+  ci_pipeline.layout = m_pipeline_layout;
+  ci_pipeline.stage = vkinit::pipelineShaderStageCreateInfo(
+      VK_SHADER_STAGE_COMPUTE_BIT, readback_shader);
+  VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &ci_pipeline,
+                                    nullptr, &m_pipeline));
+  vkDestroyShaderModule(device, readback_shader, nullptr);
+
+  // Clamped, so scaling does not blend in the opposite edge.
+  VkSamplerCreateInfo ci_sampler = {
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  ci_sampler.magFilter = VK_FILTER_LINEAR;
+  ci_sampler.minFilter = VK_FILTER_LINEAR;
+  ci_sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  ci_sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  ci_sampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  ci_sampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  VK_CHECK(vkCreateSampler(device, &ci_sampler, nullptr, &m_sampler));
+
+  m_quit = false;
+  m_thread = std::thread([this]() { deliverLoop(); });
+}
+void FrameCapture::destroy() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  if (m_thread.joinable())
+    m_thread.join();
+  m_ready.clear();
+  m_capturing = false;
+  m_callback.reset();
+  for (Slot &slot : m_slots) {
+    if (slot.capacity > 0)
+      m_engine->destroyBuffer(slot.buffer);
+    slot = Slot{};
+  }
+  VkDevice device = m_engine->m_device;
+  vkDestroySampler(device, m_sampler, nullptr);
+  vkDestroyPipeline(device, m_pipeline, nullptr);
+  vkDestroyPipelineLayout(device, m_pipeline_layout, nullptr);
+  vkDestroyDescriptorSetLayout(device, m_ds_layout, nullptr);
+}
+
+void FrameCapture::start(CaptureFormat format, CaptureCallback &&callback) {
+  m_format = format;
+  m_callback = std::make_shared<CaptureCallback>(std::move(callback));
+  m_capturing = true;
+}
+void FrameCapture::stop() {
+  m_capturing = false;
+  // Slots recorded keep their own reference.
+  m_callback.reset();
+}
+
+void FrameCapture::record(VkCommandBuffer cmd, const AllocatedImage &image,
+                          VkExtent2D extent, VkExtent2D output) {
+  if (!m_capturing || extent.width == 0 || extent.height == 0)
+    return;
+  // Scale of the unrounded output, rounding crops rather than stretches.
+  glm::vec2 uv_scale =
+      glm::vec2(extent.width, extent.height) /
+      (glm::vec2(output.width, output.height) *
+       glm::vec2(image.extent.width, image.extent.height));
+  // One invocation converts 4x2 pixels.
+  output.width &= ~3u;
+  output.height &= ~1u;
+  if (output.width == 0 || output.height == 0)
+    return;
+  size_t n_pixels = size_t(output.width) * output.height;
+  size_t size =
+      m_format == CaptureFormat::NV12 ? n_pixels * 3 / 2 : n_pixels * 4;
+
+  Slot *slot = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (Slot &s : m_slots) {
+      if (s.state == SlotState::Free) {
+        slot = &s;
+        break;
+      }
+    }
+    // Consumer is behind, dropping keeps draw() from waiting on it.
+    if (!slot) {
+      m_stats.n_dropped++;
+      return;
+    }
+  }
+  // Free slots are neither used on GPU nor read by the capture thread.
+  if (slot->capacity < size) {
+    if (slot->capacity > 0)
+      m_engine->destroyBuffer(slot->buffer);
+    slot->buffer = m_engine->createBuffer(
+        size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+    slot->capacity = size;
+  }
+  slot->size = size;
+  slot->extent = output;
+  slot->format = m_format;
+  slot->frame = static_cast<uint64_t>(m_engine->frame_number);
+  slot->callback = m_callback;
+
+  VkDescriptorSet ds = m_engine->getCurrentFrame().frame_descriptors.allocate(
+      m_engine->m_device, m_ds_layout);
+  DescriptorWriter writer;
+  writer.writeImage(0, image.view, m_sampler, VK_IMAGE_LAYOUT_GENERAL,
+                    VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+  writer.writeBuffer(1, slot->buffer.buffer, size, 0,
+                     VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  writer.updateDescriptorSet(m_engine->m_device, ds);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_pipeline_layout, 0, 1, &ds, 0, nullptr);
+  ReadbackPushConstants push_const;
+  push_const.width = output.width;
+  push_const.height = output.height;
+  push_const.format = static_cast<uint32_t>(m_format);
+  push_const.padding = 0;
+  push_const.uv_scale = uv_scale;
+  vkCmdPushConstants(cmd, m_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(ReadbackPushConstants), &push_const);
+  // 8x8 invocations of 4x2 pixels each.
+  vkCmdDispatch(cmd, (output.width + 31) / 32, (output.height + 15) / 16, 1);
+  // Host reads after the timeline value, still needs the writes visible.
+  vkutil::memoryBarrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_HOST_BIT,
+                        VK_ACCESS_2_HOST_READ_BIT);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  slot->state = SlotState::Recorded;
+}
+void FrameCapture::submitted(uint64_t timeline_value) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (Slot &slot : m_slots) {
+    if (slot.state != SlotState::Recorded)
+      continue;
+    slot.timeline_value = timeline_value;
+    slot.state = SlotState::InFlight;
+  }
+}
+void FrameCapture::poll() {
+  std::array<uint32_t, kSlots> finished;
+  uint32_t n_finished = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint32_t i = 0; i < kSlots; i++) {
+      Slot &slot = m_slots[i];
+      if (slot.state == SlotState::InFlight &&
+          m_engine->m_graphics_timeline.reached(m_engine->m_device,
+                                                slot.timeline_value))
+        finished[n_finished++] = i;
+    }
+  }
+  if (n_finished == 0)
+    return;
+  std::sort(finished.begin(), finished.begin() + n_finished,
+            [&](uint32_t a, uint32_t b) {
+              return m_slots[a].frame < m_slots[b].frame;
+            });
+  for (uint32_t i = 0; i < n_finished; i++)
+    vmaInvalidateAllocation(m_engine->m_allocator,
+                            m_slots[finished[i]].buffer.allocation, 0,
+                            m_slots[finished[i]].size);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint32_t i = 0; i < n_finished; i++) {
+      m_slots[finished[i]].state = SlotState::Delivering;
+      m_ready.push_back(finished[i]);
+    }
+  }
+  m_wake.notify_one();
+}
+
+FrameCaptureStats FrameCapture::stats() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+void FrameCapture::deliverLoop() {
+  while (true) {
+    uint32_t index;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this]() { return m_quit || !m_ready.empty(); });
+      if (m_quit)
+        return;
+      index = m_ready.front();
+      m_ready.pop_front();
+    }
+    Slot &slot = m_slots[index];
+    // Read in place from mapped memory, the slot is not reused meanwhile.
+    CapturedFrame frame;
+    frame.frame = slot.frame;
+    frame.extent = slot.extent;
+    frame.format = slot.format;
+    frame.data = std::span<const uint8_t>(
+        static_cast<const uint8_t *>(slot.buffer.alloc_info.pMappedData),
+        slot.size);
+    (*slot.callback)(frame);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    slot.callback.reset();
+    slot.state = SlotState::Free;
+    m_stats.n_delivered++;
+    m_stats.delivered_bytes += slot.size;
+  }
+}
@@ -0,0 +1,243 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace {
+thread_local uint32_t tl_thread_index = 0;
+// Deque jobs pushed from this thread go to, see execute().
+thread_local uint32_t tl_push_queue = 0;
+}
+
+void JobSystem::init(uint32_t n_workers, uint32_t n_background,
+                     bool pin_threads) {
+  m_start = std::chrono::steady_clock::now();
+  m_quit = false;
+  m_n_threads = n_workers + 1;
+  m_n_registered = 0;
+  for (uint32_t i = 0; i < m_n_threads + n_background; i++)
+    m_queues.push_back(std::make_unique<Queue>());
+  tl_thread_index = tl_push_queue = 0;
+  if (pin_threads)
+    pinThread(0);
+  for (uint32_t i = 1; i <= n_workers; i++) {
+    m_workers.emplace_back([this, i, pin_threads]() {
+      tl_thread_index = tl_push_queue = i;
+      if (pin_threads)
+        pinThread(i);
+      workerLoop(i);
+    });
+  }
+}
+void JobSystem::destroy() {
+  {
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  for (std::thread &worker : m_workers)
+    worker.join();
+  m_workers.clear();
+  m_queues.clear();
+  m_n_threads = 0;
+}
+bool JobSystem::registerThread() {
+  uint32_t queue = m_n_threads + m_n_registered.fetch_add(1);
+  if (queue >= m_queues.size())
+    return false;
+  tl_thread_index = tl_push_queue = queue;
+  return true;
+}
+uint32_t JobSystem::reserveQueue() {
+  // Nobody else would run it.
+  if (m_workers.empty())
+    return tl_push_queue;
+  uint32_t queue = m_n_threads + m_n_registered.fetch_add(1);
+  return queue < m_queues.size() ? queue : tl_push_queue;
+}
+uint32_t JobSystem::threadIndex() { return tl_thread_index; }
+
+void JobSystem::run(const char *name, std::function<void()> job,
+                    JobCounter *counter) {
+  if (counter)
+    counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+  push(Job{name, std::move(job), counter}, tl_push_queue);
+}
+void JobSystem::runOn(uint32_t queue, const char *name,
+                      std::function<void()> job, JobCounter *counter) {
+  if (counter)
+    counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+  push(Job{name, std::move(job), counter}, queue);
+}
+void JobSystem::runAfter(JobCounter &dependency, const char *name,
+                         std::function<void()> job, JobCounter *counter) {
+  if (counter)
+    counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+  // Checked under the lock finish() takes before draining continuations.
+  std::unique_lock<std::mutex> lock(dependency.m_mutex);
+  if (dependency.m_pending.load(std::memory_order_acquire) > 0) {
+    dependency.m_continuations.push_back(
+        [this, name, job = std::move(job), counter]() mutable {
+          push(Job{name, std::move(job), counter}, tl_push_queue);
+        });
+    return;
+  }
+  lock.unlock();
+  push(Job{name, std::move(job), counter}, tl_push_queue);
+}
+void JobSystem::wait(JobCounter &counter) {
+  uint32_t thread = threadIndex();
+  while (!counter.done()) {
+    if (!tryRunOne(thread))
+      std::this_thread::yield();
+  }
+  // Last finish() may still hold the lock, counter can be gone after return.
+  std::lock_guard<std::mutex> lock(counter.m_mutex);
+}
+void JobSystem::parallelFor(const char *name, size_t n, size_t chunk,
+                            const std::function<void(size_t, size_t)> &task) {
+  chunk = std::max<size_t>(chunk, 1);
+  if (n <= chunk || m_workers.empty()) {
+    if (n > 0)
+      task(0, n);
+    return;
+  }
+  JobCounter counter;
+  for (size_t begin = 0; begin < n; begin += chunk) {
+    size_t end = std::min(begin + chunk, n);
+    run(name, [&task, begin, end]() { task(begin, end); }, &counter);
+  }
+  wait(counter);
+}
+std::vector<JobProfile> JobSystem::takeProfile() {
+  std::vector<JobProfile> result;
+  for (auto &queue : m_queues) {
+    std::lock_guard<std::mutex> lock(queue->profile_mutex);
+    result.insert(result.end(), queue->profile.begin(), queue->profile.end());
+    queue->profile.clear();
+  }
+  return result;
+}
+
+void JobSystem::push(Job &&job, uint32_t queue) {
+  Queue &target = *m_queues[queue];
+  // Counted first, so it never falls below the jobs in deques.
+  m_n_queued.fetch_add(1, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> lock(target.mutex);
+    target.jobs.push_back(std::move(job));
+  }
+  // Lock pairs with the predicate check of sleeping workers.
+  { std::lock_guard<std::mutex> lock(m_sleep_mutex); }
+  m_wake.notify_one();
+}
+bool JobSystem::tryRunOne(uint32_t thread) {
+  if (m_n_queued.load(std::memory_order_acquire) == 0)
+    return false;
+  Job job;
+  uint32_t from = thread;
+  bool found = false;
+  {
+    // Own deque from the back, newest first and still in cache.
+    Queue &own = *m_queues[thread];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.jobs.empty()) {
+      job = std::move(own.jobs.back());
+      own.jobs.pop_back();
+      found = true;
+    }
+  }
+  // Steal the oldest job of another thread, likely the largest. Workers try
+  // frame deques before background ones, the main thread only frame deques
+  // and background threads none.
+  uint32_t n_victims = thread == 0 ? m_n_threads
+                                   : static_cast<uint32_t>(m_queues.size());
+  if (thread >= m_n_threads)
+    n_victims = 0;
+  for (uint32_t i = 1; !found && i < n_victims; i++) {
+    from = i < m_n_threads ? (thread + i) % m_n_threads : i;
+    Queue &victim = *m_queues[from];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.jobs.empty()) {
+      job = std::move(victim.jobs.front());
+      victim.jobs.pop_front();
+      found = true;
+    }
+  }
+  if (!found)
+    return false;
+  m_n_queued.fetch_sub(1, std::memory_order_relaxed);
+  execute(job, thread, from);
+  return true;
+}
+void JobSystem::execute(Job &job, uint32_t thread, uint32_t queue) {
+  // Jobs pushed by a background job, or its continuations, stay background
+  // wherever it runs.
+  uint32_t push_queue = tl_push_queue;
+  tl_push_queue = queue >= m_n_threads ? queue : thread;
+  if (!m_profiling) {
+    job.function();
+    finish(job.counter);
+    tl_push_queue = push_queue;
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  job.function();
+  auto end = std::chrono::steady_clock::now();
+  JobProfile profile;
+  profile.name = job.name;
+  profile.thread = thread;
+  profile.start_ms =
+      std::chrono::duration<float, std::milli>(start - m_start).count();
+  profile.duration_ms =
+      std::chrono::duration<float, std::milli>(end - start).count();
+  {
+    Queue &own = *m_queues[thread];
+    std::lock_guard<std::mutex> lock(own.profile_mutex);
+    own.profile.push_back(profile);
+  }
+  finish(job.counter);
+  tl_push_queue = push_queue;
+}
+void JobSystem::finish(JobCounter *counter) {
+  if (!counter)
+    return;
+  std::vector<std::function<void()>> continuations;
+  {
+    // Counter is not touched after unlock, see wait().
+    std::lock_guard<std::mutex> lock(counter->m_mutex);
+    if (counter->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      continuations.swap(counter->m_continuations);
+  }
+  for (auto &continuation : continuations)
+    continuation();
+}
+void JobSystem::workerLoop(uint32_t thread) {
+  while (!m_quit) {
+    if (tryRunOne(thread))
+      continue;
+    std::unique_lock<std::mutex> lock(m_sleep_mutex);
+    m_wake.wait(lock, [this]() {
+      return m_quit || m_n_queued.load(std::memory_order_acquire) > 0;
+    });
+  }
+}
+void JobSystem::pinThread(uint32_t core) {
+  uint32_t n_cores = std::max(1u, std::thread::hardware_concurrency());
+  core %= n_cores;
+#ifdef _WIN32
+  SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core);
+#else
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
@@ -0,0 +1,609 @@
+#include "mesh_processing.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+namespace {
+/// @brief Symmetric 4x4 of plane equations, weighted by area.
+struct Quadric {
+  float a2, b2, c2, d2;
+  float ab, ac, ad, bc, bd, cd;
+  float w;
+};
+Quadric planeQuadric(glm::vec3 n, float d, float w) {
+  Quadric q;
+  q.a2 = w * n.x * n.x;
+  q.b2 = w * n.y * n.y;
+  q.c2 = w * n.z * n.z;
+  q.d2 = w * d * d;
+  q.ab = w * n.x * n.y;
+  q.ac = w * n.x * n.z;
+  q.ad = w * n.x * d;
+  q.bc = w * n.y * n.z;
+  q.bd = w * n.y * d;
+  q.cd = w * n.z * d;
+  q.w = w;
+  return q;
+}
+void quadricAdd(Quadric &q, const Quadric &o) {
+  q.a2 += o.a2;
+  q.b2 += o.b2;
+  q.c2 += o.c2;
+  q.d2 += o.d2;
+  q.ab += o.ab;
+  q.ac += o.ac;
+  q.ad += o.ad;
+  q.bc += o.bc;
+  q.bd += o.bd;
+  q.cd += o.cd;
+  q.w += o.w;
+}
+/// @brief Mean squared distance to the planes.
+float quadricError(const Quadric &q, glm::vec3 v) {
+  float r = q.a2 * v.x * v.x + q.b2 * v.y * v.y + q.c2 * v.z * v.z + q.d2;
+  r += 2.f * (q.ab * v.x * v.y + q.ac * v.x * v.z + q.bc * v.y * v.z);
+  r += 2.f * (q.ad * v.x + q.bd * v.y + q.cd * v.z);
+  return std::abs(r) / std::max(q.w, 1e-12f);
+}
+
+struct PositionHash {
+  size_t operator()(const glm::vec3 &p) const {
+    uint32_t h[3];
+    std::memcpy(h, &p, sizeof(h));
+    return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+  }
+};
+
+struct Collapse {
+  uint32_t src;
+  uint32_t dst;
+  float error;
+};
+} // namespace
+
+std::vector<uint32_t> meshutil::simplify(std::span<const uint32_t> indices,
+                                         std::span<const Vertex> vertices,
+                                         size_t target_index_count,
+                                         float target_error,
+                                         float *result_error) {
+  std::vector<uint32_t> result(indices.begin(), indices.end());
+  if (result_error)
+    *result_error = 0.f;
+  if (indices.size() <= target_index_count)
+    return result;
+  size_t n_vertices = vertices.size();
+
+  // Vertices sharing a position collapse together, first one stands for all.
+  std::vector<uint32_t> canonical(n_vertices, UINT32_MAX);
+  std::vector<uint32_t> n_wedges(n_vertices, 0);
+  {
+    std::unordered_map<glm::vec3, uint32_t, PositionHash> first_at;
+    for (uint32_t idx : indices) {
+      if (canonical[idx] != UINT32_MAX)
+        continue;
+      auto it = first_at.try_emplace(vertices[idx].position, idx).first;
+      canonical[idx] = it->second;
+      n_wedges[it->second] += 1;
+    }
+  }
+  // Attribute seams and borders stay where they are.
+  std::vector<bool> locked(n_vertices, false);
+  for (uint32_t idx : indices)
+    if (n_wedges[canonical[idx]] > 1)
+      locked[canonical[idx]] = true;
+  {
+    std::unordered_map<uint64_t, uint32_t> edge_count;
+    for (size_t t = 0; t < indices.size(); t += 3) {
+      for (int e = 0; e < 3; e++) {
+        uint32_t a = canonical[indices[t + e]];
+        uint32_t b = canonical[indices[t + (e + 1) % 3]];
+        uint64_t key = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+        edge_count[key] += 1;
+      }
+    }
+    for (auto &[key, count] : edge_count) {
+      if (count == 1) {
+        locked[key >> 32] = true;
+        locked[key & 0xffffffffu] = true;
+      }
+    }
+  }
+
+  glm::vec3 min_pos = vertices[indices[0]].position;
+  glm::vec3 max_pos = min_pos;
+  for (uint32_t idx : indices) {
+    min_pos = glm::min(min_pos, vertices[idx].position);
+    max_pos = glm::max(max_pos, vertices[idx].position);
+  }
+  float extent = std::max(glm::length(max_pos - min_pos), 1e-12f);
+  float max_error_sq = (target_error * extent) * (target_error * extent);
+
+  std::vector<Quadric> quadrics(n_vertices, Quadric{});
+  for (size_t t = 0; t < indices.size(); t += 3) {
+    glm::vec3 p0 = vertices[indices[t + 0]].position;
+    glm::vec3 p1 = vertices[indices[t + 1]].position;
+    glm::vec3 p2 = vertices[indices[t + 2]].position;
+    glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+    float area = glm::length(n);
+    if (area == 0.f)
+      continue;
+    n /= area;
+    Quadric q = planeQuadric(n, -glm::dot(n, p0), 0.5f * area);
+    for (int k = 0; k < 3; k++)
+      quadricAdd(quadrics[canonical[indices[t + k]]], q);
+  }
+
+  float reached_error_sq = 0.f;
+  std::vector<Collapse> collapses;
+  std::vector<uint32_t> collapse_to(n_vertices);
+  std::vector<bool> touched(n_vertices);
+  std::vector<uint32_t> adjacency_offset(n_vertices + 1);
+  std::vector<uint32_t> adjacency;
+  while (result.size() > target_index_count) {
+    // Candidates, each edge once as its lower-index half.
+    collapses.clear();
+    for (size_t t = 0; t < result.size(); t += 3) {
+      for (int e = 0; e < 3; e++) {
+        uint32_t a = result[t + e];
+        uint32_t b = result[t + (e + 1) % 3];
+        if (a > b)
+          continue;
+        uint32_t ca = canonical[a];
+        uint32_t cb = canonical[b];
+        if (locked[ca] && locked[cb])
+          continue;
+        Quadric q = quadrics[ca];
+        quadricAdd(q, quadrics[cb]);
+        float err_ab = locked[ca] ? FLT_MAX
+                                  : quadricError(q, vertices[b].position);
+        float err_ba = locked[cb] ? FLT_MAX
+                                  : quadricError(q, vertices[a].position);
+        if (err_ab <= err_ba)
+          collapses.push_back({a, b, err_ab});
+        else
+          collapses.push_back({b, a, err_ba});
+      }
+    }
+    if (collapses.empty())
+      break;
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &l, const Collapse &r) {
+                return l.error < r.error;
+              });
+
+    // Triangles around each vertex, for flip check.
+    std::fill(adjacency_offset.begin(), adjacency_offset.end(), 0);
+    for (uint32_t idx : result)
+      adjacency_offset[idx + 1] += 1;
+    for (size_t i = 0; i < n_vertices; i++)
+      adjacency_offset[i + 1] += adjacency_offset[i];
+    adjacency.resize(result.size());
+    {
+      std::vector<uint32_t> fill(adjacency_offset.begin(),
+                                 adjacency_offset.end() - 1);
+      for (size_t i = 0; i < result.size(); i++)
+        adjacency[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    // Each collapse removes about two triangles.
+    size_t collapse_goal =
+        std::max<size_t>(1, (result.size() - target_index_count) / 6);
+    size_t n_collapsed = 0;
+    for (size_t i = 0; i < n_vertices; i++)
+      collapse_to[i] = static_cast<uint32_t>(i);
+    std::fill(touched.begin(), touched.end(), false);
+    for (const Collapse &c : collapses) {
+      if (c.error > max_error_sq || n_collapsed >= collapse_goal)
+        break;
+      uint32_t cs = canonical[c.src];
+      uint32_t cd = canonical[c.dst];
+      if (touched[cs] || touched[cd])
+        continue;
+      // Moving src to dst must not fold any remaining triangle over.
+      bool flipped = false;
+      glm::vec3 dst_pos = vertices[c.dst].position;
+      for (uint32_t a = adjacency_offset[c.src];
+           a < adjacency_offset[c.src + 1] && !flipped; a++) {
+        const uint32_t *tri = &result[adjacency[a] * 3];
+        if (canonical[tri[0]] == cd || canonical[tri[1]] == cd ||
+            canonical[tri[2]] == cd)
+          continue;
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; k++)
+          p[k] = vertices[tri[k]].position;
+        glm::vec3 n_before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        for (int k = 0; k < 3; k++)
+          if (tri[k] == c.src)
+            p[k] = dst_pos;
+        glm::vec3 n_after = glm::cross(p[1] - p[0], p[2] - p[0]);
+        flipped = glm::dot(n_before, n_after) <= 0.f;
+      }
+      if (flipped)
+        continue;
+      collapse_to[c.src] = c.dst;
+      touched[cs] = touched[cd] = true;
+      quadricAdd(quadrics[cd], quadrics[cs]);
+      reached_error_sq = std::max(reached_error_sq, c.error);
+      n_collapsed++;
+    }
+    if (n_collapsed == 0)
+      break;
+
+    // Remap and drop degenerate triangles.
+    size_t n_kept = 0;
+    for (size_t t = 0; t < result.size(); t += 3) {
+      uint32_t a = collapse_to[result[t + 0]];
+      uint32_t b = collapse_to[result[t + 1]];
+      uint32_t c = collapse_to[result[t + 2]];
+      if (canonical[a] == canonical[b] || canonical[b] == canonical[c] ||
+          canonical[a] == canonical[c])
+        continue;
+      result[n_kept++] = a;
+      result[n_kept++] = b;
+      result[n_kept++] = c;
+    }
+    result.resize(n_kept);
+  }
+  if (result_error)
+    *result_error = std::sqrt(reached_error_sq) / extent;
+  return result;
+}
+
+uint32_t meshutil::generateLods(std::vector<uint32_t> &indices,
+                                std::span<const Vertex> vertices,
+                                GeometrySurface &surface) {
+  constexpr uint32_t kMaxLods = 4;
+  // Not worth another range below this.
+  constexpr size_t kMinIndexCount = 96;
+  constexpr float kMaxError = 0.05f;
+
+  surface.lods.clear();
+  std::vector<uint32_t> source(indices.begin() + surface.start_index,
+                               indices.begin() + surface.start_index +
+                                   surface.count);
+  glm::vec3 min_pos = vertices[source[0]].position;
+  glm::vec3 max_pos = min_pos;
+  for (uint32_t idx : source) {
+    min_pos = glm::min(min_pos, vertices[idx].position);
+    max_pos = glm::max(max_pos, vertices[idx].position);
+  }
+  float extent = glm::length(max_pos - min_pos);
+
+  float error = 0.f;
+  while (surface.lods.size() < kMaxLods && source.size() > kMinIndexCount) {
+    size_t target = source.size() / 6 * 3;
+    float lod_error = 0.f;
+    std::vector<uint32_t> lod =
+        simplify(source, vertices, target, kMaxError, &lod_error);
+    // Stuck on locked vertices or error limit.
+    if (lod.size() > source.size() * 85 / 100)
+      break;
+    // Simplified from previous level, errors add up.
+    error += lod_error * extent;
+    SurfaceLod new_lod;
+    new_lod.start_index = static_cast<uint32_t>(indices.size());
+    new_lod.count = static_cast<uint32_t>(lod.size());
+    new_lod.error = error;
+    indices.insert(indices.end(), lod.begin(), lod.end());
+    surface.lods.push_back(new_lod);
+    source = std::move(lod);
+  }
+  return static_cast<uint32_t>(surface.lods.size());
+}
+
+namespace {
+void finishMeshlet(std::span<const uint32_t> indices,
+                   std::span<const Vertex> vertices, bool cone_culling,
+                   Meshlet &m) {
+  glm::vec3 min_pos = vertices[indices[m.first_index]].position;
+  glm::vec3 max_pos = min_pos;
+  glm::vec3 normal_sum(0.f);
+  for (uint32_t i = m.first_index; i < m.first_index + m.index_count; i += 3) {
+    glm::vec3 p0 = vertices[indices[i + 0]].position;
+    glm::vec3 p1 = vertices[indices[i + 1]].position;
+    glm::vec3 p2 = vertices[indices[i + 2]].position;
+    min_pos = glm::min(glm::min(min_pos, p0), glm::min(p1, p2));
+    max_pos = glm::max(glm::max(max_pos, p0), glm::max(p1, p2));
+    glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+    float len = glm::length(n);
+    if (len > 0.f)
+      normal_sum += n / len;
+  }
+  glm::vec3 center = 0.5f * (min_pos + max_pos);
+  float radius = 0.f;
+  for (uint32_t i = m.first_index; i < m.first_index + m.index_count; i++)
+    radius = std::max(radius,
+                      glm::length(vertices[indices[i]].position - center));
+  m.sphere = glm::vec4(center, radius);
+
+  // All normals lie within acos(min_dot) of the axis. The cluster faces away
+  // when the view direction is within 90 - acos(min_dot) of it.
+  m.cone = glm::vec4(0.f, 0.f, 0.f, 1.f);
+  float axis_len = glm::length(normal_sum);
+  if (!cone_culling || axis_len == 0.f)
+    return;
+  glm::vec3 axis = normal_sum / axis_len;
+  float min_dot = 1.f;
+  for (uint32_t i = m.first_index; i < m.first_index + m.index_count; i += 3) {
+    glm::vec3 p0 = vertices[indices[i + 0]].position;
+    glm::vec3 n = glm::cross(vertices[indices[i + 1]].position - p0,
+                             vertices[indices[i + 2]].position - p0);
+    float len = glm::length(n);
+    if (len > 0.f)
+      min_dot = std::min(min_dot, glm::dot(n / len, axis));
+  }
+  // Too wide to ever face away entirely.
+  if (min_dot <= 0.1f)
+    return;
+  m.cone = glm::vec4(axis, std::sqrt(1.f - min_dot * min_dot));
+}
+} // namespace
+
+uint32_t meshutil::buildMeshlets(std::span<const uint32_t> indices,
+                                 std::span<const Vertex> vertices,
+                                 uint32_t first_index, uint32_t index_count,
+                                 bool cone_culling,
+                                 std::vector<Meshlet> &meshlets) {
+  size_t n_before = meshlets.size();
+  // Meshlet that last used each vertex.
+  std::vector<uint32_t> stamp(vertices.size(), UINT32_MAX);
+  Meshlet current = {};
+  current.first_index = first_index;
+  uint32_t n_vertices = 0;
+  uint32_t id = 0;
+  for (uint32_t i = first_index; i < first_index + index_count; i += 3) {
+    uint32_t n_new = 0;
+    for (int k = 0; k < 3; k++)
+      n_new += stamp[indices[i + k]] != id ? 1 : 0;
+    if (n_vertices + n_new > kMeshletMaxVertices ||
+        current.index_count / 3 >= kMeshletMaxTriangles) {
+      finishMeshlet(indices, vertices, cone_culling, current);
+      meshlets.push_back(current);
+      current = {};
+      current.first_index = i;
+      n_vertices = 0;
+      id++;
+    }
+    for (int k = 0; k < 3; k++) {
+      if (stamp[indices[i + k]] != id) {
+        stamp[indices[i + k]] = id;
+        n_vertices++;
+      }
+    }
+    current.index_count += 3;
+  }
+  if (current.index_count > 0) {
+    finishMeshlet(indices, vertices, cone_culling, current);
+    meshlets.push_back(current);
+  }
+  return static_cast<uint32_t>(meshlets.size() - n_before);
+}
+
+namespace {
+/// @brief Unit vector onto the octahedron, folded into [-1, 1]^2.
+glm::vec2 encodeOctahedral(glm::vec3 n) {
+  float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (l1 == 0.f)
+    return glm::vec2(0.f);
+  n /= l1;
+  glm::vec2 e(n.x, n.y);
+  if (n.z < 0.f) {
+    e.x = (1.f - std::abs(n.y)) * (n.x >= 0.f ? 1.f : -1.f);
+    e.y = (1.f - std::abs(n.x)) * (n.y >= 0.f ? 1.f : -1.f);
+  }
+  return e;
+}
+} // namespace
+
+void meshutil::compressVertices(std::span<const Vertex> vertices,
+                                const GeometryBound &bound,
+                                std::span<CompactVertex> compact,
+                                std::span<uint32_t> colors) {
+  // Degenerate bound, every position is the origin.
+  float inv_radius = bound.radius > 0.f ? 1.f / bound.radius : 0.f;
+  for (size_t i = 0; i < vertices.size(); i++) {
+    const Vertex &v = vertices[i];
+    glm::vec3 p = (v.position - bound.origin) * inv_radius;
+    compact[i].position_xy = glm::packSnorm2x16(glm::vec2(p.x, p.y));
+    compact[i].position_z = glm::packSnorm2x16(glm::vec2(p.z, 0.f));
+    compact[i].normal = glm::packSnorm2x16(encodeOctahedral(v.normal));
+    compact[i].uv = glm::packHalf2x16(glm::vec2(v.uv_x, v.uv_y));
+    if (!colors.empty())
+      colors[i] = glm::packUnorm4x8(v.color);
+  }
+}
+
+meshutil::VertexCacheStats
+meshutil::analyzeVertexCache(std::span<const uint32_t> indices,
+                             uint32_t cache_size) {
+  VertexCacheStats stats{0.f, 0.f};
+  if (indices.empty())
+    return stats;
+  auto [min_it, max_it] = std::minmax_element(indices.begin(), indices.end());
+  uint32_t base = *min_it;
+  // Time of the last miss, a vertex is cached for cache_size misses.
+  std::vector<uint32_t> stamp(*max_it - base + 1, 0);
+  uint32_t time = cache_size + 1;
+  size_t n_unique = 0;
+  for (uint32_t idx : indices) {
+    uint32_t &s = stamp[idx - base];
+    if (s == 0)
+      n_unique++;
+    if (time - s > cache_size)
+      s = time++;
+  }
+  size_t n_misses = time - cache_size - 1;
+  stats.acmr = float(n_misses) / float(indices.size() / 3);
+  stats.atvr = float(n_misses) / float(n_unique);
+  return stats;
+}
+
+void meshutil::optimizeVertexCache(std::span<uint32_t> indices,
+                                   std::vector<uint32_t> *clusters,
+                                   uint32_t cache_size) {
+  if (clusters)
+    clusters->assign(1, 0);
+  if (indices.size() < 6)
+    return;
+  auto [min_it, max_it] = std::minmax_element(indices.begin(), indices.end());
+  uint32_t base = *min_it;
+  size_t n_vertices = *max_it - base + 1;
+  size_t n_triangles = indices.size() / 3;
+
+  // Triangles around each vertex, live ones are not emitted yet.
+  std::vector<uint32_t> live(n_vertices, 0);
+  for (uint32_t idx : indices)
+    live[idx - base]++;
+  std::vector<uint32_t> offsets(n_vertices + 1, 0);
+  for (size_t v = 0; v < n_vertices; v++)
+    offsets[v + 1] = offsets[v] + live[v];
+  std::vector<uint32_t> adjacency(indices.size());
+  {
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+      adjacency[fill[indices[i] - base]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  std::vector<uint32_t> stamp(n_vertices, 0);
+  std::vector<bool> emitted(n_triangles, false);
+  std::vector<uint32_t> dead_end;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  uint32_t time = cache_size + 1;
+  uint32_t cursor = 0;
+  int64_t fanning = 0;
+  while (fanning >= 0) {
+    candidates.clear();
+    uint32_t f = static_cast<uint32_t>(fanning);
+    for (uint32_t k = offsets[f]; k < offsets[f + 1]; k++) {
+      uint32_t t = adjacency[k];
+      if (emitted[t])
+        continue;
+      emitted[t] = true;
+      for (uint32_t j = 0; j < 3; j++) {
+        uint32_t idx = indices[t * 3 + j];
+        uint32_t v = idx - base;
+        result.push_back(idx);
+        dead_end.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - stamp[v] > cache_size)
+          stamp[v] = time++;
+      }
+    }
+    // Prefer the candidate that stays longest in cache and still fits its
+    // remaining triangles.
+    fanning = -1;
+    int64_t best_priority = -1;
+    for (uint32_t v : candidates) {
+      if (live[v] == 0)
+        continue;
+      int64_t priority = 0;
+      if (time - stamp[v] + 2 * live[v] <= cache_size)
+        priority = time - stamp[v];
+      if (priority > best_priority) {
+        best_priority = priority;
+        fanning = v;
+      }
+    }
+    if (fanning >= 0)
+      continue;
+    // Dead end, restart from a recent vertex, or the next one in order.
+    while (!dead_end.empty() && fanning < 0) {
+      uint32_t v = dead_end.back();
+      dead_end.pop_back();
+      if (live[v] > 0)
+        fanning = v;
+    }
+    while (fanning < 0 && cursor < n_vertices) {
+      if (live[cursor] > 0)
+        fanning = cursor;
+      cursor++;
+    }
+    if (fanning >= 0 && clusters)
+      clusters->push_back(static_cast<uint32_t>(result.size() / 3));
+  }
+  std::copy(result.begin(), result.end(), indices.begin());
+}
+
+void meshutil::optimizeOverdraw(std::span<uint32_t> indices,
+                                std::span<const Vertex> vertices,
+                                std::span<const uint32_t> clusters) {
+  size_t n_triangles = indices.size() / 3;
+  if (clusters.size() < 2)
+    return;
+  struct Cluster {
+    uint32_t first;
+    uint32_t last;
+    glm::vec3 centroid;
+    glm::vec3 normal;
+    float sort_key;
+  };
+  std::vector<Cluster> sorted(clusters.size());
+  glm::vec3 mesh_centroid(0.f);
+  float mesh_area = 0.f;
+  for (size_t c = 0; c < clusters.size(); c++) {
+    Cluster &cluster = sorted[c];
+    cluster.first = clusters[c];
+    cluster.last =
+        c + 1 < clusters.size() ? clusters[c + 1] : uint32_t(n_triangles);
+    // Area weighted centroid and normal.
+    glm::vec3 centroid(0.f), normal(0.f);
+    float area = 0.f;
+    for (uint32_t t = cluster.first; t < cluster.last; t++) {
+      glm::vec3 p0 = vertices[indices[t * 3 + 0]].position;
+      glm::vec3 p1 = vertices[indices[t * 3 + 1]].position;
+      glm::vec3 p2 = vertices[indices[t * 3 + 2]].position;
+      glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+      float a = glm::length(n);
+      centroid += (p0 + p1 + p2) * (a / 3.f);
+      normal += n;
+      area += a;
+    }
+    mesh_centroid += centroid;
+    mesh_area += area;
+    cluster.centroid = centroid / std::max(area, FLT_MIN);
+    float normal_length = glm::length(normal);
+    cluster.normal = normal_length > 0.f ? normal / normal_length : normal;
+  }
+  mesh_centroid /= std::max(mesh_area, FLT_MIN);
+  // Clusters far out along their normal are drawn first.
+  for (Cluster &cluster : sorted)
+    cluster.sort_key =
+        glm::dot(cluster.centroid - mesh_centroid, cluster.normal);
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Cluster &a, const Cluster &b) {
+                     return a.sort_key > b.sort_key;
+                   });
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (const Cluster &cluster : sorted)
+    result.insert(result.end(), indices.begin() + cluster.first * 3,
+                  indices.begin() + cluster.last * 3);
+  std::copy(result.begin(), result.end(), indices.begin());
+}
+
+uint32_t meshutil::optimizeVertexFetch(std::span<uint32_t> indices,
+                                       std::vector<Vertex> &vertices) {
+  std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+  uint32_t n_used = 0;
+  for (uint32_t &idx : indices) {
+    if (remap[idx] == UINT32_MAX)
+      remap[idx] = n_used++;
+    idx = remap[idx];
+  }
+  std::vector<Vertex> reordered(n_used);
+  for (size_t i = 0; i < vertices.size(); i++)
+    if (remap[i] != UINT32_MAX)
+      reordered[remap[i]] = vertices[i];
+  vertices.swap(reordered);
+  return n_used;
+}
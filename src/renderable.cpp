@@ -1,6 +1,8 @@
 #include "renderable.h"
 #include "engine.h"
 
+#include <algorithm>
+
 void Node::updateTransform(const glm::mat4 &parent_matrix) {
   transform_world = parent_matrix * transform_local;
   for (auto c : children) {
@@ -12,16 +14,60 @@ void Node::draw(const glm::mat4 &top_matrix, DrawContext &context) {
     c->draw(top_matrix, context);
 }
 
+/**
+ * @brief Coarsest LOD whose error stays under the pixel budget, measured from
+ *        the nearest point of the surface bound.
+ */
+static const SurfaceLod *selectLod(const GeometrySurface &s,
+                                   const glm::mat4 &transform,
+                                   const DrawContext &context) {
+  if (context.lod_pixels_per_unit <= 0.f || s.lods.empty())
+    return nullptr;
+  float scale = std::max({glm::length(glm::vec3(transform[0])),
+                          glm::length(glm::vec3(transform[1])),
+                          glm::length(glm::vec3(transform[2]))});
+  glm::vec3 center = glm::vec3(transform * glm::vec4(s.bound.origin, 1.f));
+  float distance = glm::length(center - context.camera_position) -
+                   s.bound.radius * scale;
+  if (distance <= 0.f)
+    return nullptr;
+  float pixels_per_error = context.lod_pixels_per_unit * scale / distance;
+  const SurfaceLod *selected = nullptr;
+  for (const SurfaceLod &lod : s.lods) {
+    if (lod.error * pixels_per_error > context.lod_max_error_pixels)
+      break;
+    selected = &lod;
+  }
+  return selected;
+}
+
 void MeshNode::draw(const glm::mat4 &top_matrix, DrawContext &context) {
   glm::mat4 node_matrix = top_matrix * transform_world;
   for (auto &s : mesh->surfaces) {
     RenderObject surface;
     surface.first_index = s.start_index;
     surface.n_index = s.count;
+    surface.first_meshlet = s.first_meshlet;
+    surface.n_meshlets = s.meshlet_count;
+    context.n_triangles_full += s.count / 3;
+    if (const SurfaceLod *lod = selectLod(s, node_matrix, context)) {
+      surface.first_index = lod->start_index;
+      surface.n_index = lod->count;
+      surface.first_meshlet = lod->first_meshlet;
+      surface.n_meshlets = lod->meshlet_count;
+    }
+    context.n_triangles_selected += surface.n_index / 3;
     surface.index_buffer = mesh->mesh_buffers.index_buffer.buffer;
+    surface.index_type = mesh->mesh_buffers.index_type;
+    surface.vertex_offset = static_cast<int32_t>(s.base_vertex);
     surface.material = &s.material->data;
     surface.transform = node_matrix;
     surface.vertex_buffer_address = mesh->mesh_buffers.vertex_buffer_address;
+    surface.color_buffer_address = mesh->mesh_buffers.color_buffer_address;
+    surface.vertex_layout = mesh->mesh_buffers.vertex_layout;
+    surface.index_buffer_address = mesh->mesh_buffers.index_buffer_address;
+    surface.meshlet_buffer_address =
+        mesh->mesh_buffers.meshlet_buffer_address;
 
     surface.bound = s.bound;
 
@@ -39,25 +85,50 @@ void MeshNode::draw(const glm::mat4 &top_matrix, DrawContext &context) {
 }
 
 void LoadedGLTF::draw(const glm::mat4 &top_mat, DrawContext &context) {
-  for (auto &n : top_nodes)
-    n->draw(top_mat, context);
+  if (top_nodes.size() < 2) {
+    for (auto &n : top_nodes)
+      n->draw(top_mat, context);
+    return;
+  }
+  // Subtrees go to their own contexts in parallel, merged in order.
+  std::vector<DrawContext> partial(top_nodes.size());
+  creator->m_jobs.parallelFor(
+      "draw list", top_nodes.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          partial[i].camera_position = context.camera_position;
+          partial[i].lod_pixels_per_unit = context.lod_pixels_per_unit;
+          partial[i].lod_max_error_pixels = context.lod_max_error_pixels;
+          top_nodes[i]->draw(top_mat, partial[i]);
+        }
+      });
+  for (DrawContext &p : partial) {
+    context.opaque_surfaces.insert(context.opaque_surfaces.end(),
+                                   p.opaque_surfaces.begin(),
+                                   p.opaque_surfaces.end());
+    context.transparent_surfaces.insert(context.transparent_surfaces.end(),
+                                        p.transparent_surfaces.begin(),
+                                        p.transparent_surfaces.end());
+    context.n_triangles_full += p.n_triangles_full;
+    context.n_triangles_selected += p.n_triangles_selected;
+  }
 }
 void LoadedGLTF::clearAll() {
   VkDevice dv = creator->m_device;
+  // Shared textures may outlive this file, its materials must not be
+  // rewritten by the streamer after that.
+  for (MaterialInstance *instance : streamed_materials)
+    creator->m_texture_streamer.removeMaterial(instance);
+  for (TextureHandle texture : textures)
+    creator->m_assets.releaseTexture(texture);
   descriptor_pool.destroyPools(dv);
   creator->destroyBuffer(material_data_buffer);
 
   for (auto &[k, v] : meshes) {
     creator->destroyBuffer(v->mesh_buffers.index_buffer);
     creator->destroyBuffer(v->mesh_buffers.vertex_buffer);
+    creator->destroyBuffer(v->mesh_buffers.color_buffer);
+    creator->destroyBuffer(v->mesh_buffers.meshlet_buffer);
   }
-  for (auto &[k, v] : images) {
-    if (v.image == creator->m_error_image.image) {
-      // dont destroy the default images
-      continue;
-    }
-    creator->destroyImage(v);
-  }
-  for (auto &sampler : samplers)
-    vkDestroySampler(dv, sampler, nullptr);
+  for (VkSampler sampler : samplers)
+    creator->m_assets.releaseSampler(sampler);
 }
\ No newline at end of file
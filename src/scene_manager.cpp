@@ -0,0 +1,138 @@
+#include "scene_manager.h"
+
+#include "engine.h"
+
+void SceneManager::init(Engine *engine) {
+  m_engine = engine;
+  m_quit = false;
+  m_loader = std::thread([this]() { loaderLoop(); });
+}
+void SceneManager::destroy() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  if (m_loader.joinable())
+    m_loader.join();
+  // Left in queues are also in m_requests.
+  m_queued.clear();
+  m_parsed.clear();
+  for (std::shared_ptr<Request> &request : m_requests)
+    request->promise.set_value(nullptr);
+  m_requests.clear();
+  m_unloads.clear();
+  m_retired.clear();
+}
+
+SceneFuture SceneManager::requestScene(const std::string &name,
+                                       std::filesystem::path file_path) {
+  std::shared_ptr<Request> request = std::make_shared<Request>();
+  request->name = name;
+  request->path = std::move(file_path);
+  return queue(std::move(request));
+}
+SceneFuture SceneManager::requestScene(const std::string &name,
+                                       const SyntheticSceneConfig &config) {
+  std::shared_ptr<Request> request = std::make_shared<Request>();
+  request->name = name;
+  request->path = fmt::format("<{} synthetic objects>", config.n_objects);
+  request->synthetic = config;
+  return queue(std::move(request));
+}
+SceneFuture SceneManager::queue(std::shared_ptr<Request> &&request) {
+  // Read here, the loader thread must not touch engine settings.
+  request->compact_vertices = m_engine->m_compact_vertices;
+  SceneFuture future = request->promise.get_future().share();
+  m_requests.push_back(request);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queued.push_back(std::move(request));
+  }
+  m_wake.notify_one();
+  return future;
+}
+void SceneManager::unloadScene(const std::string &name) {
+  for (std::shared_ptr<Request> &request : m_requests)
+    if (request->name == name)
+      request->cancelled = true;
+  m_unloads.push_back(name);
+}
+
+void SceneManager::update() {
+  uint64_t frame = static_cast<uint64_t>(m_engine->frame_number);
+  // Last recorded kFrameOverlap frames ago, its timeline value was waited
+  // since. Frame numbers rather than values, as immediate submits take
+  // values between those of frames.
+  while (!m_retired.empty() &&
+         m_retired.front().frame + kFrameOverlap < frame) {
+    m_retired.pop_front();
+  }
+  for (const std::string &name : m_unloads) {
+    auto it = m_engine->m_loaded_scenes.find(name);
+    if (it == m_engine->m_loaded_scenes.end())
+      continue;
+    retire(std::move(it->second));
+    m_engine->m_loaded_scenes.erase(it);
+  }
+  m_unloads.clear();
+
+  for (uint32_t i = 0; i < max_finish_per_frame; i++) {
+    std::shared_ptr<Request> request;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_parsed.empty())
+        break;
+      request = std::move(m_parsed.front());
+      m_parsed.pop_front();
+    }
+    std::erase(m_requests, request);
+    std::shared_ptr<LoadedGLTF> scene;
+    if (request->staging && !request->cancelled) {
+      auto loaded = finishGltf(m_engine, *request->staging);
+      if (loaded.has_value())
+        scene = *loaded;
+    }
+    request->staging.reset();
+    if (scene) {
+      std::shared_ptr<LoadedGLTF> &slot =
+          m_engine->m_loaded_scenes[request->name];
+      if (slot)
+        retire(std::move(slot));
+      slot = scene;
+    } else if (!request->cancelled) {
+      fmt::println("Failed to load scene {} from {}", request->name,
+                   request->path.string());
+    }
+    request->promise.set_value(scene);
+  }
+}
+
+void SceneManager::loaderLoop() {
+  // Jobs of the loader go to its own deque, the main thread never runs them.
+  if (!m_engine->m_jobs.registerThread())
+    fmt::println("Scene loader has no job deque, loading on frame deques");
+  while (true) {
+    std::shared_ptr<Request> request;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this]() { return m_quit || !m_queued.empty(); });
+      if (m_quit)
+        return;
+      request = std::move(m_queued.front());
+      m_queued.pop_front();
+    }
+    if (!request->cancelled)
+      request->staging =
+          request->synthetic.has_value()
+              ? generateScene(m_engine, *request->synthetic,
+                              request->compact_vertices)
+              : parseGltf(m_engine, request->path, request->compact_vertices);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_parsed.push_back(std::move(request));
+  }
+}
+void SceneManager::retire(std::shared_ptr<LoadedGLTF> &&scene) {
+  m_retired.push_back(
+      {std::move(scene), static_cast<uint64_t>(m_engine->frame_number)});
+}
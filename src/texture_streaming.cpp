@@ -0,0 +1,409 @@
+#include "texture_streaming.h"
+
+#include "engine.h"
+#include "vk_images.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+TextureSource texutil::buildMipChain(const uint8_t *rgba, uint32_t width,
+                                     uint32_t height) {
+  TextureSource source;
+  uint32_t levels = static_cast<uint32_t>(
+                        std::floor(std::log2(std::max(width, height)))) +
+                    1;
+  size_t total = 0;
+  for (uint32_t l = 0; l < levels; l++) {
+    VkExtent2D extent{std::max(1u, width >> l), std::max(1u, height >> l)};
+    source.extents.push_back(extent);
+    source.offsets.push_back(total);
+    total += size_t(extent.width) * extent.height * 4;
+  }
+  source.pixels.resize(total);
+  memcpy(source.pixels.data(), rgba, size_t(width) * height * 4);
+  for (uint32_t l = 1; l < levels; l++) {
+    VkExtent2D src = source.extents[l - 1];
+    VkExtent2D dst = source.extents[l];
+    const uint8_t *in = source.pixels.data() + source.offsets[l - 1];
+    uint8_t *out = source.pixels.data() + source.offsets[l];
+    for (uint32_t y = 0; y < dst.height; y++) {
+      uint32_t y0 = std::min(2 * y, src.height - 1);
+      uint32_t y1 = std::min(2 * y + 1, src.height - 1);
+      for (uint32_t x = 0; x < dst.width; x++) {
+        uint32_t x0 = std::min(2 * x, src.width - 1);
+        uint32_t x1 = std::min(2 * x + 1, src.width - 1);
+        for (uint32_t c = 0; c < 4; c++) {
+          uint32_t sum = in[(size_t(y0) * src.width + x0) * 4 + c] +
+                         in[(size_t(y0) * src.width + x1) * 4 + c] +
+                         in[(size_t(y1) * src.width + x0) * 4 + c] +
+                         in[(size_t(y1) * src.width + x1) * 4 + c];
+          out[(size_t(y) * dst.width + x) * 4 + c] =
+              static_cast<uint8_t>((sum + 2) / 4);
+        }
+      }
+    }
+  }
+  return source;
+}
+
+void TextureStreamer::init(Engine *engine) {
+  m_engine = engine;
+  std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2},
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}};
+  m_ds_allocator.initPool(engine->m_device, 64, sizes);
+}
+void TextureStreamer::destroy() {
+  for (TextureHandle t = 0; t < m_textures.size(); t++) {
+    if (m_textures[t].alive)
+      removeTexture(t);
+  }
+  m_materials.clear();
+  m_free_sets.clear();
+  m_retired_sets.clear();
+  m_ds_allocator.destroyPools(m_engine->m_device);
+}
+
+TextureHandle TextureStreamer::addTexture(TextureSource &&source) {
+  TextureHandle handle;
+  if (!m_free_textures.empty()) {
+    handle = m_free_textures.back();
+    m_free_textures.pop_back();
+  } else {
+    handle = static_cast<TextureHandle>(m_textures.size());
+    m_textures.emplace_back();
+  }
+  StreamedTexture &texture = m_textures[handle];
+  texture = StreamedTexture{};
+  texture.source = std::move(source);
+  texture.alive = true;
+  uint32_t tail = 0;
+  while (tail + 1 < texture.source.levels() &&
+         std::max(texture.source.extents[tail].width,
+                  texture.source.extents[tail].height) > kTailSize)
+    tail++;
+  texture.tail_level = tail;
+  texture.resident_level = texture.source.levels();
+  texture.wanted_level = tail;
+  m_engine->immediateSubmit(
+      [&](VkCommandBuffer cmd) { setResidentLevel(cmd, texture, tail); });
+  m_stats.full_bytes += texture.source.bytesFrom(0);
+  m_stats.n_textures++;
+  return handle;
+}
+void TextureStreamer::removeTexture(TextureHandle handle) {
+  StreamedTexture &texture = m_textures[handle];
+  std::vector<MaterialInstance *> users = texture.materials;
+  for (MaterialInstance *instance : users)
+    removeMaterial(instance);
+  m_engine->destroyImage(texture.image);
+  m_resident_bytes -= texture.source.bytesFrom(texture.resident_level);
+  m_stats.full_bytes -= texture.source.bytesFrom(0);
+  m_stats.n_textures--;
+  texture = StreamedTexture{};
+  m_free_textures.push_back(handle);
+}
+
+void TextureStreamer::addMaterial(MaterialInstance *instance,
+                                  VkBuffer data_buffer,
+                                  uint32_t data_buffer_offset,
+                                  TextureHandle color, VkSampler color_sampler,
+                                  TextureHandle metal_rough,
+                                  VkSampler metal_rough_sampler) {
+  StreamedMaterial material{};
+  material.data_buffer = data_buffer;
+  material.data_buffer_offset = data_buffer_offset;
+  material.color = color;
+  material.color_sampler = color_sampler;
+  material.metal_rough = metal_rough;
+  material.metal_rough_sampler = metal_rough_sampler;
+  material.fixed_color = m_engine->m_white_image;
+  material.fixed_metal_rough = m_engine->m_white_image;
+  m_materials[instance] = material;
+  for (TextureHandle t : {color, metal_rough}) {
+    if (t != kNoTexture)
+      m_textures[t].materials.push_back(instance);
+  }
+}
+void TextureStreamer::removeMaterial(MaterialInstance *instance) {
+  auto it = m_materials.find(instance);
+  if (it == m_materials.end())
+    return;
+  for (TextureHandle t : {it->second.color, it->second.metal_rough}) {
+    if (t == kNoTexture)
+      continue;
+    std::vector<MaterialInstance *> &users = m_textures[t].materials;
+    users.erase(std::remove(users.begin(), users.end(), instance),
+                users.end());
+  }
+  if (it->second.owns_set)
+    retireSet(instance->ds);
+  m_materials.erase(it);
+}
+
+void TextureStreamer::update(VkCommandBuffer cmd, const DrawContext &context,
+                             std::span<const size_t> visible_opaque,
+                             float pixels_per_unit) {
+  uint64_t frame = m_engine->frame_number;
+  m_stats.n_upgraded = 0;
+  m_stats.n_evicted = 0;
+  m_stats.n_refused = 0;
+  m_stats.uploaded_bytes = 0;
+  while (!m_retired_sets.empty() &&
+         m_retired_sets.front().frame + kFrameOverlap <= frame) {
+    m_free_sets.push_back(m_retired_sets.front().ds);
+    m_retired_sets.pop_front();
+  }
+
+  // Finest level each texture needs, from the projected bounding spheres
+  // of surfaces using it. A texture is assumed to span its surface once.
+  for (StreamedTexture &texture : m_textures)
+    texture.wanted_level = texture.tail_level;
+  const MaterialInstance *last_instance = nullptr;
+  const StreamedMaterial *last_material = nullptr;
+  auto request = [&](const RenderObject &obj) {
+    if (obj.material != last_instance) {
+      last_instance = obj.material;
+      auto it = m_materials.find(obj.material);
+      last_material = it == m_materials.end() ? nullptr : &it->second;
+    }
+    if (last_material == nullptr)
+      return;
+    glm::vec3 center =
+        glm::vec3(obj.transform * glm::vec4(obj.bound.origin, 1.f));
+    float scale = std::max({glm::length(glm::vec3(obj.transform[0])),
+                            glm::length(glm::vec3(obj.transform[1])),
+                            glm::length(glm::vec3(obj.transform[2]))});
+    float radius = obj.bound.radius * scale;
+    float distance = std::max(
+        glm::length(center - context.camera_position) - radius, 0.1f);
+    float pixels = 2.f * radius * pixels_per_unit / distance;
+    for (TextureHandle t :
+         {last_material->color, last_material->metal_rough}) {
+      if (t == kNoTexture)
+        continue;
+      StreamedTexture &texture = m_textures[t];
+      VkExtent2D extent = texture.source.extents[0];
+      float ratio =
+          std::max(extent.width, extent.height) / std::max(pixels, 1.f);
+      uint32_t level = static_cast<uint32_t>(
+          std::clamp(std::floor(std::log2(ratio)), 0.f,
+                     static_cast<float>(texture.tail_level)));
+      texture.wanted_level = std::min(texture.wanted_level, level);
+      texture.last_used_frame = frame;
+    }
+  };
+  for (size_t i : visible_opaque)
+    request(context.opaque_surfaces[i]);
+  for (const RenderObject &obj : context.transparent_surfaces)
+    request(obj);
+
+  std::vector<TextureHandle> changed;
+  auto evict = [&](TextureHandle t, uint32_t level) {
+    setResidentLevel(cmd, m_textures[t], level);
+    changed.push_back(t);
+    m_stats.n_evicted++;
+  };
+  // Textures unused for a while drop to the tail.
+  std::vector<TextureHandle> lru;
+  for (TextureHandle t = 0; t < m_textures.size(); t++) {
+    StreamedTexture &texture = m_textures[t];
+    if (!texture.alive || texture.resident_level >= texture.tail_level)
+      continue;
+    if (frame - texture.last_used_frame > kEvictFrames)
+      evict(t, texture.tail_level);
+    else
+      lru.push_back(t);
+  }
+  // Under pressure, least recently used first, used ones keep what they
+  // need this frame.
+  std::sort(lru.begin(), lru.end(), [&](TextureHandle a, TextureHandle b) {
+    return m_textures[a].last_used_frame < m_textures[b].last_used_frame;
+  });
+  size_t budget = std::min(budget_bytes, pressure_limit_bytes);
+  auto makeRoom = [&](size_t needed) {
+    for (TextureHandle t : lru) {
+      if (m_resident_bytes + needed <= budget)
+        break;
+      StreamedTexture &texture = m_textures[t];
+      uint32_t level = texture.last_used_frame == frame
+                           ? texture.wanted_level
+                           : texture.tail_level;
+      if (texture.resident_level < level)
+        evict(t, level);
+    }
+    return m_resident_bytes + needed <= budget;
+  };
+  makeRoom(0);
+
+  // Largest upgrades first, within the per frame upload budget.
+  std::vector<TextureHandle> upgrades;
+  for (TextureHandle t = 0; t < m_textures.size(); t++) {
+    StreamedTexture &texture = m_textures[t];
+    if (texture.alive && texture.wanted_level < texture.resident_level)
+      upgrades.push_back(t);
+  }
+  std::sort(upgrades.begin(), upgrades.end(),
+            [&](TextureHandle a, TextureHandle b) {
+              const StreamedTexture &ta = m_textures[a];
+              const StreamedTexture &tb = m_textures[b];
+              return ta.resident_level - ta.wanted_level >
+                     tb.resident_level - tb.wanted_level;
+            });
+  for (TextureHandle t : upgrades) {
+    StreamedTexture &texture = m_textures[t];
+    size_t upload = texture.source.bytesFrom(texture.wanted_level) -
+                    texture.source.bytesFrom(texture.resident_level);
+    // One upgrade always goes, however large.
+    if (m_stats.uploaded_bytes > 0 &&
+        m_stats.uploaded_bytes + upload > upload_bytes_per_frame)
+      break;
+    if (!makeRoom(upload)) {
+      m_stats.n_refused++;
+      continue;
+    }
+    if (!setResidentLevel(cmd, texture, texture.wanted_level)) {
+      m_stats.n_refused++;
+      continue;
+    }
+    m_stats.uploaded_bytes += upload;
+    changed.push_back(t);
+    m_stats.n_upgraded++;
+  }
+
+  std::sort(changed.begin(), changed.end());
+  changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+  std::vector<MaterialInstance *> dirty;
+  for (TextureHandle t : changed) {
+    const std::vector<MaterialInstance *> &users = m_textures[t].materials;
+    dirty.insert(dirty.end(), users.begin(), users.end());
+  }
+  std::sort(dirty.begin(), dirty.end());
+  dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+  for (MaterialInstance *instance : dirty)
+    rewriteMaterial(instance);
+  m_stats.resident_bytes = m_resident_bytes;
+}
+
+bool TextureStreamer::setResidentLevel(VkCommandBuffer cmd,
+                                       StreamedTexture &texture,
+                                       uint32_t level) {
+  const TextureSource &source = texture.source;
+  uint32_t n_levels = source.levels();
+  uint32_t old_level = texture.resident_level;
+  AllocatedImage old_image = texture.image;
+  VkExtent2D extent = source.extents[level];
+  // Finer levels are optional, tails and downgrades must succeed.
+  bool upgrade = level < old_level && old_image.image != VK_NULL_HANDLE;
+  AllocatedImage image{};
+  VkResult result = m_engine->allocateImage(
+      VkExtent3D{extent.width, extent.height, 1}, VK_FORMAT_R8G8B8A8_UNORM,
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      n_levels - level,
+      upgrade ? VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT : 0, image);
+  if (upgrade && result == VK_ERROR_OUT_OF_DEVICE_MEMORY)
+    return false;
+  VK_CHECK(result);
+  vkutil::transitionImage(cmd, image.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+  // Levels already on GPU are copied over.
+  uint32_t first_copied = std::max(level, old_level);
+  if (first_copied < n_levels) {
+    std::vector<VkImageCopy> regions;
+    for (uint32_t l = first_copied; l < n_levels; l++) {
+      VkImageCopy region{};
+      region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, l - old_level, 0, 1};
+      region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, l - level, 0, 1};
+      region.extent = {source.extents[l].width, source.extents[l].height, 1};
+      regions.push_back(region);
+    }
+    vkutil::transitionImage(cmd, old_image.image,
+                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    vkCmdCopyImage(cmd, old_image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(regions.size()), regions.data());
+  }
+  // Finer ones come from RAM.
+  if (level < old_level) {
+    uint32_t last_uploaded = std::min(old_level, n_levels);
+    size_t offset = source.offsets[level];
+    size_t size = (last_uploaded < n_levels ? source.offsets[last_uploaded]
+                                            : source.pixels.size()) -
+                  offset;
+    AllocatedBuffer staging = m_engine->createBuffer(
+        size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+        MemoryClass::Upload);
+    memcpy(staging.alloc_info.pMappedData, source.pixels.data() + offset,
+           size);
+    std::vector<VkBufferImageCopy> regions;
+    for (uint32_t l = level; l < last_uploaded; l++) {
+      VkBufferImageCopy region{};
+      region.bufferOffset = source.offsets[l] - offset;
+      region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, l - level, 0, 1};
+      region.imageExtent = {source.extents[l].width, source.extents[l].height,
+                            1};
+      regions.push_back(region);
+    }
+    vkCmdCopyBufferToImage(cmd, staging.buffer, image.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(regions.size()),
+                           regions.data());
+    Engine *engine = m_engine;
+    engine->getCurrentFrame().deletion_queue.push(
+        [engine, staging]() { engine->destroyBuffer(staging); });
+  }
+  vkutil::transitionImage(cmd, image.image,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  // Frames in flight may still sample the old image.
+  if (old_image.image != VK_NULL_HANDLE) {
+    Engine *engine = m_engine;
+    engine->getCurrentFrame().deletion_queue.push(
+        [engine, old_image]() { engine->destroyImage(old_image); });
+    m_resident_bytes -= source.bytesFrom(old_level);
+  }
+  m_resident_bytes += source.bytesFrom(level);
+  texture.image = image;
+  texture.resident_level = level;
+  return true;
+}
+
+void TextureStreamer::rewriteMaterial(MaterialInstance *instance) {
+  StreamedMaterial &material = m_materials.at(instance);
+  if (material.owns_set)
+    retireSet(instance->ds);
+  VkDevice device = m_engine->m_device;
+  GLTFMetallicRoughness &builder = m_engine->m_metal_rough_mat;
+  VkDescriptorSet ds;
+  if (!m_free_sets.empty()) {
+    ds = m_free_sets.back();
+    m_free_sets.pop_back();
+  } else {
+    ds = m_ds_allocator.allocate(device, builder.ds_layout);
+  }
+  GLTFMetallicRoughness::MaterialResources resources;
+  resources.color_image = material.color == kNoTexture
+                              ? material.fixed_color
+                              : m_textures[material.color].image;
+  resources.color_sampler = material.color_sampler;
+  resources.metal_rough_image = material.metal_rough == kNoTexture
+                                    ? material.fixed_metal_rough
+                                    : m_textures[material.metal_rough].image;
+  resources.metal_rough_sampler = material.metal_rough_sampler;
+  resources.data_buffer = material.data_buffer;
+  resources.data_buffer_offset = material.data_buffer_offset;
+  builder.writeMaterialSet(device, ds, resources);
+  instance->ds = ds;
+  material.owns_set = true;
+}
+void TextureStreamer::retireSet(VkDescriptorSet ds) {
+  m_retired_sets.push_back(
+      {ds, static_cast<uint64_t>(m_engine->frame_number)});
+}
@@ -0,0 +1,174 @@
+#include "vk_call_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace vkstats {
+
+namespace detail {
+std::atomic<bool> g_active{false};
+std::atomic<bool> g_time_calls{false};
+} // namespace detail
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Written by recording threads of the current pass.
+struct PassCounters {
+  std::array<std::atomic<uint32_t>, kCalls> counts{};
+  std::array<std::atomic<int64_t>, kCalls> call_ns{};
+};
+/// @brief Sums and maxima over frames, counts may overflow 32 bits.
+struct Accumulated {
+  uint32_t n_frames{0};
+  std::array<std::array<double, kCalls>, kPasses> count_sum{};
+  std::array<std::array<uint32_t, kCalls>, kPasses> count_max{};
+  std::array<std::array<double, kCalls>, kPasses> call_ms_sum{};
+  std::array<double, kPasses> pass_ms_sum{};
+  std::array<float, kPasses> pass_ms_max{};
+  double record_ms_sum{0.0};
+  float record_ms_max{0.f};
+};
+struct State {
+  bool enabled{false};
+  std::atomic<Pass> pass{Pass::Other};
+  std::array<PassCounters, kPasses> counters;
+  std::array<float, kPasses> pass_ms{}; // Recording thread only.
+  Clock::time_point frame_start;
+  FrameCallStats last;
+  Accumulated accumulated;
+};
+State g_state;
+
+float toMs(Clock::duration d) {
+  return std::chrono::duration<float, std::milli>(d).count();
+}
+} // namespace
+
+const char *callName(Call call) {
+  static const char *kNames[kCalls] = {
+      "vkCmdBindPipeline",        "vkCmdBindDescriptorSets",
+      "vkCmdPushConstants",       "vkCmdBindIndexBuffer",
+      "vkCmdDrawIndexed",         "vkCmdDrawIndexedIndirect",
+      "vkCmdDispatch",
+  };
+  return kNames[static_cast<size_t>(call)];
+}
+const char *passName(Pass pass) {
+  static const char *kNames[kPasses] = {
+      "other",    "background",    "culling",  "depth_pyramid",
+      "lighting", "depth_prepass", "geometry", "capture",
+      "upscale",
+  };
+  return kNames[static_cast<size_t>(pass)];
+}
+
+void setEnabled(bool enabled) { g_state.enabled = enabled; }
+bool enabled() { return g_state.enabled; }
+void setTimeCalls(bool time_calls) {
+  detail::g_time_calls.store(time_calls, std::memory_order_relaxed);
+}
+bool timeCalls() {
+  return detail::g_time_calls.load(std::memory_order_relaxed);
+}
+
+void beginFrame() {
+  detail::g_active.store(g_state.enabled, std::memory_order_relaxed);
+  if (g_state.enabled)
+    g_state.frame_start = Clock::now();
+}
+void endFrame() {
+  if (!detail::g_active.load(std::memory_order_relaxed))
+    return;
+  // Calls between frames, such as uploads, are not counted.
+  detail::g_active.store(false, std::memory_order_relaxed);
+  FrameCallStats &last = g_state.last;
+  Accumulated &acc = g_state.accumulated;
+  last.record_ms = toMs(Clock::now() - g_state.frame_start);
+  for (size_t p = 0; p < kPasses; p++) {
+    PassCounters &counters = g_state.counters[p];
+    PassCallStats &pass = last.passes[p];
+    for (size_t c = 0; c < kCalls; c++) {
+      pass.counts[c] =
+          counters.counts[c].exchange(0, std::memory_order_relaxed);
+      pass.call_ms[c] =
+          counters.call_ns[c].exchange(0, std::memory_order_relaxed) / 1e6f;
+      acc.count_sum[p][c] += pass.counts[c];
+      acc.count_max[p][c] = std::max(acc.count_max[p][c], pass.counts[c]);
+      acc.call_ms_sum[p][c] += pass.call_ms[c];
+    }
+    pass.record_ms = g_state.pass_ms[p];
+    g_state.pass_ms[p] = 0.f;
+    acc.pass_ms_sum[p] += pass.record_ms;
+    acc.pass_ms_max[p] = std::max(acc.pass_ms_max[p], pass.record_ms);
+  }
+  acc.n_frames++;
+  acc.record_ms_sum += last.record_ms;
+  acc.record_ms_max = std::max(acc.record_ms_max, last.record_ms);
+}
+const FrameCallStats &lastFrame() { return g_state.last; }
+void reset() { g_state.accumulated = Accumulated{}; }
+
+bool dump(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file) {
+    fmt::println("Failed to open {}", path);
+    return false;
+  }
+  const Accumulated &acc = g_state.accumulated;
+  double n = std::max(1u, acc.n_frames);
+  fmt::print(file, "{{\n  \"frames\": {},\n", acc.n_frames);
+  fmt::print(file, "  \"calls_timed\": {},\n", timeCalls());
+  fmt::print(file, "  \"record_ms\": {{\"mean\": {:.4f}, \"max\": {:.4f}}},\n",
+             acc.record_ms_sum / n, acc.record_ms_max);
+  fmt::print(file, "  \"passes\": {{\n");
+  for (size_t p = 0; p < kPasses; p++) {
+    fmt::print(file,
+               "    \"{}\": {{\n      \"record_ms\": {{\"mean\": {:.4f}, "
+               "\"max\": {:.4f}}},\n      \"calls\": {{\n",
+               passName(static_cast<Pass>(p)), acc.pass_ms_sum[p] / n,
+               acc.pass_ms_max[p]);
+    // Per frame: mean and max of counts, mean of time inside the calls.
+    for (size_t c = 0; c < kCalls; c++)
+      fmt::print(file,
+                 "        \"{}\": {{\"mean\": {:.2f}, \"max\": {}, "
+                 "\"ms\": {:.4f}}}{}\n",
+                 callName(static_cast<Call>(c)), acc.count_sum[p][c] / n,
+                 acc.count_max[p][c], acc.call_ms_sum[p][c] / n,
+                 c + 1 < kCalls ? "," : "");
+    fmt::print(file, "      }}\n    }}{}\n", p + 1 < kPasses ? "," : "");
+  }
+  fmt::print(file, "  }}\n}}\n");
+  fclose(file);
+  fmt::println("Vulkan call stats written to {}", path);
+  return true;
+}
+
+PassScope::PassScope(Pass pass) {
+  m_previous = g_state.pass.exchange(pass, std::memory_order_relaxed);
+  if (detail::g_active.load(std::memory_order_relaxed))
+    m_start = Clock::now();
+}
+PassScope::~PassScope() {
+  Pass pass = g_state.pass.exchange(m_previous, std::memory_order_relaxed);
+  if (detail::g_active.load(std::memory_order_relaxed))
+    g_state.pass_ms[static_cast<size_t>(pass)] += toMs(Clock::now() - m_start);
+}
+
+namespace detail {
+static PassCounters &currentCounters() {
+  Pass pass = g_state.pass.load(std::memory_order_relaxed);
+  return g_state.counters[static_cast<size_t>(pass)];
+}
+void count(Call call) {
+  currentCounters().counts[static_cast<size_t>(call)].fetch_add(
+      1, std::memory_order_relaxed);
+}
+void addTime(Call call, std::chrono::steady_clock::duration elapsed) {
+  currentCounters().call_ns[static_cast<size_t>(call)].fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+      std::memory_order_relaxed);
+}
+} // namespace detail
+
+} // namespace vkstats
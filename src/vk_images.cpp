@@ -19,10 +19,13 @@ void vkutil::transitionImage(VkCommandBuffer cmd, VkImage image,
   img_barrier.oldLayout = cur_layout;
   img_barrier.newLayout = new_layout;
 
+  auto isDepth = [](VkImageLayout layout) {
+    return layout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL ||
+           layout == VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+  };
   VkImageAspectFlags aspectMask =
-      (new_layout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL)
-          ? VK_IMAGE_ASPECT_DEPTH_BIT
-          : VK_IMAGE_ASPECT_COLOR_BIT;
+      (isDepth(new_layout) || isDepth(cur_layout)) ? VK_IMAGE_ASPECT_DEPTH_BIT
+                                                   : VK_IMAGE_ASPECT_COLOR_BIT;
   img_barrier.subresourceRange = vkinit::imageSubresourceRange(aspectMask);
   img_barrier.image = image;
 
@@ -37,6 +40,61 @@ void vkutil::transitionImage(VkCommandBuffer cmd, VkImage image,
   vkCmdPipelineBarrier2(cmd, &dep_info);
 }
 
+void vkutil::transferImageOwnership(VkCommandBuffer cmd, VkImage image,
+                                    VkImageLayout cur_layout,
+                                    VkImageLayout new_layout,
+                                    uint32_t src_queue_family,
+                                    uint32_t dst_queue_family) {
+  VkImageMemoryBarrier2 img_barrier{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+  img_barrier.pNext = nullptr;
+
+  img_barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  img_barrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+  img_barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  img_barrier.dstAccessMask =
+      VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT;
+
+  img_barrier.oldLayout = cur_layout;
+  img_barrier.newLayout = new_layout;
+  // Ignored if both are the same family.
+  img_barrier.srcQueueFamilyIndex = src_queue_family;
+  img_barrier.dstQueueFamilyIndex = dst_queue_family;
+
+  img_barrier.subresourceRange =
+      vkinit::imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+  img_barrier.image = image;
+
+  VkDependencyInfo dep_info{};
+  dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dep_info.pNext = nullptr;
+  dep_info.imageMemoryBarrierCount = 1;
+  dep_info.pImageMemoryBarriers = &img_barrier;
+
+  vkCmdPipelineBarrier2(cmd, &dep_info);
+}
+
+void vkutil::memoryBarrier(VkCommandBuffer cmd,
+                           VkPipelineStageFlags2 src_stage,
+                           VkAccessFlags2 src_access,
+                           VkPipelineStageFlags2 dst_stage,
+                           VkAccessFlags2 dst_access) {
+  VkMemoryBarrier2 barrier{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+  barrier.pNext = nullptr;
+  barrier.srcStageMask = src_stage;
+  barrier.srcAccessMask = src_access;
+  barrier.dstStageMask = dst_stage;
+  barrier.dstAccessMask = dst_access;
+
+  VkDependencyInfo dep_info{};
+  dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dep_info.pNext = nullptr;
+  dep_info.memoryBarrierCount = 1;
+  dep_info.pMemoryBarriers = &barrier;
+
+  vkCmdPipelineBarrier2(cmd, &dep_info);
+}
+
 void vkutil::copyImage(VkCommandBuffer cmd, VkImage src, VkImage dst,
                        VkExtent2D src_size, VkExtent2D dst_size) {
   VkImageBlit2 blit_region{.sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2,
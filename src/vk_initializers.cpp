@@ -11,15 +11,16 @@ vkinit::cmdPoolCreateInfo(uint32_t queue_family_idx,
   return info;
 }
 
-VkCommandBufferAllocateInfo vkinit::cmdBufferAllocInfo(VkCommandPool pool,
-                                                       uint32_t count /*= 1*/) {
+VkCommandBufferAllocateInfo
+vkinit::cmdBufferAllocInfo(VkCommandPool pool, uint32_t count /*= 1*/,
+                           VkCommandBufferLevel level /*= PRIMARY*/) {
   VkCommandBufferAllocateInfo info = {};
   info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
   info.pNext = nullptr;
 
   info.commandPool = pool;
   info.commandBufferCount = count;
-  info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  info.level = level;
   return info;
 }
 
@@ -54,19 +55,30 @@ vkinit::semaphoreCreateInfo(VkSemaphoreCreateFlags flags /*= 0*/) {
   info.flags = flags;
   return info;
 }
+
+VkSemaphoreTypeCreateInfo
+vkinit::semaphoreTypeCreateInfo(VkSemaphoreType type,
+                                uint64_t initial_value /*= 0*/) {
+  VkSemaphoreTypeCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  info.pNext = nullptr;
+  info.semaphoreType = type;
+  info.initialValue = initial_value;
+  return info;
+}
 //< init_sync
 
 //> init_submit
 VkSemaphoreSubmitInfo
 vkinit::semaphoreSubmitInfo(VkPipelineStageFlags2 stage_mask,
-                            VkSemaphore semaphore) {
+                            VkSemaphore semaphore, uint64_t value /*= 1*/) {
   VkSemaphoreSubmitInfo submit_info{};
   submit_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
   submit_info.pNext = nullptr;
   submit_info.semaphore = semaphore;
   submit_info.stageMask = stage_mask;
   submit_info.deviceIndex = 0;
-  submit_info.value = 1;
+  submit_info.value = value;
 
   return submit_info;
 }
@@ -164,7 +176,8 @@ vkinit::renderingInfo(VkExtent2D render_extent,
 
   render_info.renderArea = VkRect2D{VkOffset2D{0, 0}, render_extent};
   render_info.layerCount = 1;
-  render_info.colorAttachmentCount = 1;
+  // Depth only if no color attachment.
+  render_info.colorAttachmentCount = color_attachment ? 1 : 0;
   render_info.pColorAttachments = color_attachment;
   render_info.pDepthAttachment = depth_attachment;
   render_info.pStencilAttachment = nullptr;
@@ -2,11 +2,19 @@
 #include <iostream>
 #include "vk_loader.h"
 
+#include "asset_cache.h"
 #include "engine.h"
+#include "mesh_processing.h"
 #include "vk_initializers.h"
 #include "vk_types.h"
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/quaternion.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <unordered_set>
 
 #include "stb_image.h"
 #include "stb_image_write.h"
@@ -39,49 +47,35 @@ VkSamplerMipmapMode extractMipmapMode(fastgltf::Filter filter) {
     return VK_SAMPLER_MIPMAP_MODE_LINEAR;
   }
 }
-std::optional<AllocatedImage> loadImage(Engine *engine, fastgltf::Asset &asset,
-                                        fastgltf::Image &image) {
-  bool mipmap = true;
-  AllocatedImage newImage{};
-  int w, h, n_channels;
+/// @brief Encoded bytes of an image, files are read into memory.
+struct EncodedImage {
+  std::vector<uint8_t> file_bytes;
+  std::span<const uint8_t> bytes;
+};
+EncodedImage readImage(fastgltf::Asset &asset, fastgltf::Image &image) {
+  EncodedImage encoded;
   std::visit(
       fastgltf::visitor{
           [](auto &) {},
           [&](fastgltf::sources::URI &filePath) {
-            // fmt::println("file path {}", filePath.uri.c_str());
             // We don't support offsets with stbi.
             assert(filePath.fileByteOffset == 0);
             assert(filePath.uri.isLocalPath());
             const std::string path(filePath.uri.path().begin(),
                                    filePath.uri.path().end());
-            unsigned char *data =
-                stbi_load(path.c_str(), &w, &h, &n_channels, 4);
-            if (data) {
-              VkExtent3D img_size;
-              img_size.width = w;
-              img_size.height = h;
-              img_size.depth = 1;
-              newImage =
-                  engine->createImage(data, img_size, VK_FORMAT_R8G8B8A8_UNORM,
-                                      VK_IMAGE_USAGE_SAMPLED_BIT, mipmap);
-              stbi_image_free(data);
-            }
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file.is_open())
+              return;
+            encoded.file_bytes.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(reinterpret_cast<char *>(encoded.file_bytes.data()),
+                      encoded.file_bytes.size());
+            encoded.bytes = encoded.file_bytes;
           },
           [&](fastgltf::sources::Vector &vector) {
-            // fmt::println("source vector");
-            unsigned char *data = stbi_load_from_memory(
-                (unsigned char *)vector.bytes.data(),
-                static_cast<int>(vector.bytes.size()), &w, &h, &n_channels, 4);
-            if (data) {
-              VkExtent3D img_size;
-              img_size.width = w;
-              img_size.height = h;
-              img_size.depth = 1;
-              newImage =
-                  engine->createImage(data, img_size, VK_FORMAT_R8G8B8A8_UNORM,
-                                      VK_IMAGE_USAGE_SAMPLED_BIT, mipmap);
-              stbi_image_free(data);
-            }
+            encoded.bytes = std::span(
+                reinterpret_cast<const uint8_t *>(vector.bytes.data()),
+                vector.bytes.size());
           },
           [&](fastgltf::sources::BufferView &view) {
             auto &bufferView = asset.bufferViews[view.bufferViewIndex];
@@ -89,42 +83,249 @@ std::optional<AllocatedImage> loadImage(Engine *engine, fastgltf::Asset &asset,
             std::visit(fastgltf::visitor{
                            [](auto &) { fmt::println("empty"); },
                            [&](fastgltf::sources::Array &arr) {
-                             unsigned char *data = stbi_load_from_memory(
-                                 (unsigned char *)arr.bytes.data() +
+                             encoded.bytes = std::span(
+                                 reinterpret_cast<const uint8_t *>(
+                                     arr.bytes.data()) +
                                      bufferView.byteOffset,
-                                 static_cast<int>(bufferView.byteLength), &w,
-                                 &h, &n_channels, 4);
-                             if (data) {
-                               VkExtent3D imagesize;
-                               imagesize.width = w;
-                               imagesize.height = h;
-                               imagesize.depth = 1;
-                               newImage = engine->createImage(
-                                   data, imagesize, VK_FORMAT_R8G8B8A8_UNORM,
-                                   VK_IMAGE_USAGE_SAMPLED_BIT, mipmap);
-
-                               stbi_image_free(data);
-                             }
+                                 bufferView.byteLength);
                            },
                        },
                        buffer.data);
           },
       },
       image.data);
-  // if any of the attempts to load the data failed, we haven't written the
-  // image so handle is null
-  if (newImage.image == VK_NULL_HANDLE) {
+  return encoded;
+}
+/// @brief Decode to RGBA8 and build the mip chain, thread safe.
+std::optional<TextureSource> decodeImage(std::span<const uint8_t> bytes) {
+  if (bytes.empty())
     return {};
-  } else {
-    return newImage;
+  int w, h, n_channels;
+  unsigned char *data =
+      stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()), &w,
+                            &h, &n_channels, 4);
+  if (!data)
+    return {};
+  TextureSource source = texutil::buildMipChain(data, w, h);
+  stbi_image_free(data);
+  return source;
+}
+bool readPrimitive(fastgltf::Asset &gltf, fastgltf::Primitive &p,
+                   std::vector<uint32_t> &indices,
+                   std::vector<Vertex> &vertices) {
+  size_t initial_vtx = vertices.size();
+  { // load indexes
+    fastgltf::Accessor &accessor = gltf.accessors[p.indicesAccessor.value()];
+    indices.reserve(indices.size() + accessor.count);
+    fastgltf::iterateAccessor<std::uint32_t>(
+        gltf, accessor,
+        [&](std::uint32_t idx) { indices.push_back(idx + initial_vtx); });
+  }
+  { // load vertex positions
+    fastgltf::Accessor &posAccessor =
+        gltf.accessors[p.findAttribute("POSITION")->accessorIndex];
+    vertices.resize(vertices.size() + posAccessor.count);
+    fastgltf::iterateAccessorWithIndex<glm::vec3>(
+        gltf, posAccessor, [&](glm::vec3 v, size_t index) {
+          Vertex new_vert;
+          new_vert.position = v;
+          new_vert.normal = {1, 0, 0};
+          new_vert.color = glm::vec4{1.f};
+          new_vert.uv_x = 0;
+          new_vert.uv_y = 0;
+          vertices[initial_vtx + index] = new_vert;
+        });
+  }
+  auto normals = p.findAttribute("NORMAL");
+  if (normals != p.attributes.end()) {
+    fastgltf::iterateAccessorWithIndex<glm::vec3>(
+        gltf, gltf.accessors[(*normals).accessorIndex],
+        [&](glm::vec3 v, size_t index) {
+          vertices[initial_vtx + index].normal = v;
+        });
+  }
+  auto uv = p.findAttribute("TEXCOORD_0");
+  if (uv != p.attributes.end()) {
+    fastgltf::iterateAccessorWithIndex<glm::vec2>(
+        gltf, gltf.accessors[(*uv).accessorIndex],
+        [&](glm::vec2 v, size_t index) {
+          vertices[initial_vtx + index].uv_x = v.x;
+          vertices[initial_vtx + index].uv_y = v.y;
+        });
   }
+  bool has_color = false;
+  auto color_attr = p.findAttribute("COLOR_0");
+  if (color_attr != p.attributes.end()) {
+    has_color = true;
+    fastgltf::iterateAccessorWithIndex<glm::vec4>(
+        gltf, gltf.accessors[(*color_attr).accessorIndex],
+        [&](glm::vec4 v, size_t index) {
+          vertices[initial_vtx + index].color = v;
+        });
+  }
+  return has_color;
 }
-std::optional<std::shared_ptr<LoadedGLTF>>
-loadGltf(Engine *engine, std::filesystem::path file_path) {
+/// @brief CPU side geometry of a mesh while loading.
+struct MeshGeometry {
+  MeshAsset *mesh;
+  std::vector<uint32_t> indices;
+  std::vector<Vertex> vertices;
+  std::vector<Meshlet> meshlets;
+  std::vector<CompactVertex> compact_vertices;
+  std::vector<uint32_t> colors;
+  // Vertices owned by each surface, first and past the last.
+  std::vector<std::pair<size_t, size_t>> vertex_ranges;
+  // Back faces are visible on double-sided surfaces, no cone culling.
+  std::vector<bool> cone_culling;
+  bool has_color = false;
+  // Over full detail surfaces, as authored and after optimization.
+  meshutil::VertexCacheStats cache_before{0.f, 0.f};
+  meshutil::VertexCacheStats cache_after{0.f, 0.f};
+};
+/**
+ * @brief Optimize index order, build LODs and meshlets, then encode vertices.
+ *        Touches nothing but geometry, safe to run on worker threads.
+ */
+void processMesh(MeshGeometry &geometry, bool compact) {
+  std::vector<uint32_t> &indices = geometry.indices;
+  std::vector<Vertex> &vertices = geometry.vertices;
+  std::vector<GeometrySurface> &surfaces = geometry.mesh->surfaces;
+  auto cacheStats = [&]() {
+    float n_misses = 0.f, n_unique = 0.f, n_triangles = 0.f;
+    for (const GeometrySurface &surface : surfaces) {
+      auto range =
+          std::span(indices).subspan(surface.start_index, surface.count);
+      meshutil::VertexCacheStats stats = meshutil::analyzeVertexCache(range);
+      float surface_misses = stats.acmr * (surface.count / 3);
+      n_misses += surface_misses;
+      n_unique += stats.atvr > 0.f ? surface_misses / stats.atvr : 0.f;
+      n_triangles += surface.count / 3;
+    }
+    return meshutil::VertexCacheStats{n_misses / std::max(n_triangles, 1.f),
+                                      n_misses / std::max(n_unique, 1.f)};
+  };
+  geometry.cache_before = cacheStats();
+
+  // Cache order first, then clusters of it sorted against overdraw.
+  std::vector<uint32_t> clusters;
+  for (GeometrySurface &surface : surfaces) {
+    auto range =
+        std::span(indices).subspan(surface.start_index, surface.count);
+    meshutil::optimizeVertexCache(range, &clusters);
+    meshutil::optimizeOverdraw(range, vertices, clusters);
+  }
+  // Coarser LODs share the vertices, appended after all surfaces.
+  for (GeometrySurface &surface : surfaces) {
+    meshutil::generateLods(indices, vertices, surface);
+    for (SurfaceLod &lod : surface.lods)
+      meshutil::optimizeVertexCache(
+          std::span(indices).subspan(lod.start_index, lod.count));
+  }
+  // LODs only use vertices of their surface, so surfaces still own
+  // contiguous vertex ranges after the reorder.
+  meshutil::optimizeVertexFetch(indices, vertices);
+  for (size_t i = 0; i < surfaces.size(); i++) {
+    auto range =
+        std::span(indices).subspan(surfaces[i].start_index, surfaces[i].count);
+    if (range.empty()) {
+      geometry.vertex_ranges[i] = {0, 0};
+      continue;
+    }
+    auto [min_it, max_it] = std::minmax_element(range.begin(), range.end());
+    geometry.vertex_ranges[i] = {*min_it, *max_it + 1};
+  }
+  geometry.cache_after = cacheStats();
+
+  // Every LOD gets its own meshlets.
+  for (size_t i = 0; i < surfaces.size(); i++) {
+    GeometrySurface &surface = surfaces[i];
+    surface.first_meshlet = static_cast<uint32_t>(geometry.meshlets.size());
+    surface.meshlet_count = meshutil::buildMeshlets(
+        indices, vertices, surface.start_index, surface.count,
+        geometry.cone_culling[i], geometry.meshlets);
+    for (SurfaceLod &lod : surface.lods) {
+      lod.first_meshlet = static_cast<uint32_t>(geometry.meshlets.size());
+      lod.meshlet_count = meshutil::buildMeshlets(
+          indices, vertices, lod.start_index, lod.count,
+          geometry.cone_culling[i], geometry.meshlets);
+    }
+  }
+  // Indices relative to the surface vertex range, so the mesh can upload
+  // 16-bit indices when each surface fits even if the whole mesh does not.
+  bool rebase = vertices.size() > UINT16_MAX + 1 &&
+                std::all_of(geometry.vertex_ranges.begin(),
+                            geometry.vertex_ranges.end(), [](auto range) {
+                              return range.second - range.first <=
+                                     UINT16_MAX + 1;
+                            });
+  for (size_t i = 0; rebase && i < surfaces.size(); i++) {
+    GeometrySurface &surface = surfaces[i];
+    surface.base_vertex =
+        static_cast<uint32_t>(geometry.vertex_ranges[i].first);
+    auto rebaseRange = [&](uint32_t start, uint32_t count) {
+      for (uint32_t k = start; k < start + count; k++)
+        indices[k] -= surface.base_vertex;
+    };
+    rebaseRange(surface.start_index, surface.count);
+    for (const SurfaceLod &lod : surface.lods)
+      rebaseRange(lod.start_index, lod.count);
+  }
+  if (!compact)
+    return;
+  geometry.compact_vertices.resize(vertices.size());
+  geometry.colors.resize(geometry.has_color ? vertices.size() : 0);
+  for (size_t i = 0; i < surfaces.size(); i++) {
+    auto [first, last] = geometry.vertex_ranges[i];
+    std::span<uint32_t> surface_colors;
+    if (geometry.has_color)
+      surface_colors = std::span(geometry.colors).subspan(first, last - first);
+    meshutil::compressVertices(
+        std::span(vertices).subspan(first, last - first), surfaces[i].bound,
+        std::span(geometry.compact_vertices).subspan(first, last - first),
+        surface_colors);
+  }
+}
+/// @brief Material to write, images and samplers by staged index.
+struct StagedMaterial {
+  std::string name;
+  GLTFMetallicRoughness::MaterialConstants constants;
+  MaterialPass pass;
+  std::optional<size_t> color_image;
+  std::optional<size_t> color_sampler; // Default linear if none.
+};
+struct StagedNode {
+  std::string name;
+  std::optional<size_t> mesh;
+  glm::mat4 transform;
+  std::vector<size_t> children;
+};
+/**
+ * @brief CPU side of a scene between parseGltf() or generateScene() and
+ *        finishGltf(). Nothing past parsing reads the glTF asset itself.
+ */
+struct GltfStaging {
+  fastgltf::Asset gltf; // Encoded images may point into its buffers.
+  bool compact_vertices;
+  // By image, bytes are kept only for decoding on the main thread.
+  std::vector<EncodedImage> encoded;
+  std::vector<uint64_t> hashes;
+  std::vector<std::optional<TextureSource>> sources;
+  std::vector<VkSamplerCreateInfo> samplers;
+  std::vector<StagedMaterial> material_infos;
+  std::vector<StagedNode> nodes;
+  // Filled by finishGltf(), surfaces point to them already.
+  std::vector<std::shared_ptr<GLTFMaterial>> materials;
+  std::vector<std::shared_ptr<MeshAsset>> meshes;
+  std::vector<MeshGeometry> geometries;
+};
+std::shared_ptr<GltfStaging> parseGltf(Engine *engine,
+                                       std::filesystem::path file_path,
+                                       bool compact_vertices) {
   fmt::println("Loading GLTF: {}", file_path.string());
-  std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
-  scene->creator = engine;
-  LoadedGLTF &file = *scene.get();
+  std::shared_ptr<GltfStaging> staging_ptr = std::make_shared<GltfStaging>();
+  GltfStaging &staging = *staging_ptr;
+  staging.compact_vertices = compact_vertices;
+  fastgltf::Asset &gltf = staging.gltf;
 
   fastgltf::Parser parser{};
   constexpr auto kGltfOptions = fastgltf::Options::DontRequireValidAssetMember |
@@ -134,41 +335,79 @@ loadGltf(Engine *engine, std::filesystem::path file_path) {
   auto data = fastgltf::GltfDataBuffer::FromPath(file_path);
   if (data.error() != fastgltf::Error::None) {
     fmt::println("Error loading GLTF from file.");
-    return {};
+    return nullptr;
   }
-  fastgltf::Asset gltf;
   std::filesystem::path path = file_path;
   auto type = fastgltf::determineGltfFileType(data.get());
   if (type == fastgltf::GltfType::glTF) {
     auto load = parser.loadGltf(data.get(), path.parent_path(), kGltfOptions);
     if (load) {
-      gltf = std::move(load.get());
+      staging.gltf = std::move(load.get());
     } else {
       std::cerr << "Failed to load glTF: "
                 << fastgltf::to_underlying(load.error()) << std::endl;
-      return {};
+      return nullptr;
     }
   } else if (type == fastgltf::GltfType::GLB) {
     auto load =
         parser.loadGltfBinary(data.get(), path.parent_path(), kGltfOptions);
     if (load) {
-      gltf = std::move(load.get());
+      staging.gltf = std::move(load.get());
     } else {
       std::cerr << "Failed to load glTF: "
                 << fastgltf::to_underlying(load.error()) << std::endl;
-      return {};
+      return nullptr;
     }
   } else {
     std::cerr << "Failed to determine glTF container" << std::endl;
-    return {};
+    return nullptr;
   }
-  std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
-      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
-      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
-      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}};
+  // Images already cached by content are not decoded again, nor are
+  // duplicates in this file. The cache may drop one before finishGltf(),
+  // which then decodes it from the kept bytes. Hashing, then decoding once
+  // all are hashed, runs in jobs meanwhile the geometry below is read.
+  std::vector<EncodedImage> &encoded = staging.encoded;
+  std::vector<uint64_t> &hashes = staging.hashes;
+  encoded.resize(gltf.images.size());
+  hashes.resize(gltf.images.size());
+  staging.sources.resize(gltf.images.size());
+  JobCounter hashed;
+  JobCounter images_done;
+  for (size_t i = 0; i < gltf.images.size(); i++) {
+    engine->m_jobs.run(
+        "hash image",
+        [&, i]() {
+          encoded[i] = readImage(gltf, gltf.images[i]);
+          hashes[i] = assetutil::hashBytes(encoded[i].bytes.data(),
+                                           encoded[i].bytes.size());
+        },
+        &hashed);
+  }
+  engine->m_jobs.runAfter(
+      hashed, "dedup images",
+      [&]() {
+        std::unordered_set<uint64_t> seen;
+        for (size_t i = 0; i < gltf.images.size(); i++) {
+          bool first =
+              !encoded[i].bytes.empty() && seen.insert(hashes[i]).second;
+          if (!first) {
+            encoded[i] = EncodedImage{};
+            continue;
+          }
+          if (engine->m_assets.hasTexture(hashes[i]))
+            continue;
+          // Counted before this job finishes, images_done waits for it.
+          engine->m_jobs.run(
+              "decode image",
+              [&, i]() {
+                staging.sources[i] = decodeImage(encoded[i].bytes);
+                encoded[i] = EncodedImage{};
+              },
+              &images_done);
+        }
+      },
+      &images_done);
 
-  file.descriptor_pool.initPool(engine->m_device, gltf.materials.size(), sizes);
-  // load samplers
   for (fastgltf::Sampler &sampler : gltf.samplers) {
     VkSamplerCreateInfo ci_sampler = {
         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr};
@@ -180,52 +419,404 @@ loadGltf(Engine *engine, std::filesystem::path file_path) {
         extractFilter(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
     ci_sampler.mipmapMode = extractMipmapMode(
         sampler.minFilter.value_or(fastgltf::Filter::Nearest));
-    VkSampler newSampler;
-    VK_CHECK(
-        vkCreateSampler(engine->m_device, &ci_sampler, nullptr, &newSampler));
-    file.samplers.push_back(newSampler);
+    staging.samplers.push_back(ci_sampler);
   }
-  std::vector<std::shared_ptr<MeshAsset>> meshes;
-  std::vector<std::shared_ptr<Node>> nodes;
-  std::vector<AllocatedImage> images;
-  std::vector<std::shared_ptr<GLTFMaterial>> materials;
+  for (fastgltf::Material &mat : gltf.materials) {
+    staging.materials.push_back(std::make_shared<GLTFMaterial>());
+    StagedMaterial info;
+    info.name = mat.name.c_str();
+    info.constants.color_factors.x = mat.pbrData.baseColorFactor[0];
+    info.constants.color_factors.y = mat.pbrData.baseColorFactor[1];
+    info.constants.color_factors.z = mat.pbrData.baseColorFactor[2];
+    info.constants.color_factors.w = mat.pbrData.baseColorFactor[3];
+    info.constants.metal_rough_factors.x = mat.pbrData.metallicFactor;
+    info.constants.metal_rough_factors.y = mat.pbrData.roughnessFactor;
+    info.pass = mat.alphaMode == fastgltf::AlphaMode::Blend
+                    ? MaterialPass::BasicTransparent
+                    : MaterialPass::BasicMainColor;
+    if (mat.pbrData.baseColorTexture.has_value()) {
+      fastgltf::Texture &texture =
+          gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex];
+      if (texture.imageIndex.has_value())
+        info.color_image = texture.imageIndex.value();
+      if (texture.samplerIndex.has_value())
+        info.color_sampler = texture.samplerIndex.value();
+    }
+    staging.material_infos.push_back(info);
+  }
+  for (fastgltf::Node &node : gltf.nodes) {
+    StagedNode staged;
+    staged.name = node.name.c_str();
+    if (node.meshIndex.has_value())
+      staged.mesh = node.meshIndex.value();
+    std::visit(
+        fastgltf::visitor{
+            [&](fastgltf::math::fmat4x4 matrix) {
+              memcpy(&staged.transform, matrix.data(), sizeof(matrix));
+            },
+            [&](fastgltf::TRS transform) {
+              glm::vec3 tl(transform.translation[0], transform.translation[1],
+                           transform.translation[2]);
+              glm::quat rot(transform.rotation[3], transform.rotation[0],
+                            transform.rotation[1], transform.rotation[2]);
+              glm::vec3 sc(transform.scale[0], transform.scale[1],
+                           transform.scale[2]);
+              glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
+              glm::mat4 rm = glm::toMat4(rot);
+              glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
+              staged.transform = tm * rm * sm;
+            }},
+        node.transform);
+    staged.children.assign(node.children.begin(), node.children.end());
+    staging.nodes.push_back(std::move(staged));
+  }
+  // Geometry is read here, processed in parallel, then uploaded in order.
+  std::vector<MeshGeometry> &geometries = staging.geometries;
+  geometries.resize(gltf.meshes.size());
+  for (size_t m = 0; m < gltf.meshes.size(); m++) {
+    fastgltf::Mesh &mesh = gltf.meshes[m];
+    std::shared_ptr<MeshAsset> new_mesh = std::make_shared<MeshAsset>();
+    staging.meshes.push_back(new_mesh);
+    new_mesh->name = mesh.name;
+    MeshGeometry &geometry = geometries[m];
+    geometry.mesh = new_mesh.get();
+    std::vector<uint32_t> &indices = geometry.indices;
+    std::vector<Vertex> &vertices = geometry.vertices;
+    for (auto &&p : mesh.primitives) {
+      GeometrySurface new_surface;
+      new_surface.start_index = (uint32_t)indices.size();
+      new_surface.count =
+          (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+      size_t initial_vtx = vertices.size();
+      if (readPrimitive(gltf, p, indices, vertices))
+        geometry.has_color = true;
+      geometry.vertex_ranges.push_back({initial_vtx, vertices.size()});
+      if (p.materialIndex.has_value())
+        new_surface.material = staging.materials[p.materialIndex.value()];
+      else
+        new_surface.material = staging.materials[0];
+      geometry.cone_culling.push_back(
+          !(p.materialIndex.has_value() &&
+            gltf.materials[p.materialIndex.value()].doubleSided));
+
+      glm::vec3 min_pos = vertices[initial_vtx].position;
+      glm::vec3 max_pos = vertices[initial_vtx].position;
+      for (size_t i = initial_vtx; i < vertices.size(); i++) {
+        min_pos = glm::min(min_pos, vertices[i].position);
+        max_pos = glm::max(max_pos, vertices[i].position);
+      }
+      new_surface.bound.origin = 0.5f * (min_pos + max_pos);
+      new_surface.bound.radius = glm::length(0.5f * (max_pos - min_pos));
 
-  for (fastgltf::Image &image : gltf.images) {
-    std::optional<AllocatedImage> img = loadImage(engine, gltf, image);
-    if (img.has_value()) {
-      images.push_back(*img);
-      file.images[image.name.c_str()] = *img;
+      new_mesh->surfaces.push_back(new_surface);
+    }
+  }
+  engine->m_jobs.parallelFor("process mesh", geometries.size(), 1,
+                             [&](size_t begin, size_t end) {
+                               for (size_t m = begin; m < end; m++)
+                                 processMesh(geometries[m], compact_vertices);
+                             });
+  // Jobs above reference locals.
+  engine->m_jobs.wait(images_done);
+  return staging_ptr;
+}
+namespace {
+/// @brief Portable across standard libraries, unlike std distributions.
+float uniform(std::mt19937 &rng) { return (rng() >> 8) * (1.f / 16777216.f); }
+/**
+ * @brief Rings [ring_begin, ring_end] of a UV sphere as one surface. Radius
+ *        is displaced by a seeded wave so meshes differ.
+ */
+void appendSphereBand(MeshGeometry &geometry, uint32_t rings,
+                      uint32_t segments, uint32_t ring_begin,
+                      uint32_t ring_end, glm::vec3 wave,
+                      std::shared_ptr<GLTFMaterial> material) {
+  std::vector<uint32_t> &indices = geometry.indices;
+  std::vector<Vertex> &vertices = geometry.vertices;
+  GeometrySurface surface;
+  surface.start_index = static_cast<uint32_t>(indices.size());
+  uint32_t initial_vtx = static_cast<uint32_t>(vertices.size());
+  for (uint32_t r = ring_begin; r <= ring_end; r++) {
+    float theta = glm::pi<float>() * r / rings;
+    for (uint32_t s = 0; s <= segments; s++) {
+      float phi = glm::two_pi<float>() * s / segments;
+      glm::vec3 dir{std::sin(theta) * std::cos(phi), std::cos(theta),
+                    std::sin(theta) * std::sin(phi)};
+      float radius = 1.f + wave.z * std::sin(wave.x * theta) *
+                               std::sin(wave.y * phi);
+      Vertex vertex;
+      vertex.position = radius * dir;
+      vertex.normal = dir;
+      vertex.color = glm::vec4{1.f};
+      vertex.uv_x = static_cast<float>(s) / segments;
+      vertex.uv_y = static_cast<float>(r) / rings;
+      vertices.push_back(vertex);
+    }
+  }
+  // Counter-clockwise from outside, degenerate triangles at poles skipped.
+  uint32_t row = segments + 1;
+  for (uint32_t r = ring_begin; r < ring_end; r++) {
+    for (uint32_t s = 0; s < segments; s++) {
+      uint32_t a = initial_vtx + (r - ring_begin) * row + s;
+      uint32_t b = a + 1, c = a + row, d = c + 1;
+      if (r > 0)
+        indices.insert(indices.end(), {a, b, c});
+      if (r + 1 < rings)
+        indices.insert(indices.end(), {b, d, c});
+    }
+  }
+  surface.count = static_cast<uint32_t>(indices.size()) - surface.start_index;
+  surface.material = std::move(material);
+  glm::vec3 min_pos = vertices[initial_vtx].position;
+  glm::vec3 max_pos = vertices[initial_vtx].position;
+  for (size_t i = initial_vtx; i < vertices.size(); i++) {
+    min_pos = glm::min(min_pos, vertices[i].position);
+    max_pos = glm::max(max_pos, vertices[i].position);
+  }
+  surface.bound.origin = 0.5f * (min_pos + max_pos);
+  surface.bound.radius = glm::length(0.5f * (max_pos - min_pos));
+  geometry.vertex_ranges.push_back({initial_vtx, vertices.size()});
+  geometry.cone_culling.push_back(true);
+  geometry.mesh->surfaces.push_back(surface);
+}
+} // namespace
+
+std::shared_ptr<GltfStaging> generateScene(Engine *engine,
+                                           const SyntheticSceneConfig &config,
+                                           bool compact_vertices) {
+  fmt::println("Generating scene: {} objects, {} meshes, {} materials, {} "
+               "textures, depth {}",
+               config.n_objects, config.n_meshes, config.n_materials,
+               config.n_textures, config.hierarchy_depth);
+  std::shared_ptr<GltfStaging> staging_ptr = std::make_shared<GltfStaging>();
+  GltfStaging &staging = *staging_ptr;
+  staging.compact_vertices = compact_vertices;
+  uint32_t n_meshes = std::max(1u, config.n_meshes);
+  uint32_t n_materials = std::max(1u, config.n_materials);
+  uint32_t n_textures = config.n_textures;
+
+  // Checkers of seeded colors and periods, each one unique to the cache.
+  staging.encoded.resize(n_textures);
+  staging.hashes.resize(n_textures);
+  staging.sources.resize(n_textures);
+  uint32_t size = std::max(4u, config.texture_size);
+  engine->m_jobs.parallelFor(
+      "generate texture", n_textures, 1, [&](size_t begin, size_t end) {
+        std::vector<uint8_t> pixels(size_t(size) * size * 4);
+        for (size_t t = begin; t < end; t++) {
+          std::mt19937 rng(config.seed * 7919u + static_cast<uint32_t>(t));
+          uint8_t colors[2][4];
+          for (auto &color : colors) {
+            for (int k = 0; k < 3; k++)
+              color[k] = static_cast<uint8_t>(rng() & 0xff);
+            color[3] = 0xff;
+          }
+          uint32_t period = 4u << (rng() % 4);
+          for (uint32_t y = 0; y < size; y++)
+            for (uint32_t x = 0; x < size; x++)
+              memcpy(&pixels[(size_t(y) * size + x) * 4],
+                     colors[(x / period + y / period) & 1], 4);
+          staging.hashes[t] = assetutil::hashBytes(pixels.data(),
+                                                   pixels.size());
+          staging.sources[t] = texutil::buildMipChain(pixels.data(), size,
+                                                      size);
+        }
+      });
+  // One linear repeating sampler.
+  VkSamplerCreateInfo ci_sampler = {
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr};
+  ci_sampler.maxLod = VK_LOD_CLAMP_NONE;
+  ci_sampler.minLod = 0;
+  ci_sampler.magFilter = VK_FILTER_LINEAR;
+  ci_sampler.minFilter = VK_FILTER_LINEAR;
+  ci_sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  staging.samplers.push_back(ci_sampler);
+
+  std::mt19937 rng(config.seed);
+  for (uint32_t i = 0; i < n_materials; i++) {
+    staging.materials.push_back(std::make_shared<GLTFMaterial>());
+    StagedMaterial info;
+    info.name = fmt::format("synthetic_material_{}", i);
+    info.constants.color_factors =
+        glm::vec4{0.5f + 0.5f * uniform(rng), 0.5f + 0.5f * uniform(rng),
+                  0.5f + 0.5f * uniform(rng), 1.f};
+    info.constants.metal_rough_factors =
+        glm::vec4{uniform(rng), 0.2f + 0.8f * uniform(rng), 0.f, 0.f};
+    info.pass = MaterialPass::BasicMainColor;
+    if (n_textures > 0) {
+      info.color_image = i % n_textures;
+      info.color_sampler = 0;
+    }
+    staging.material_infos.push_back(info);
+  }
+
+  // Spheres of varying detail, split in bands when there are more
+  // materials than meshes so that every material is drawn.
+  uint32_t n_bands = (n_materials + n_meshes - 1) / n_meshes;
+  uint32_t max_rings = std::max(config.mesh_rings, 2 * n_bands);
+  std::vector<MeshGeometry> &geometries = staging.geometries;
+  geometries.resize(n_meshes);
+  for (uint32_t m = 0; m < n_meshes; m++) {
+    std::shared_ptr<MeshAsset> new_mesh = std::make_shared<MeshAsset>();
+    new_mesh->name = fmt::format("synthetic_mesh_{}", m);
+    staging.meshes.push_back(new_mesh);
+    MeshGeometry &geometry = geometries[m];
+    geometry.mesh = new_mesh.get();
+    uint32_t rings = std::max(n_bands, max_rings / 2 + m % (max_rings / 2 + 1));
+    uint32_t segments = 2 * rings;
+    glm::vec3 wave(1 + rng() % 6, 1 + rng() % 6, 0.2f * uniform(rng));
+    for (uint32_t b = 0; b < n_bands; b++) {
+      uint32_t ring_begin = rings * b / n_bands;
+      uint32_t ring_end = rings * (b + 1) / n_bands;
+      appendSphereBand(geometry, rings, segments, ring_begin, ring_end, wave,
+                       staging.materials[(m * n_bands + b) % n_materials]);
+    }
+  }
+  engine->m_jobs.parallelFor("process mesh", geometries.size(), 1,
+                             [&](size_t begin, size_t end) {
+                               for (size_t m = begin; m < end; m++)
+                                 processMesh(geometries[m], compact_vertices);
+                             });
+
+  // Objects on a jittered grid, then groups of branching nodes under a
+  // parent at their center, depth times. Parents only translate.
+  uint32_t n_objects = config.n_objects;
+  uint32_t side = std::max(
+      1u, static_cast<uint32_t>(std::ceil(std::cbrt(float(n_objects)))));
+  float spacing = config.spacing;
+  glm::vec3 grid_center = glm::vec3{0.5f * (side - 1) * spacing};
+  std::vector<StagedNode> &nodes = staging.nodes;
+  std::vector<glm::mat4> world;
+  std::vector<glm::vec3> centers;
+  nodes.reserve(n_objects + n_objects / 4);
+  world.reserve(nodes.capacity());
+  centers.reserve(nodes.capacity());
+  for (uint32_t i = 0; i < n_objects; i++) {
+    glm::vec3 cell(i % side, (i / side) % side, i / (side * side));
+    glm::vec3 jitter{uniform(rng), uniform(rng), uniform(rng)};
+    glm::vec3 position =
+        cell * spacing - grid_center + (jitter - 0.5f) * 0.5f * spacing;
+    float angle = glm::two_pi<float>() * uniform(rng);
+    float scale = 0.5f + uniform(rng);
+    StagedNode node;
+    node.mesh = rng() % n_meshes;
+    nodes.push_back(std::move(node));
+    world.push_back(glm::translate(glm::mat4(1.f), position) *
+                    glm::rotate(glm::mat4(1.f), angle, glm::vec3{0, 1, 0}) *
+                    glm::scale(glm::mat4(1.f), glm::vec3{scale}));
+    centers.push_back(position);
+  }
+  uint32_t branching = std::max(2u, config.branching);
+  std::vector<size_t> level(n_objects);
+  for (size_t i = 0; i < level.size(); i++)
+    level[i] = i;
+  for (uint32_t d = 0; d < config.hierarchy_depth && level.size() > 1; d++) {
+    std::vector<size_t> parents;
+    for (size_t first = 0; first < level.size(); first += branching) {
+      size_t last = std::min(level.size(), first + branching);
+      StagedNode group;
+      glm::vec3 center{0.f};
+      for (size_t k = first; k < last; k++) {
+        group.children.push_back(level[k]);
+        center += centers[level[k]];
+      }
+      center /= static_cast<float>(last - first);
+      parents.push_back(nodes.size());
+      nodes.push_back(std::move(group));
+      world.push_back(glm::translate(glm::mat4(1.f), center));
+      centers.push_back(center);
+    }
+    level = std::move(parents);
+  }
+  // Local transforms relative to the parent center.
+  std::vector<bool> has_parent(nodes.size(), false);
+  for (size_t p = 0; p < nodes.size(); p++) {
+    for (size_t c : nodes[p].children) {
+      has_parent[c] = true;
+      nodes[c].transform =
+          glm::translate(glm::mat4(1.f), -centers[p]) * world[c];
+    }
+  }
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (!has_parent[i])
+      nodes[i].transform = world[i];
+  }
+  return staging_ptr;
+}
+std::optional<std::shared_ptr<LoadedGLTF>> finishGltf(Engine *engine,
+                                                      GltfStaging &staging) {
+  if (engine->memoryPressure() == MemoryPressure::Critical) {
+    fmt::println("Refused to load GLTF, device memory is nearly full.");
+    return {};
+  }
+  // Refuse before uploading rather than failing an allocation midway.
+  size_t upload_bytes = 0;
+  for (const MeshGeometry &geometry : staging.geometries) {
+    upload_bytes +=
+        geometry.indices.size() * sizeof(uint32_t) +
+        geometry.meshlets.size() * sizeof(Meshlet) +
+        geometry.colors.size() * sizeof(uint32_t) +
+        (staging.compact_vertices
+             ? geometry.compact_vertices.size() * sizeof(CompactVertex)
+             : geometry.vertices.size() * sizeof(Vertex));
+  }
+  if (!engine->hasMemoryFor(upload_bytes)) {
+    fmt::println("Refused to load GLTF, {} KiB of geometry does not fit in "
+                 "device memory budget.",
+                 upload_bytes / 1024);
+    return {};
+  }
+
+  std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
+  scene->creator = engine;
+  LoadedGLTF &file = *scene.get();
+  std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}};
+
+  size_t n_materials = staging.material_infos.size();
+  file.descriptor_pool.initPool(engine->m_device, n_materials, sizes);
+  for (const VkSamplerCreateInfo &ci_sampler : staging.samplers)
+    file.samplers.push_back(engine->m_assets.acquireSampler(ci_sampler));
+  // Only mip tails are uploaded here.
+  size_t n_images = staging.hashes.size();
+  std::vector<TextureHandle> images(n_images, kNoTexture);
+  for (size_t i = 0; i < n_images; i++) {
+    uint64_t hash = staging.hashes[i];
+    std::optional<TextureSource> &source = staging.sources[i];
+    if (auto cached = engine->m_assets.acquireTexture(hash)) {
+      images[i] = *cached;
     } else {
-      // we failed to load, so lets give the slot a default white texture to not
-      // completely break loading
-      images.push_back(engine->m_error_image);
-      std::cout << "gltf failed to load texture " << image.name << std::endl;
+      if (!source.has_value())
+        source = decodeImage(staging.encoded[i].bytes);
+      if (source.has_value())
+        images[i] = engine->m_assets.addTexture(hash, std::move(*source));
+    }
+    source.reset();
+    staging.encoded[i] = EncodedImage{};
+    if (images[i] != kNoTexture) {
+      file.textures.push_back(images[i]);
+    } else {
+      // we failed to load, so lets give the slot a default white texture to
+      // not completely break loading
+      std::cout << "gltf failed to load image " << i << std::endl;
     }
   }
 
   file.material_data_buffer = engine->createBuffer(
-      sizeof(GLTFMetallicRoughness::MaterialConstants) * gltf.materials.size(),
+      sizeof(GLTFMetallicRoughness::MaterialConstants) * n_materials,
       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
   GLTFMetallicRoughness::MaterialConstants *scene_material_constants =
       (GLTFMetallicRoughness::MaterialConstants *)
           file.material_data_buffer.alloc_info.pMappedData;
   int data_index = 0;
-  for (fastgltf::Material &mat : gltf.materials) {
-    std::shared_ptr<GLTFMaterial> new_mat = std::make_shared<GLTFMaterial>();
-    materials.push_back(new_mat);
-    file.materials[mat.name.c_str()] = new_mat;
-    GLTFMetallicRoughness::MaterialConstants constants;
-    constants.color_factors.x = mat.pbrData.baseColorFactor[0];
-    constants.color_factors.y = mat.pbrData.baseColorFactor[1];
-    constants.color_factors.z = mat.pbrData.baseColorFactor[2];
-    constants.color_factors.w = mat.pbrData.baseColorFactor[3];
-    constants.metal_rough_factors.x = mat.pbrData.metallicFactor;
-    constants.metal_rough_factors.y = mat.pbrData.roughnessFactor;
+  for (const StagedMaterial &mat : staging.material_infos) {
+    std::shared_ptr<GLTFMaterial> new_mat = staging.materials[data_index];
+    file.materials[mat.name] = new_mat;
     // write material parameters to buffer
-    scene_material_constants[data_index] = constants;
-    MaterialPass pass_type = MaterialPass::BasicMainColor;
-    if (mat.alphaMode == fastgltf::AlphaMode::Blend)
-      pass_type = MaterialPass::BasicTransparent;
+    scene_material_constants[data_index] = mat.constants;
+    MaterialPass pass_type = mat.pass;
     GLTFMetallicRoughness::MaterialResources material_res;
     // default the material textures
     material_res.color_image = engine->m_white_image;
@@ -236,143 +827,107 @@ loadGltf(Engine *engine, std::filesystem::path file_path) {
     material_res.data_buffer = file.material_data_buffer.buffer;
     material_res.data_buffer_offset =
         data_index * sizeof(GLTFMetallicRoughness::MaterialConstants);
-    // grab textures from gltf file
-    if (mat.pbrData.baseColorTexture.has_value()) {
-      size_t img =
-          gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex]
-              .imageIndex.value();
-      size_t sampler =
-          gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex]
-              .samplerIndex.value();
-      material_res.color_image = images[img];
-      material_res.color_sampler = file.samplers[sampler];
+    TextureHandle color_texture = kNoTexture;
+    if (mat.color_image.has_value()) {
+      color_texture = images[*mat.color_image];
+      material_res.color_image =
+          color_texture == kNoTexture
+              ? engine->m_error_image
+              : engine->m_texture_streamer.image(color_texture);
+      if (mat.color_sampler.has_value())
+        material_res.color_sampler = file.samplers[*mat.color_sampler];
     }
     // build material
     new_mat->data = engine->m_metal_rough_mat.writeMaterial(
         engine->m_device, pass_type, material_res, file.descriptor_pool);
+    if (color_texture != kNoTexture) {
+      engine->m_texture_streamer.addMaterial(
+          &new_mat->data, material_res.data_buffer,
+          material_res.data_buffer_offset, color_texture,
+          material_res.color_sampler, kNoTexture,
+          material_res.metal_rough_sampler);
+      file.streamed_materials.push_back(&new_mat->data);
+    }
     data_index++;
   }
-  // Same vectors for all meshes to avoid too much reallocation.
-  std::vector<uint32_t> indices;
-  std::vector<Vertex> vertices;
-  for (fastgltf::Mesh &mesh : gltf.meshes) {
-    std::shared_ptr<MeshAsset> new_mesh = std::make_shared<MeshAsset>();
-    meshes.push_back(new_mesh);
-    file.meshes[mesh.name.c_str()] = new_mesh;
-    new_mesh->name = mesh.name;
-    indices.clear();
-    vertices.clear();
-    for (auto &&p : mesh.primitives) {
-      GeometrySurface new_surface;
-      new_surface.start_index = (uint32_t)indices.size();
-      new_surface.count =
-          (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
-      size_t initial_vtx = vertices.size();
-      { // load indexes
-        fastgltf::Accessor &accessor =
-            gltf.accessors[p.indicesAccessor.value()];
-        indices.reserve(indices.size() + accessor.count);
-        fastgltf::iterateAccessor<std::uint32_t>(
-            gltf, accessor,
-            [&](std::uint32_t idx) { indices.push_back(idx + initial_vtx); });
-      }
-      { // load vertex positions
-        fastgltf::Accessor &posAccessor =
-            gltf.accessors[p.findAttribute("POSITION")->accessorIndex];
-        vertices.resize(vertices.size() + posAccessor.count);
-        fastgltf::iterateAccessorWithIndex<glm::vec3>(
-            gltf, posAccessor, [&](glm::vec3 v, size_t index) {
-              Vertex new_vert;
-              new_vert.position = v;
-              new_vert.normal = {1, 0, 0};
-              new_vert.color = glm::vec4{1.f};
-              new_vert.uv_x = 0;
-              new_vert.uv_y = 0;
-              vertices[initial_vtx + index] = new_vert;
-            });
-      }
-      auto normals = p.findAttribute("NORMAL");
-      if (normals != p.attributes.end()) {
-        fastgltf::iterateAccessorWithIndex<glm::vec3>(
-            gltf, gltf.accessors[(*normals).accessorIndex],
-            [&](glm::vec3 v, size_t index) {
-              vertices[initial_vtx + index].normal = v;
-            });
-      }
-      auto uv = p.findAttribute("TEXCOORD_0");
-      if (uv != p.attributes.end()) {
-        fastgltf::iterateAccessorWithIndex<glm::vec2>(
-            gltf, gltf.accessors[(*uv).accessorIndex],
-            [&](glm::vec2 v, size_t index) {
-              vertices[initial_vtx + index].uv_x = v.x;
-              vertices[initial_vtx + index].uv_y = v.y;
-            });
-      }
-      auto colors = p.findAttribute("COLOR_0");
-      if (colors != p.attributes.end()) {
-        fastgltf::iterateAccessorWithIndex<glm::vec4>(
-            gltf, gltf.accessors[(*colors).accessorIndex],
-            [&](glm::vec4 v, size_t index) {
-              vertices[initial_vtx + index].color = v;
-            });
-      }
-      if (p.materialIndex.has_value())
-        new_surface.material = materials[p.materialIndex.value()];
-      else
-        new_surface.material = materials[0];
+  for (std::shared_ptr<MeshAsset> &mesh : staging.meshes)
+    file.meshes[mesh->name] = mesh;
 
-      glm::vec3 min_pos = vertices[initial_vtx].position;
-      glm::vec3 max_pos = vertices[initial_vtx].position;
-      for (size_t i = initial_vtx; i < vertices.size(); i++) {
-        min_pos = glm::min(min_pos, vertices[i].position);
-        max_pos = glm::max(max_pos, vertices[i].position);
-      }
-      new_surface.bound.origin = 0.5f * (min_pos + max_pos);
-      new_surface.bound.radius = glm::length(0.5f * (max_pos - min_pos));
-
-      new_mesh->surfaces.push_back(new_surface);
+  std::vector<MeshGeometry> &geometries = staging.geometries;
+  uint32_t n_lods = 0;
+  size_t n_meshlets = 0;
+  size_t n_triangles_full = 0;
+  size_t n_triangles_coarsest = 0;
+  size_t index_bytes = 0;
+  size_t index_bytes_full = 0;
+  for (MeshGeometry &geometry : geometries) {
+    MeshAsset &mesh = *geometry.mesh;
+    for (const GeometrySurface &surface : mesh.surfaces) {
+      n_lods += static_cast<uint32_t>(surface.lods.size());
+      n_triangles_full += surface.count / 3;
+      n_triangles_coarsest +=
+          (surface.lods.empty() ? surface.count : surface.lods.back().count) /
+          3;
+    }
+    n_meshlets += geometry.meshlets.size();
+    fmt::println("Mesh {}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}",
+                 mesh.name, geometry.cache_before.acmr,
+                 geometry.cache_after.acmr, geometry.cache_before.atvr,
+                 geometry.cache_after.atvr);
+    file.vertex_bytes_full += geometry.vertices.size() * sizeof(Vertex);
+    if (staging.compact_vertices) {
+      file.vertex_bytes +=
+          geometry.compact_vertices.size() * sizeof(CompactVertex) +
+          geometry.colors.size() * sizeof(uint32_t);
+      mesh.mesh_buffers =
+          engine->uploadMesh(geometry.indices, geometry.compact_vertices,
+                             geometry.colors, geometry.meshlets);
+    } else {
+      file.vertex_bytes += geometry.vertices.size() * sizeof(Vertex);
+      mesh.mesh_buffers = engine->uploadMesh(
+          geometry.indices, geometry.vertices, geometry.meshlets);
     }
-    new_mesh->mesh_buffers = engine->uploadMesh(indices, vertices);
+    index_bytes_full += geometry.indices.size() * sizeof(uint32_t);
+    index_bytes += geometry.indices.size() *
+                   (mesh.mesh_buffers.index_type == VK_INDEX_TYPE_UINT16
+                        ? sizeof(uint16_t)
+                        : sizeof(uint32_t));
+    geometry = MeshGeometry{};
   }
+  fmt::println("{} LODs generated, {} triangles at full detail, {} at "
+               "coarsest",
+               n_lods, n_triangles_full, n_triangles_coarsest);
+  fmt::println("{} meshlets generated", n_meshlets);
+  fmt::println("Vertex data {} KiB, {} KiB in full layout, {:.1f}% saved",
+               file.vertex_bytes / 1024, file.vertex_bytes_full / 1024,
+               100.f - 100.f * file.vertex_bytes /
+                           std::max<size_t>(file.vertex_bytes_full, 1));
+  fmt::println("Index data {} KiB, {} KiB all 32-bit", index_bytes / 1024,
+               index_bytes_full / 1024);
   // load all nodes and their meshes
-  for (fastgltf::Node &node : gltf.nodes) {
+  std::vector<std::shared_ptr<Node>> nodes;
+  nodes.reserve(staging.nodes.size());
+  for (StagedNode &node : staging.nodes) {
     std::shared_ptr<Node> new_node;
     // find if the node has a mesh, and if it does hook it to the mesh pointer
     // and allocate it with the MeshNode class
-    if (node.meshIndex.has_value()) {
+    if (node.mesh.has_value()) {
       // MeshNode is actually created.
       new_node = std::make_shared<MeshNode>();
-      static_cast<MeshNode *>(new_node.get())->mesh = meshes[*node.meshIndex];
+      static_cast<MeshNode *>(new_node.get())->mesh =
+          staging.meshes[*node.mesh];
     } else {
       new_node = std::make_shared<Node>();
     }
     nodes.push_back(new_node);
-    file.nodes[node.name.c_str()];
-    std::visit(
-        fastgltf::visitor{
-            [&](fastgltf::math::fmat4x4 matrix) {
-              memcpy(&new_node->transform_local, matrix.data(), sizeof(matrix));
-            },
-            [&](fastgltf::TRS transform) {
-              glm::vec3 tl(transform.translation[0], transform.translation[1],
-                           transform.translation[2]);
-              glm::quat rot(transform.rotation[3], transform.rotation[0],
-                            transform.rotation[1], transform.rotation[2]);
-              glm::vec3 sc(transform.scale[0], transform.scale[1],
-                           transform.scale[2]);
-              glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
-              glm::mat4 rm = glm::toMat4(rot);
-              glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
-              new_node->transform_local = tm * rm * sm;
-            }},
-        node.transform);
+    file.nodes[node.name];
+    new_node->transform_local = node.transform;
   }
 
   // run loop again to setup transform hierarchy
-  for (size_t i = 0; i < gltf.nodes.size(); i++) {
-    fastgltf::Node &node = gltf.nodes[i];
+  for (size_t i = 0; i < staging.nodes.size(); i++) {
     std::shared_ptr<Node> &sceneNode = nodes[i];
-    for (auto &c : node.children) {
+    for (size_t c : staging.nodes[i].children) {
       sceneNode->children.push_back(nodes[c]);
       nodes[c]->parent = sceneNode;
     }
@@ -386,6 +941,14 @@ loadGltf(Engine *engine, std::filesystem::path file_path) {
   }
   return scene;
 }
+std::optional<std::shared_ptr<LoadedGLTF>>
+loadGltf(Engine *engine, std::filesystem::path file_path) {
+  std::shared_ptr<GltfStaging> staging =
+      parseGltf(engine, file_path, engine->m_compact_vertices);
+  if (!staging)
+    return {};
+  return finishGltf(engine, *staging);
+}
 
 // Load mesh data only, no materials.
 std::optional<std::vector<std::shared_ptr<MeshAsset>>>
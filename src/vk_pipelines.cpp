@@ -69,7 +69,7 @@ VkPipeline PipelineBuilder::buildPipeline(VkDevice device) {
   };
   ci_color_blend.logicOpEnable = VK_FALSE;
   ci_color_blend.logicOp = VK_LOGIC_OP_COPY;
-  ci_color_blend.attachmentCount = 1;
+  ci_color_blend.attachmentCount = ci_render.colorAttachmentCount;
   ci_color_blend.pAttachments = &color_blend_attach;
 
   // No need, vertex data is sent by array.
@@ -117,6 +117,11 @@ void PipelineBuilder::setShaders(VkShaderModule vert, VkShaderModule frag) {
   ci_shader_stages.push_back(vkinit::pipelineShaderStageCreateInfo(
       VK_SHADER_STAGE_FRAGMENT_BIT, frag));
 }
+void PipelineBuilder::setVertexShader(VkShaderModule vert) {
+  ci_shader_stages.clear();
+  ci_shader_stages.push_back(
+      vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, vert));
+}
 void PipelineBuilder::setInputTopology(VkPrimitiveTopology topology) {
   ci_input_asm.topology = topology;
   // Enable for triangle strip or line strip.